@@ -1,5 +1,6 @@
 #include "Renderer.hpp"
 
+#include <atomic>
 #include <iostream>
 #include <optional>
 
@@ -105,6 +106,32 @@ std::optional<Hit_payload> trace(
     return payload;
 }
 
+namespace {
+    // Renders started so far. The shadow cache of a thread is emptied when it first finds a new render started,
+    // so it never holds occluders of an earlier render or of a scene which was since freed.
+    std::atomic<unsigned int> render_generation = 0;
+
+    // Last object found blocking the shadow rays towards each light of the current render, per thread.
+    // Shadow rays from nearby points towards a light are mostly blocked by the same object.
+    struct Shadow_cache {
+        unsigned int generation = 0;    // render the occluders were found in
+        std::vector<std::shared_ptr<Object>> occluder_ptrs;     // by light index
+    };
+
+    Shadow_cache& shadow_cache(const Scene& scene) {
+        thread_local Shadow_cache cache;
+        const auto generation = render_generation.load(std::memory_order_relaxed);
+        if (cache.generation != generation || cache.occluder_ptrs.size() != scene.get_lights().size()) {
+            cache.generation = generation;
+            cache.occluder_ptrs.assign(scene.get_lights().size(), nullptr);
+        }
+        return cache;
+    }
+
+    // Reflection and refraction rays not cast because their weight fell below Scene::min_ray_weight, per thread
+    thread_local size_t pruned_ray_count = 0;
+}
+
 // Implementation of the Whitted-style light transport algorithm
 //
 // This function is the function that compute the color at the intersection point
@@ -119,7 +146,10 @@ std::optional<Hit_payload> trace(
 //
 // If the surface is diffuse/glossy we use the Phong illumation model to compute the color
 // at the intersection point.
-Eigen::Vector3f cast_ray( const Eigen::Vector3f& ori, const Eigen::Vector3f& dir, const Scene& scene, int depth) {
+//
+// The weight of a secondary ray is that of its parent times its fresnel factor. Rays whose weight falls
+// below scene.min_ray_weight are not cast, which cuts the branches of the ray tree that barely show.
+Eigen::Vector3f cast_ray( const Eigen::Vector3f& ori, const Eigen::Vector3f& dir, const Scene& scene, int depth, float weight) {
     // exceed max depth
     if (depth > scene.max_depth) {
         return {0.0f, 0.0f, 0.0f};
@@ -136,29 +166,45 @@ Eigen::Vector3f cast_ray( const Eigen::Vector3f& ori, const Eigen::Vector3f& dir
 
         switch (payload->obj_ptr->material_type) {
             case Material_type::REFLECTION_AND_REFRACTION: {
-                const auto reflection_dir = reflect(dir, normal).normalized();
-                const auto reflection_ray_ori = (reflection_dir.dot(normal) < 0) ?
-                                                (hit_point + normal * -scene.epsilon) :
-                                                (hit_point + normal * scene.epsilon);
-                const auto reflection_color = cast_ray(reflection_ray_ori, reflection_dir, scene, depth + 1);
-
-                const auto refraction_dir = refract(dir, normal, payload->obj_ptr->ior).normalized();
-                const auto refraction_ray_ori = (refraction_dir.dot(normal) < 0) ?
-                                                (hit_point + normal * -scene.epsilon) :
-                                                (hit_point + normal * scene.epsilon);
-                
-                const auto refraction_color = cast_ray(refraction_ray_ori, refraction_dir, scene, depth + 1);
-                
                 const auto kr = fresnel(dir, normal, payload->obj_ptr->ior);
+
+                Eigen::Vector3f reflection_color(0.0f, 0.0f, 0.0f);
+                if (weight * kr >= scene.min_ray_weight) {
+                    const auto reflection_dir = reflect(dir, normal).normalized();
+                    const auto reflection_ray_ori = (reflection_dir.dot(normal) < 0) ?
+                                                    (hit_point + normal * -scene.epsilon) :
+                                                    (hit_point + normal * scene.epsilon);
+                    reflection_color = cast_ray(reflection_ray_ori, reflection_dir, scene, depth + 1, weight * kr);
+                } else {
+                    ++pruned_ray_count;
+                }
+
+                // no refraction ray under total internal reflection, where kr is 1, unless pruning is off
+                Eigen::Vector3f refraction_color(0.0f, 0.0f, 0.0f);
+                if (weight * (1 - kr) >= scene.min_ray_weight) {
+                    const auto refraction_dir = refract(dir, normal, payload->obj_ptr->ior).normalized();
+                    const auto refraction_ray_ori = (refraction_dir.dot(normal) < 0) ?
+                                                    (hit_point + normal * -scene.epsilon) :
+                                                    (hit_point + normal * scene.epsilon);
+                    refraction_color = cast_ray(refraction_ray_ori, refraction_dir, scene, depth + 1, weight * (1 - kr));
+                } else {
+                    ++pruned_ray_count;
+                }
+
                 hit_color = reflection_color * kr + refraction_color * (1 - kr);
                 break;
             } case Material_type::REFLECTION: {
                 const auto kr = fresnel(dir, normal, payload->obj_ptr->ior);
+                if (weight * kr < scene.min_ray_weight) {
+                    ++pruned_ray_count;
+                    hit_color = Eigen::Vector3f(0.0f, 0.0f, 0.0f);
+                    break;
+                }
                 const auto reflection_dir = reflect(dir, normal).normalized();
                 const auto reflection_ray_ori = (reflection_dir.dot(normal) < 0) ?
                                                 (hit_point + normal * -scene.epsilon) :
                                                 (hit_point + normal * scene.epsilon);
-                hit_color = kr * cast_ray(reflection_ray_ori, reflection_dir, scene, depth + 1);
+                hit_color = kr * cast_ray(reflection_ray_ori, reflection_dir, scene, depth + 1, weight * kr);
                 break;
             } default: {
                 // We use the Phong illumation model for the default case. The phong model
@@ -172,15 +218,34 @@ Eigen::Vector3f cast_ray( const Eigen::Vector3f& ori, const Eigen::Vector3f& dir
 
                 // Loop over all lights in the scene and sum their contribution up
                 // We also apply the lambert cosine law
-                for (const auto& light : scene.get_lights()) {
+                const auto& lights = scene.get_lights();
+                auto& occluder_ptrs = shadow_cache(scene).occluder_ptrs;
+                for (size_t light_idx = 0; light_idx < lights.size(); ++light_idx) {
+                    const auto& light = lights[light_idx];
                     Eigen::Vector3f light_dir = light->position - hit_point;
                     // square of the distance between hitPoint and the light
                     float light_dist_squared = light_dir.squaredNorm();
                     light_dir = light_dir.normalized();
                     float l_dot_n = std::max(0.0f, light_dir.dot(normal));
+
+                    // does the object that blocked the last shadow ray towards this light block this one too?
+                    bool in_shadow = false;
+                    auto& occluder_ptr = occluder_ptrs[light_idx];
+                    if (occluder_ptr != nullptr) {
+                        float t_near = FLOAT_INFINITY;
+                        uint32_t index;
+                        Eigen::Vector2f uv;
+                        in_shadow = occluder_ptr->intersect(shadow_point_ori, light_dir, t_near, index, uv)
+                                    && t_near * t_near < light_dist_squared;
+                    }
+
                     // is the point in shadow, and is the nearest occluding object closer to the object than the light itself?
-                    auto shadow_res = trace(shadow_point_ori, light_dir, scene.get_objects());
-                    bool in_shadow = shadow_res && (shadow_res->t_near * shadow_res->t_near < light_dist_squared);
+                    if (!in_shadow) {
+                        auto shadow_res = trace(shadow_point_ori, light_dir, scene.get_objects());
+                        in_shadow = shadow_res && (shadow_res->t_near * shadow_res->t_near < light_dist_squared);
+                        if (in_shadow)
+                            occluder_ptr = shadow_res->obj_ptr;
+                    }
 
                     if (!in_shadow)
                         light_ambient += light->intensity * l_dot_n;
@@ -214,6 +279,9 @@ void Renderer::render(const Scene& scene) {
     // Use this variable as the eye position to start your rays.
     Eigen::Vector3f eye_pos(0.0f, 0.0f, 0.0f);
     int pixel_idx = 0;
+    // the shadow cache starts empty
+    render_generation.fetch_add(1, std::memory_order_relaxed);
+    pruned_ray_count = 0;
     for (int j = 0; j < scene.height; ++j) {
         for (int i = 0; i < scene.width; ++i) {
             // Find the x and y positions of the current pixel to get the direction
@@ -230,6 +298,7 @@ void Renderer::render(const Scene& scene) {
 
     update_progress(1.0f);
     std::cout << std::endl;
+    std::cout << "Pruned " << pruned_ray_count << " reflection and refraction rays weighing less than " << scene.min_ray_weight << std::endl;
 
     // save framebuffer to file with tools from stb library
     const std::string output_file_name("output.png");
@@ -19,7 +19,8 @@ std::optional<Hit_payload> trace(const Eigen::Vector3f& ori,
                                 const Eigen::Vector3f& dir,
                                 const std::vector<std::shared_ptr<Object>>& obj_ptr_list);
 
-Eigen::Vector3f cast_ray( const Eigen::Vector3f& ori, const Eigen::Vector3f& dir, const Scene& scene, int depth);
+// *weight* is the factor the returned color is scaled by in the pixel
+Eigen::Vector3f cast_ray( const Eigen::Vector3f& ori, const Eigen::Vector3f& dir, const Scene& scene, int depth, float weight = 1.0f);
 
 
 class Renderer {
@@ -15,6 +15,8 @@ public:
     Eigen::Vector3f background_color = Eigen::Vector3f(0.235294f, 0.67451f, 0.843137f);
     int max_depth = 5;
     float epsilon = 0.00001f;
+    // Reflection and refraction rays whose color would be scaled by less than this are not cast, 0 casts them all
+    float min_ray_weight = 0.0f;
 
     Scene(int w, int h) : width(w), height(h) {}
 
@@ -1,3 +1,6 @@
+#include <cstring>
+#include <string>
+
 #include "Scene.hpp"
 #include "Sphere.hpp"
 #include "Triangle.hpp"
@@ -7,8 +10,15 @@
 // In the main function of the program, we create the scene (create objects and lights)
 // as well as set the options for the render (image width and height, maximum recursion
 // depth, field-of-view, etc.). We then call the render function().
-int main() {
+//
+// Pass `--min-ray-weight <weight>` to cast reflection and refraction rays only while they weigh at least *weight*,
+// by default all of them are cast.
+int main(int argc, char** argv) {
     Scene scene(1280, 960);
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--min-ray-weight") == 0 && i + 1 < argc)
+            scene.min_ray_weight = std::stof(argv[++i]);
+    }
 
     auto sph1 = std::make_unique<Sphere>(Eigen::Vector3f(-1.0f, 0.0f, -12.0f), 2.0f);
     sph1->material_type = Material_type::DIFFUSE_AND_GLOSSY;
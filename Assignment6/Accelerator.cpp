@@ -0,0 +1,6 @@
+#include "Accelerator.hpp"
+
+Traversal_stats& Accelerator::traversal_stats() {
+    thread_local Traversal_stats stats;
+    return stats;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <optional>
+
+#include "Object.hpp"
+#include "Ray.hpp"
+#include "Bounding_box.hpp"
+#include "Intersection.hpp"
+
+// Work of traversals done by a thread, to compare the acceleration structures
+struct Traversal_stats {
+    size_t ray_num = 0;             // rays traced through the scene
+    size_t visited_node_num = 0;    // nodes or grid cells visited, over all acceleration structures
+};
+
+// Spatial index over a set of objects, which finds the closest object a ray hits
+class Accelerator {
+public:
+    enum class Type {
+        BVH,        // bounding volume hierarchy, see BVH_tree
+        KD_TREE,    // kd-tree split by the surface area heuristic, see Kd_tree
+        GRID        // uniform grid whose crowded cells hold grids of their own, see Uniform_grid
+    };
+
+    virtual ~Accelerator() = default;
+
+    [[nodiscard]] virtual std::optional<Intersection> intersect(const Ray& ray) const = 0;
+
+    [[nodiscard]] virtual Bounding_box bound() const = 0;
+
+    // Bytes taken by the structure, without the objects it refers to
+    [[nodiscard]] virtual size_t byte_size() const = 0;
+
+    // Traversal work of the calling thread so far
+    [[nodiscard]] static Traversal_stats& traversal_stats();
+};
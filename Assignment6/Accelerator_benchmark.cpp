@@ -0,0 +1,103 @@
+#include "Accelerator_benchmark.hpp"
+
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "Accelerator_factory.hpp"
+#include "Renderer.hpp"
+
+namespace {
+    struct Trace_result {
+        double rays_per_second;
+        size_t hit_num;
+        double visited_node_num_per_ray;
+    };
+
+    Trace_result trace(const Accelerator& accelerator, const std::vector<Ray>& rays) {
+        const auto stats_start = Accelerator::traversal_stats();
+        const auto start = std::chrono::steady_clock::now();
+        size_t hit_num = 0;
+        for (const auto& ray : rays) {
+            if (accelerator.intersect(ray))
+                ++hit_num;
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        const auto visited_node_num = Accelerator::traversal_stats().visited_node_num - stats_start.visited_node_num;
+        return { static_cast<double>(rays.size()) / elapsed.count(), hit_num,
+                 static_cast<double>(visited_node_num) / static_cast<double>(std::max<size_t>(rays.size(), 1)) };
+    }
+}
+
+void run_accelerator_benchmark(const Scene& scene, const std::vector<std::shared_ptr<Triangle>>& triangle_ptrs,
+                               size_t random_ray_num) {
+    auto obj_ptrs = transform_to_object_vector<Triangle>(triangle_ptrs);
+
+    std::vector<Ray> camera_rays;
+    camera_rays.reserve(static_cast<size_t>(scene.width()) * scene.height());
+    for (int j = 0; j < scene.height(); ++j) {
+        for (int i = 0; i < scene.width(); ++i)
+            camera_rays.push_back(Renderer::camera_ray(scene, i, j));
+    }
+
+    // From random points in a box twice the size of the triangles' box to random points in the triangles' box
+    Bounding_box bound;
+    for (const auto& obj_ptr : obj_ptrs)
+        bound = union_box(bound, obj_ptr->bound());
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const auto random_point = [&](float scale) {
+        const auto offset = Vector3f(dist(rng) - 0.5f, dist(rng) - 0.5f, dist(rng) - 0.5f) * scale;
+        return bound.centroid() + offset * bound.diagonal();
+    };
+    std::vector<Ray> random_rays;
+    random_rays.reserve(random_ray_num);
+    while (random_rays.size() < random_ray_num) {
+        const auto ori = random_point(2.0f);
+        const auto dir = random_point(1.0f) - ori;
+        if (dir.magnitude_squared() > 0.0f)
+            random_rays.emplace_back(ori, dir.normalized());
+    }
+
+    struct Config {
+        Accelerator::Type type;
+        BVH_tree::Split_method split_method;
+        const char* name;
+        float optimization_time = 0.0f;
+    };
+    const Config configs[] = {
+        {Accelerator::Type::BVH, BVH_tree::Split_method::NAIVE, "BVH (NAIVE)"},
+        {Accelerator::Type::BVH, BVH_tree::Split_method::SAH, "BVH (SAH)"},
+        {Accelerator::Type::BVH, BVH_tree::Split_method::SAH, "BVH (SAH+opt)", 10.0f},
+        {Accelerator::Type::BVH, BVH_tree::Split_method::LBVH, "BVH (LBVH)"},
+        {Accelerator::Type::BVH, BVH_tree::Split_method::SBVH, "BVH (SBVH)"},
+        {Accelerator::Type::KD_TREE, BVH_tree::Split_method::NAIVE, "kd-tree"},
+        {Accelerator::Type::GRID, BVH_tree::Split_method::NAIVE, "grid"},
+    };
+
+    std::vector<std::string> report;
+    for (const auto& config : configs) {
+        std::cout << " - Building " << config.name << " over " << obj_ptrs.size() << " triangles..." << std::endl;
+        const auto start = std::chrono::steady_clock::now();
+        BVH_build_params bvh_params;
+        bvh_params.optimization_time = config.optimization_time;
+        const auto accelerator_ptr = make_accelerator(config.type, obj_ptrs, config.split_method, bvh_params);
+        const auto build_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+        const auto camera = trace(*accelerator_ptr, camera_rays);
+        const auto random = trace(*accelerator_ptr, random_rays);
+
+        char line[256];
+        snprintf(line, sizeof(line), "%-13s %8i ms %8.2f MiB | camera %6.3f Mrays/s %8zu hits %6.1f nodes/ray | random %6.3f Mrays/s %8zu hits %6.1f nodes/ray",
+                 config.name, static_cast<int>(build_ms), static_cast<double>(accelerator_ptr->byte_size()) / (1 << 20),
+                 camera.rays_per_second * 1e-6, camera.hit_num, camera.visited_node_num_per_ray,
+                 random.rays_per_second * 1e-6, random.hit_num, random.visited_node_num_per_ray);
+        report.emplace_back(line);
+    }
+
+    std::cout << "\n" << camera_rays.size() << " camera rays, " << random_rays.size() << " random rays, 1 thread:\n";
+    for (const auto& line : report)
+        std::cout << line << "\n";
+    std::cout << std::flush;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Scene.hpp"
+#include "Triangle.hpp"
+
+// Build each accelerator (the BVH with each split method and with SAH optimized by treelet restructuring,
+// the kd-tree and the grid) over *triangle_ptrs*, then trace the camera rays of *scene* and *random_ray_num*
+// random rays through the triangles' box on one thread.
+// Prints the build time, the memory taken, the rays traced per second and the nodes or cells visited per ray.
+void run_accelerator_benchmark(const Scene& scene, const std::vector<std::shared_ptr<Triangle>>& triangle_ptrs,
+                               size_t random_ray_num = 1000000);
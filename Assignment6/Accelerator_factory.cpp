@@ -0,0 +1,36 @@
+#include "Accelerator_factory.hpp"
+
+#include <stdexcept>
+
+std::unique_ptr<Accelerator> make_accelerator(Accelerator::Type type, std::vector<std::shared_ptr<Object>>& obj_ptrs,
+                                               BVH_tree::Split_method split_method, const BVH_build_params& bvh_params) {
+    switch (type) {
+        case Accelerator::Type::BVH:
+            return std::make_unique<BVH_tree>(obj_ptrs, split_method, bvh_params);
+        case Accelerator::Type::KD_TREE:
+            return std::make_unique<Kd_tree>(obj_ptrs);
+        case Accelerator::Type::GRID:
+            return std::make_unique<Uniform_grid>(obj_ptrs);
+    }
+    throw std::runtime_error("unknown accelerator type");
+}
+
+const char* accelerator_type_name(Accelerator::Type type) {
+    switch (type) {
+        case Accelerator::Type::BVH:
+            return "bvh";
+        case Accelerator::Type::KD_TREE:
+            return "kd-tree";
+        case Accelerator::Type::GRID:
+            return "grid";
+    }
+    return "unknown";
+}
+
+Accelerator::Type parse_accelerator_type(const std::string& name) {
+    for (const auto type : {Accelerator::Type::BVH, Accelerator::Type::KD_TREE, Accelerator::Type::GRID}) {
+        if (name == accelerator_type_name(type))
+            return type;
+    }
+    throw std::runtime_error("unknown accelerator \"" + name + "\", expected bvh, kd-tree or grid");
+}
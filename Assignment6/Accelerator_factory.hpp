@@ -0,0 +1,20 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Accelerator.hpp"
+#include "BVH.hpp"
+#include "Kd_tree.hpp"
+#include "Uniform_grid.hpp"
+
+// Build an accelerator of *type* over *obj_ptrs*, *split_method* and *bvh_params* are used by BVH only
+[[nodiscard]] std::unique_ptr<Accelerator> make_accelerator(Accelerator::Type type, std::vector<std::shared_ptr<Object>>& obj_ptrs,
+                                                            BVH_tree::Split_method split_method = BVH_tree::Split_method::NAIVE,
+                                                            const BVH_build_params& bvh_params = {});
+
+[[nodiscard]] const char* accelerator_type_name(Accelerator::Type type);
+
+// Type named "bvh", "kd-tree" or "grid", throws std::runtime_error for other names
+[[nodiscard]] Accelerator::Type parse_accelerator_type(const std::string& name);
@@ -5,7 +5,14 @@ Area_light::Area_light(const Vector3f &pos, const Vector3f &inten)
       length(100.0f),
       normal({0.0f, -1.0f, 0.0f}),
       u({1.0f, 0.0f, 0.0f}),
-      v({1.0f, 0.0f, 0.0f}) {}
+      v({0.0f, 0.0f, 1.0f}) {}
+
+Area_light::Area_light(const Vector3f& pos, const Vector3f& inten, const Vector3f& edge_u, const Vector3f& edge_v)
+    : Light(pos, inten),
+      length(edge_u.magnitude()),
+      normal(edge_u.cross(edge_v).normalized()),
+      u(edge_u),
+      v(edge_v) {}
 
 Vector3f Area_light::random_sample_point() const {
     const auto random_u = get_random_float();
@@ -4,15 +4,29 @@
 #include "Vector.hpp"
 #include "Utility.hpp"
 
+// Rectangular light spanned by the edges *u* and *v* from its corner *position*. The renderer shades with its
+// center and casts shadow rays to stratified points on it, which gives soft shadows.
 class Area_light : public Light {
 public:
     Area_light(const Vector3f& pos, const Vector3f& inten);
+    Area_light(const Vector3f& pos, const Vector3f& inten, const Vector3f& edge_u, const Vector3f& edge_v);
 
     [[nodiscard]] Vector3f random_sample_point() const;
 
+    // Point at (*s*, *t*) in [0, 1) x [0, 1) of the extent along *u* and *v*
+    [[nodiscard]] Vector3f sample_point(float s, float t) const { return position + s * u + t * v; }
+
+    [[nodiscard]] Vector3f center() const { return sample_point(0.5f, 0.5f); }
+
 public:
     float length;
     Vector3f normal;
     Vector3f u;
     Vector3f v;
+
+    // The extent is split into strata_num x strata_num strata and a shadow ray is cast to a jittered point in each.
+    // With *adaptive* the rays to the four corner strata are cast first, and the others only when they disagree,
+    // so that points fully lit or fully in shadow take four rays and only penumbrae take them all.
+    int strata_num = 4;
+    bool adaptive = true;
 };
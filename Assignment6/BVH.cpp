@@ -1,31 +1,45 @@
 #include "BVH.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
 
 #include "Bounding_box.hpp"
 
 BVH_tree::BVH_tree() : _root_ptr(nullptr), _split_method(Split_method::NAIVE) { }
 
-BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>& obj_ptrs, Split_method split_method)
-    : _split_method(split_method) {
+BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>& obj_ptrs, Split_method split_method, const BVH_build_params& build_params)
+    : _split_method(split_method), _build_params(build_params) {
+    if (_build_params.max_leaf_size == 0)
+        throw std::runtime_error("the leaves of a BVH hold at least one object");
+
     // Record building time
-    time_t start, stop;
-    time(&start);
-    _root_ptr = recursive_build(obj_ptrs, 0, obj_ptrs.size());
-    time(&stop);
+    const auto start = std::chrono::steady_clock::now();
+    if (_split_method == Split_method::LBVH)
+        _root_ptr = build_LBVH(obj_ptrs);
+    else if (_split_method == Split_method::SBVH)
+        _root_ptr = build_SBVH(obj_ptrs);
+    else
+        _root_ptr = recursive_build(obj_ptrs, 0, obj_ptrs.size());
+    if (_build_params.optimization_time > 0.0f)
+        optimize();
+    const auto stop = std::chrono::steady_clock::now();
 
     // Print results
-    const auto diff = static_cast<float>(difftime(stop, start));
-    const auto hrs = static_cast<int>(diff / 3600.0f);
-    const auto mins = static_cast<int>(diff / 60.0f) - (hrs * 60);
-    const auto secs = static_cast<int>(diff) - (hrs * 3600) - (mins * 60);
+    const auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+    const auto hrs = static_cast<int>(diff / 3600000);
+    const auto mins = static_cast<int>(diff / 60000) - (hrs * 60);
+    const auto secs = static_cast<int>(diff / 1000) - (hrs * 3600) - (mins * 60);
+    const auto msecs = static_cast<int>(diff % 1000);
 
-    printf( "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n", hrs, mins, secs);
+    printf( "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs, %i ms\n\n", hrs, mins, secs, msecs);
 }
 
-BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>&& obj_ptrs, Split_method split_method)
-    : BVH_tree(obj_ptrs, split_method) { }
+BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>&& obj_ptrs, Split_method split_method, const BVH_build_params& build_params)
+    : BVH_tree(obj_ptrs, split_method, build_params) { }
 
 std::optional<Intersection> BVH_tree::intersect(const Ray& ray) const {
     return intersect(_root_ptr, ray);
@@ -35,6 +49,17 @@ Bounding_box BVH_tree::bound() const {
     return _root_ptr->bound;
 }
 
+size_t BVH_tree::byte_size() const {
+    return byte_size(_root_ptr);
+}
+
+size_t BVH_tree::byte_size(const std::unique_ptr<BVH_node>& node_ptr) {
+    if (node_ptr == nullptr)
+        return 0;
+    return sizeof(BVH_node) + node_ptr->obj_ptrs.capacity() * sizeof(std::shared_ptr<Object>)
+         + byte_size(node_ptr->left_ptr) + byte_size(node_ptr->right_ptr);
+}
+
 
 
 std::unique_ptr<BVH_node> BVH_tree::recursive_build(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end) {
@@ -45,157 +70,680 @@ std::unique_ptr<BVH_node> BVH_tree::recursive_build(std::vector<std::shared_ptr<
 
     // Build current node
     auto node_ptr = std::make_unique<BVH_node>();
+    for (auto i = start; i < end; ++i)
+        node_ptr->bound = union_box(node_ptr->bound, obj_ptrs[i]->bound());
+
     if (obj_span == 1) {
         // Create leaf node and return early
-        node_ptr->bound = obj_ptrs[start]->bound();
-        node_ptr->obj_ptr = obj_ptrs[start];
-    } else if (obj_span == 2) {
-        // Assign first object to left
-        node_ptr->left_ptr = std::make_unique<BVH_node>();
-        node_ptr->left_ptr->bound = obj_ptrs[start]->bound();
-        node_ptr->left_ptr->obj_ptr = obj_ptrs[start];
-
-        // Assign second object to right
-        node_ptr->right_ptr = std::make_unique<BVH_node>();
-        node_ptr->right_ptr->bound = obj_ptrs[start + 1]->bound();
-        node_ptr->right_ptr->obj_ptr = obj_ptrs[start + 1];
-
-        // Construct return node
-        node_ptr->bound = union_box(node_ptr->left_ptr->bound, node_ptr->right_ptr->bound);
-    } else {
-        // Split the objects based on chosen method
-        switch(_split_method) {
-            case Split_method::NAIVE: {
-                // Compute the union bounding box of the centroids
-                // of the bounding boxes of given range of objects.
-                Bounding_box centroid_bound;
-                for (auto i = start; i < end; ++i)
-                    centroid_bound = union_box(centroid_bound, obj_ptrs[i]->bound().centroid());
-
-                // Divide objects along the axis with max extent 
-                const auto axis = centroid_bound.max_extent();
-                const auto dim = Bounding_box::axis_to_dim(axis);
-
-                const auto iter_start = obj_ptrs.begin() + start;
-                const auto iter_end = obj_ptrs.begin() + end;
-                std::sort(iter_start, iter_end, [dim](const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs) {
-                    const auto lhs_box_centroid = lhs->bound().centroid();
-                    const auto rhs_box_centroid = rhs->bound().centroid();
-
-                    return lhs_box_centroid[dim] < rhs_box_centroid[dim];
-                });
-
-                const auto mid = start + obj_span / 2;
-                
-                // Recursively build nodes
-                node_ptr->left_ptr = recursive_build(obj_ptrs, start, mid);
-                node_ptr->right_ptr = recursive_build(obj_ptrs, mid, end);
-
-                if (node_ptr->left_ptr != nullptr) node_ptr->bound = union_box(node_ptr->bound, node_ptr->left_ptr->bound);
-                if (node_ptr->right_ptr != nullptr) node_ptr->bound = union_box(node_ptr->bound, node_ptr->right_ptr->bound);
+        node_ptr->obj_ptrs.push_back(obj_ptrs[start]);
+        return node_ptr;
+    }
 
-                break;
-            } case Split_method::SAH: {
-                constexpr int bucket_num = 16;
-
-                // Compute bounding box of all objects in BVH node
-                Bounding_box bound;
-                for (auto i = start; i < end; ++i)
-                    bound = union_box(bound, obj_ptrs[i]->bound());
-                node_ptr->bound = bound;
-
-                // Record variables
-                auto min_cost = FLOAT_INFINITY;
-                int split = -1;
-                Bounding_box::Axis axis;
-
-                // For each of the three axis x/y/z
-                const auto axis_list = {Bounding_box::Axis::AXIS_X, Bounding_box::Axis::AXIS_Y, Bounding_box::Axis::AXIS_Z};
-                for (const auto current_axis : axis_list) {
-                    const auto dim = Bounding_box::axis_to_dim(current_axis);
-
-                    std::vector<Bounding_box> box_buckets(bucket_num);
-                    std::vector<size_t> object_counters(bucket_num);
-
-                    for (auto i = start; i < end; ++i) {
-                        const auto& obj_ptr = obj_ptrs[i];
-                        const auto box = obj_ptr->bound();
-                        const auto idx = static_cast<int>(bound.offset_ratio(box.centroid())[dim] * bucket_num);
-                        box_buckets[idx] = union_box(box_buckets[idx], box);
-                        ++object_counters[idx];
-                    }
+    // Compute the union bounding box of the centroids
+    // of the bounding boxes of given range of objects.
+    Bounding_box centroid_bound;
+    for (auto i = start; i < end; ++i)
+        centroid_bound = union_box(centroid_bound, obj_ptrs[i]->bound().centroid());
+
+    // Split the objects based on chosen method
+    auto mid = start + obj_span / 2;
+    auto axis = centroid_bound.max_extent();
+    bool halve = true;
+    switch(_split_method) {
+        case Split_method::NAIVE: {
+            // Divide objects along the axis with max extent
+            break;
+        } case Split_method::SAH: {
+            constexpr int bucket_num = 16;
+            const auto& bound = node_ptr->bound;
+
+            // Record variables
+            auto min_cost = FLOAT_INFINITY;
+            int split = -1;
+            Bounding_box::Axis split_axis;
+
+            // For each of the three axis x/y/z
+            const auto axis_list = {Bounding_box::Axis::AXIS_X, Bounding_box::Axis::AXIS_Y, Bounding_box::Axis::AXIS_Z};
+            for (const auto current_axis : axis_list) {
+                const auto dim = Bounding_box::axis_to_dim(current_axis);
+
+                std::vector<Bounding_box> box_buckets(bucket_num);
+                std::vector<size_t> object_counters(bucket_num);
+
+                for (auto i = start; i < end; ++i) {
+                    const auto& obj_ptr = obj_ptrs[i];
+                    const auto box = obj_ptr->bound();
+                    // A centroid on the upper bound goes to the last bucket
+                    const auto idx = std::min(bucket_num - 1, static_cast<int>(bound.offset_ratio(box.centroid())[dim] * bucket_num));
+                    box_buckets[idx] = union_box(box_buckets[idx], box);
+                    ++object_counters[idx];
+                }
 
-                    // DP preparation
-                    // union box and count accumulation from left to right
-                    std::vector<Bounding_box> left_union_boxes(bucket_num);
-                    std::vector<size_t> left_accumulation(bucket_num, 0);
-                    for (int current_split = 1; current_split < bucket_num; ++current_split) {
-                        const auto left_last_idx = current_split - 1;
-                        const auto prev_split = current_split - 1;
-                        left_union_boxes[current_split] = union_box(box_buckets[left_last_idx], left_union_boxes[prev_split]);
-                        left_accumulation[current_split] = object_counters[left_last_idx] + left_accumulation[prev_split];
-                    }
+                // DP preparation
+                // union box and count accumulation from left to right
+                std::vector<Bounding_box> left_union_boxes(bucket_num);
+                std::vector<size_t> left_accumulation(bucket_num, 0);
+                for (int current_split = 1; current_split < bucket_num; ++current_split) {
+                    const auto left_last_idx = current_split - 1;
+                    const auto prev_split = current_split - 1;
+                    left_union_boxes[current_split] = union_box(box_buckets[left_last_idx], left_union_boxes[prev_split]);
+                    left_accumulation[current_split] = object_counters[left_last_idx] + left_accumulation[prev_split];
+                }
 
-                    std::vector<Bounding_box> right_union_boxes(bucket_num);
-                    std::vector<size_t> right_accumulation(bucket_num, 0);
-
-                    // union box and count accumulation from right to left
-                    right_union_boxes.back() = box_buckets.back();
-                    right_accumulation.back() = object_counters.back();
-                    for (int current_split = bucket_num - 2; current_split >= 1; --current_split) {
-                        const auto right_first_idx = current_split;
-                        const auto prev_split = current_split + 1;
-                        right_union_boxes[current_split] = union_box(box_buckets[right_first_idx], right_union_boxes[prev_split]);
-                        right_accumulation[current_split] = object_counters[right_first_idx] + right_accumulation[prev_split];
-                    }
+                std::vector<Bounding_box> right_union_boxes(bucket_num);
+                std::vector<size_t> right_accumulation(bucket_num, 0);
+
+                // union box and count accumulation from right to left
+                right_union_boxes.back() = box_buckets.back();
+                right_accumulation.back() = object_counters.back();
+                for (int current_split = bucket_num - 2; current_split >= 1; --current_split) {
+                    const auto right_first_idx = current_split;
+                    const auto prev_split = current_split + 1;
+                    right_union_boxes[current_split] = union_box(box_buckets[right_first_idx], right_union_boxes[prev_split]);
+                    right_accumulation[current_split] = object_counters[right_first_idx] + right_accumulation[prev_split];
+                }
 
-                    // Find out the split with minimum cost
-                    for (int current_split = 1; current_split < bucket_num; ++current_split) {
-                        const auto current_cost = left_union_boxes[current_split].surface_area() * left_accumulation[current_split]
-                                                 + right_union_boxes[current_split].surface_area() * right_accumulation[current_split];
+                // Find out the split with minimum cost, skipping those leaving a side empty
+                for (int current_split = 1; current_split < bucket_num; ++current_split) {
+                    if (left_accumulation[current_split] == 0 || right_accumulation[current_split] == 0)
+                        continue;
 
-                        if (current_cost < min_cost) {
-                            min_cost = current_cost;
-                            split = current_split;
-                            axis = current_axis;
-                        }
+                    const auto current_cost = left_union_boxes[current_split].surface_area() * left_accumulation[current_split]
+                                             + right_union_boxes[current_split].surface_area() * right_accumulation[current_split];
+
+                    if (current_cost < min_cost) {
+                        min_cost = current_cost;
+                        split = current_split;
+                        split_axis = current_axis;
                     }
                 }
+            }
 
-                assert(split != -1);
+            // All centroids fell into one bucket on every axis, halve the objects on the axis with max extent instead
+            if (split == -1)
+                break;
+            axis = split_axis;
+            const auto dim = Bounding_box::axis_to_dim(axis);
+
+            // Objects in the buckets left of the split go left
+            const auto iter_start = obj_ptrs.begin() + start;
+            const auto iter_end = obj_ptrs.begin() + end;
+            const auto comparator = [&bound, dim, split](const std::shared_ptr<Object>& obj_ptr) {
+                return std::min(bucket_num - 1, static_cast<int>(bound.offset_ratio(obj_ptr->bound().centroid())[dim] * bucket_num)) < split;
+            };
+            mid = static_cast<size_t>(std::partition(iter_start, iter_end, comparator) - obj_ptrs.begin());
+            halve = false;
+            break;
+        } case Split_method::LBVH:
+          case Split_method::SBVH: {
+            // Built by build_LBVH and build_SBVH instead
+            assert(false);
+            break;
+        }
+    }
 
-                const auto dim = Bounding_box::axis_to_dim(axis);
+    if (halve) {
+        const auto dim = Bounding_box::axis_to_dim(axis);
+        const auto iter_start = obj_ptrs.begin() + start;
+        const auto iter_end = obj_ptrs.begin() + end;
+        std::sort(iter_start, iter_end, [dim](const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs) {
+            const auto lhs_box_centroid = lhs->bound().centroid();
+            const auto rhs_box_centroid = rhs->bound().centroid();
 
-                const auto iter_start = obj_ptrs.begin() + start;
-                const auto iter_end = obj_ptrs.begin() + end;
-                std::sort(iter_start, iter_end, [dim](const auto& lhs, const auto& rhs) {
-                    return lhs->bound().centroid()[dim] < rhs->bound().centroid()[dim];
-                });
+            return lhs_box_centroid[dim] < rhs_box_centroid[dim];
+        });
+    }
 
-                // Find the mid with the split we just calculated
-                const auto threshold = bound.p_min[dim] + bound.diagonal()[dim] * (static_cast<float>(split) / static_cast<float>(bucket_num));
-                const auto comparator = [dim](const float threshold, const std::shared_ptr<Object>& obj_ptr) {
-                    return obj_ptr->bound().centroid()[dim] > threshold;
-                };
-                const auto mid = static_cast<size_t>(std::upper_bound(iter_start, std::prev(iter_end), threshold, comparator) - obj_ptrs.begin());
+    // Make a leaf if testing all objects is cheaper than the split
+    if (obj_span <= _build_params.max_leaf_size) {
+        Bounding_box left_bound, right_bound;
+        for (auto i = start; i < mid; ++i)
+            left_bound = union_box(left_bound, obj_ptrs[i]->bound());
+        for (auto i = mid; i < end; ++i)
+            right_bound = union_box(right_bound, obj_ptrs[i]->bound());
+        if (leaf_is_cheaper(node_ptr->bound, obj_span, left_bound, mid - start, right_bound, end - mid)) {
+            node_ptr->obj_ptrs.assign(obj_ptrs.begin() + start, obj_ptrs.begin() + end);
+            return node_ptr;
+        }
+    }
 
-                // Recursively build nodes
-                node_ptr->left_ptr = recursive_build(obj_ptrs, start, mid);
-                node_ptr->right_ptr = recursive_build(obj_ptrs, mid, end);
+    // Recursively build nodes
+    node_ptr->left_ptr = recursive_build(obj_ptrs, start, mid);
+    node_ptr->right_ptr = recursive_build(obj_ptrs, mid, end);
 
-                break;
+    return node_ptr;
+}
+
+bool BVH_tree::leaf_is_cheaper(const Bounding_box& bound, size_t obj_num, const Bounding_box& left_bound, size_t left_num,
+                               const Bounding_box& right_bound, size_t right_num) const {
+    if (obj_num > _build_params.max_leaf_size)
+        return false;
+
+    const auto surface_area = bound.surface_area();
+    if (surface_area <= 0.0f)
+        return true;
+
+    const auto leaf_cost = _build_params.intersection_cost * static_cast<float>(obj_num);
+    const auto split_cost = _build_params.traversal_cost + _build_params.intersection_cost
+                          * (left_bound.surface_area() * static_cast<float>(left_num)
+                             + right_bound.surface_area() * static_cast<float>(right_num)) / surface_area;
+    return leaf_cost <= split_cost;
+}
+
+float BVH_tree::sah_cost() const {
+    if (_root_ptr == nullptr || _root_ptr->bound.surface_area() <= 0.0f)
+        return 0.0f;
+    return sah_cost(_root_ptr) / _root_ptr->bound.surface_area();
+}
+
+float BVH_tree::sah_cost(const std::unique_ptr<BVH_node>& node_ptr) const {
+    if (node_ptr == nullptr)
+        return 0.0f;
+    const auto surface_area = node_ptr->bound.surface_area();
+    if (!node_ptr->obj_ptrs.empty())
+        return _build_params.intersection_cost * static_cast<float>(node_ptr->obj_ptrs.size()) * surface_area;
+    return _build_params.traversal_cost * surface_area + sah_cost(node_ptr->left_ptr) + sah_cost(node_ptr->right_ptr);
+}
+
+void BVH_tree::optimize() {
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<float>(_build_params.optimization_time));
+
+    const auto initial_cost = sah_cost();
+    auto cost = initial_cost;
+    int pass_num = 0;
+    std::unordered_map<const BVH_node*, Subtree_cost> costs;
+    while (_root_ptr != nullptr && std::chrono::steady_clock::now() < deadline) {
+        costs.clear();
+        restructure_treelets(_root_ptr, costs, deadline);
+        ++pass_num;
+
+        const auto previous_cost = cost;
+        cost = sah_cost();
+        if (cost > previous_cost * (1.0f - _build_params.min_sah_improvement))
+            break;
+    }
+
+    const auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("\rBVH treelet restructuring: SAH cost %.2f -> %.2f in %i passes, %i ms\n",
+           initial_cost, cost, pass_num, static_cast<int>(diff));
+}
+
+BVH_tree::Subtree_cost BVH_tree::restructure_treelets(std::unique_ptr<BVH_node>& node_ptr,
+                                                      std::unordered_map<const BVH_node*, Subtree_cost>& costs,
+                                                      std::chrono::steady_clock::time_point deadline) const {
+    const auto is_inner = [](const std::unique_ptr<BVH_node>& ptr) {
+        return ptr->obj_ptrs.empty() && ptr->left_ptr != nullptr && ptr->right_ptr != nullptr;
+    };
+
+    if (!is_inner(node_ptr)) {
+        const Subtree_cost leaf_cost = {sah_cost(node_ptr), node_ptr->obj_ptrs.size()};
+        costs[node_ptr.get()] = leaf_cost;
+        return leaf_cost;
+    }
+
+    const auto left_cost = restructure_treelets(node_ptr->left_ptr, costs, deadline);
+    const auto right_cost = restructure_treelets(node_ptr->right_ptr, costs, deadline);
+    const Subtree_cost current_cost = {_build_params.traversal_cost * node_ptr->bound.surface_area() + left_cost.cost + right_cost.cost,
+                                       left_cost.obj_num + right_cost.obj_num};
+    costs[node_ptr.get()] = current_cost;
+    if (std::chrono::steady_clock::now() >= deadline)
+        return current_cost;
+
+    // Grow the treelet by turning its leaf of the largest surface area into the two children of it,
+    // as a large node is the most likely to be placed better
+    std::vector<std::unique_ptr<BVH_node>*> leaf_slots = {&node_ptr->left_ptr, &node_ptr->right_ptr};
+    std::vector<std::unique_ptr<BVH_node>*> inner_slots;
+    while (leaf_slots.size() < TREELET_LEAF_NUM) {
+        int largest = -1;
+        auto largest_area = -1.0f;
+        for (size_t i = 0; i < leaf_slots.size(); ++i) {
+            const auto& leaf_ptr = *leaf_slots[i];
+            if (is_inner(leaf_ptr) && leaf_ptr->bound.surface_area() > largest_area) {
+                largest = static_cast<int>(i);
+                largest_area = leaf_ptr->bound.surface_area();
+            }
+        }
+        if (largest == -1)
+            break;
+
+        const auto slot = leaf_slots[largest];
+        inner_slots.push_back(slot);
+        leaf_slots[largest] = &(*slot)->left_ptr;
+        leaf_slots.push_back(&(*slot)->right_ptr);
+    }
+
+    // Least cost of a subtree over each subset of the leaves, subsets being bit masks. A subset of few
+    // enough objects may also collapse into a single leaf.
+    const auto leaf_num = static_cast<int>(leaf_slots.size());
+    const auto full_set = (1u << leaf_num) - 1;
+    std::array<Bounding_box, 1u << TREELET_LEAF_NUM> bounds;
+    std::array<Subtree_cost, 1u << TREELET_LEAF_NUM> subset_costs{};
+    std::array<uint32_t, 1u << TREELET_LEAF_NUM> left_subsets{};   // 0 when the subset is kept as it is or collapsed
+    std::array<bool, 1u << TREELET_LEAF_NUM> collapsed{};
+    for (uint32_t set = 1; set <= full_set; ++set) {
+        int lowest = 0;
+        while (!(set >> lowest & 1u))
+            ++lowest;
+        const auto& lowest_leaf_ptr = *leaf_slots[lowest];
+        bounds[set] = union_box(bounds[set & (set - 1)], lowest_leaf_ptr->bound);
+
+        auto& subset_cost = subset_costs[set];
+        if (set == (1u << lowest)) {
+            subset_cost = costs.at(lowest_leaf_ptr.get());
+        } else {
+            // Every split of the set into two, counted once by keeping the lowest leaf on the left
+            subset_cost.cost = std::numeric_limits<float>::infinity();
+            for (auto left = (set - 1) & set; left != 0; left = (left - 1) & set) {
+                if (!(left >> lowest & 1u))
+                    continue;
+                const auto cost = subset_costs[left].cost + subset_costs[set ^ left].cost;
+                if (cost < subset_cost.cost) {
+                    subset_cost.cost = cost;
+                    left_subsets[set] = left;
+                }
+            }
+            subset_cost.cost += _build_params.traversal_cost * bounds[set].surface_area();
+            subset_cost.obj_num = subset_costs[set & (set - 1)].obj_num + costs.at(lowest_leaf_ptr.get()).obj_num;
+        }
+
+        if (subset_cost.obj_num <= _build_params.max_leaf_size && !(set == (1u << lowest) && !is_inner(lowest_leaf_ptr))) {
+            const auto leaf_cost = _build_params.intersection_cost * static_cast<float>(subset_cost.obj_num) * bounds[set].surface_area();
+            if (leaf_cost <= subset_cost.cost) {
+                subset_cost.cost = leaf_cost;
+                collapsed[set] = true;
+            }
+        }
+    }
+
+    if (subset_costs[full_set].cost >= current_cost.cost * (1.0f - 1e-5f))
+        return current_cost;
+
+    // Take the treelet apart, then put its leaves and inner nodes back together in the new order
+    std::vector<std::unique_ptr<BVH_node>> leaf_ptrs;
+    for (const auto slot : leaf_slots)
+        leaf_ptrs.push_back(std::move(*slot));
+    std::vector<std::unique_ptr<BVH_node>> inner_ptrs;
+    for (const auto slot : inner_slots)
+        inner_ptrs.push_back(std::move(*slot));
+
+    const auto gather = [](const std::unique_ptr<BVH_node>& ptr, std::vector<std::shared_ptr<Object>>& obj_ptrs, const auto& self) -> void {
+        for (const auto& obj_ptr : ptr->obj_ptrs) {
+            // The references of an object cut by spatial splits meet again
+            if (std::find(obj_ptrs.begin(), obj_ptrs.end(), obj_ptr) == obj_ptrs.end())
+                obj_ptrs.push_back(obj_ptr);
+        }
+        if (ptr->left_ptr != nullptr)
+            self(ptr->left_ptr, obj_ptrs, self);
+        if (ptr->right_ptr != nullptr)
+            self(ptr->right_ptr, obj_ptrs, self);
+    };
+
+    // Fill *target_ptr*, bounding the leaves of *set*, with the subtree of least cost over them
+    const auto rebuild = [&](std::unique_ptr<BVH_node>& target_ptr, uint32_t set, const auto& self) -> void {
+        costs[target_ptr.get()] = subset_costs[set];
+        if (collapsed[set]) {
+            for (int leaf = 0; leaf < leaf_num; ++leaf) {
+                if (set >> leaf & 1u)
+                    gather(leaf_ptrs[leaf], target_ptr->obj_ptrs, gather);
+            }
+            target_ptr->left_ptr = nullptr;
+            target_ptr->right_ptr = nullptr;
+            return;
+        }
+
+        const auto left = left_subsets[set];
+        for (const auto& [child_ptr, subset] : {std::make_pair(&target_ptr->left_ptr, left), std::make_pair(&target_ptr->right_ptr, set ^ left)}) {
+            if ((subset & (subset - 1)) == 0 && !collapsed[subset]) {
+                int leaf = 0;
+                while (subset >> leaf != 1u)
+                    ++leaf;
+                *child_ptr = std::move(leaf_ptrs[leaf]);
+                continue;
+            }
+            if (inner_ptrs.empty()) {
+                *child_ptr = std::make_unique<BVH_node>();
+            } else {
+                *child_ptr = std::move(inner_ptrs.back());
+                inner_ptrs.pop_back();
+            }
+            (*child_ptr)->bound = bounds[subset];
+            self(*child_ptr, subset, self);
+        }
+    };
+    rebuild(node_ptr, full_set, rebuild);
+
+    return subset_costs[full_set];
+}
+
+namespace {
+    constexpr int MORTON_BITS_PER_AXIS = 21;    // 63-bit codes
+    constexpr int RADIX_BITS = 8;
+
+    // Spread the lower 21 bits of *v* so that two zero bits follow each of them
+    uint64_t expand_bits(uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffull;
+        v = (v | v << 16) & 0x1f0000ff0000ffull;
+        v = (v | v << 8) & 0x100f00f00f00f00full;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    }
+
+    // Interleave the bits of *p* quantized to 21 bits per axis, x highest
+    uint64_t morton_code(const Vector3f& p) {
+        constexpr auto scale = static_cast<float>((1u << MORTON_BITS_PER_AXIS) - 1);
+        const auto quantize = [scale](float v) { return static_cast<uint64_t>(clamp(0.0f, 1.0f, v) * scale); };
+        return expand_bits(quantize(p.x)) << 2 | expand_bits(quantize(p.y)) << 1 | expand_bits(quantize(p.z));
+    }
+}
+
+std::unique_ptr<BVH_node> BVH_tree::build_LBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs) const {
+    if (obj_ptrs.empty())
+        return nullptr;
+
+    // Bound each object once, the comparisons of the other methods call bound() again and again
+    std::vector<Morton_primitive> primitives(obj_ptrs.size());
+    Bounding_box centroid_bound;
+    for (size_t i = 0; i < obj_ptrs.size(); ++i) {
+        primitives[i].obj_idx = static_cast<uint32_t>(i);
+        primitives[i].bound = obj_ptrs[i]->bound();
+        centroid_bound = union_box(centroid_bound, primitives[i].bound.centroid());
+    }
+    for (auto& primitive : primitives)
+        primitive.code = morton_code(centroid_bound.offset_ratio(primitive.bound.centroid()));
+
+    // LSD radix sort by the codes, skipping the digits which all codes share
+    std::vector<Morton_primitive> sorted(primitives.size());
+    constexpr int bucket_count = 1 << RADIX_BITS;
+    for (int shift = 0; shift < 3 * MORTON_BITS_PER_AXIS; shift += RADIX_BITS) {
+        std::array<size_t, bucket_count + 1> offsets {};
+        for (const auto& primitive : primitives)
+            ++offsets[((primitive.code >> shift) & (bucket_count - 1)) + 1];
+        if (std::any_of(offsets.begin(), offsets.end(), [&](size_t count) { return count == primitives.size(); }))
+            continue;
+
+        for (int i = 1; i <= bucket_count; ++i)
+            offsets[i] += offsets[i - 1];
+        for (const auto& primitive : primitives)
+            sorted[offsets[(primitive.code >> shift) & (bucket_count - 1)]++] = primitive;
+        primitives.swap(sorted);
+    }
+
+    return emit_LBVH(obj_ptrs, primitives, 0, primitives.size());
+}
+
+std::unique_ptr<BVH_node> BVH_tree::emit_LBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs,
+                                              const std::vector<Morton_primitive>& primitives, size_t start, size_t end) const {
+    auto node_ptr = std::make_unique<BVH_node>();
+    const auto span = end - start;
+    if (span == 1) {
+        node_ptr->bound = primitives[start].bound;
+        node_ptr->obj_ptrs.push_back(obj_ptrs[primitives[start].obj_idx]);
+        return node_ptr;
+    }
+
+    // The codes of the range share their bits above the highest bit in which the first and the last differ,
+    // the objects whose codes have that bit set go right. Objects with equal codes are halved.
+    const auto first_code = primitives[start].code;
+    const auto last_code = primitives[end - 1].code;
+    size_t mid = start + (end - start) / 2;
+    if (first_code != last_code) {
+        uint64_t split_bit = 1ull << 63;
+        while (!((first_code ^ last_code) & split_bit))
+            split_bit >>= 1;
+        mid = static_cast<size_t>(std::partition_point(primitives.begin() + start, primitives.begin() + end,
+            [split_bit](const Morton_primitive& primitive) { return !(primitive.code & split_bit); }) - primitives.begin());
+    }
+
+    // Make a leaf if testing all objects is cheaper than the split
+    if (span <= _build_params.max_leaf_size) {
+        Bounding_box left_bound, right_bound;
+        for (auto i = start; i < mid; ++i)
+            left_bound = union_box(left_bound, primitives[i].bound);
+        for (auto i = mid; i < end; ++i)
+            right_bound = union_box(right_bound, primitives[i].bound);
+        node_ptr->bound = union_box(left_bound, right_bound);
+        if (leaf_is_cheaper(node_ptr->bound, span, left_bound, mid - start, right_bound, end - mid)) {
+            for (auto i = start; i < end; ++i)
+                node_ptr->obj_ptrs.push_back(obj_ptrs[primitives[i].obj_idx]);
+            return node_ptr;
+        }
+    }
+
+    node_ptr->left_ptr = emit_LBVH(obj_ptrs, primitives, start, mid);
+    node_ptr->right_ptr = emit_LBVH(obj_ptrs, primitives, mid, end);
+    node_ptr->bound = union_box(node_ptr->left_ptr->bound, node_ptr->right_ptr->bound);
+
+    return node_ptr;
+}
+
+namespace {
+    // Bin of the SBVH binned SAH holding *v*, the bins split [lo, lo + extent] evenly
+    int sbvh_bin_idx(float v, float lo, float extent) {
+        const auto idx = static_cast<int>((v - lo) / extent * static_cast<float>(BVH_tree::SBVH_BIN_NUM));
+        return std::max(0, std::min(BVH_tree::SBVH_BIN_NUM - 1, idx));
+    }
+
+    struct Sbvh_bin {
+        Bounding_box bound;
+        size_t entry_num = 0;   // references starting in the bin
+        size_t exit_num = 0;    // references ending in the bin
+    };
+
+    struct Sbvh_split {
+        float cost = FLOAT_INFINITY;
+        int dim = -1;
+        int bin = -1;           // first bin of the right child
+        size_t left_num = 0;
+        size_t right_num = 0;
+        Bounding_box left_bound;
+        Bounding_box right_bound;
+    };
+
+    // Update *best* with the cheapest split of *bins* on *dim* by the SAH, taking the references starting
+    // left of a split to the left child and those ending right of it to the right. Splits leaving all
+    // *ref_num* references on a side are skipped, they would not make progress.
+    void sweep_sbvh_bins(const std::array<Sbvh_bin, BVH_tree::SBVH_BIN_NUM>& bins, int dim, size_t ref_num, Sbvh_split& best) {
+        constexpr int bin_num = BVH_tree::SBVH_BIN_NUM;
+
+        // Union box and count of the right child of each split, accumulated from right to left
+        std::array<Bounding_box, bin_num> right_bounds;
+        std::array<size_t, bin_num> right_nums {};
+        Bounding_box right_bound;
+        size_t right_num = 0;
+        for (int split = bin_num - 1; split >= 1; --split) {
+            right_bound = union_box(right_bound, bins[split].bound);
+            right_num += bins[split].exit_num;
+            right_bounds[split] = right_bound;
+            right_nums[split] = right_num;
+        }
+
+        Bounding_box left_bound;
+        size_t left_num = 0;
+        for (int split = 1; split < bin_num; ++split) {
+            left_bound = union_box(left_bound, bins[split - 1].bound);
+            left_num += bins[split - 1].entry_num;
+            if (left_num == 0 || right_nums[split] == 0 || left_num == ref_num || right_nums[split] == ref_num)
+                continue;
+
+            const auto cost = left_bound.surface_area() * static_cast<float>(left_num)
+                            + right_bounds[split].surface_area() * static_cast<float>(right_nums[split]);
+            if (cost < best.cost)
+                best = {cost, dim, split, left_num, right_nums[split], left_bound, right_bounds[split]};
+        }
+    }
+}
+
+std::unique_ptr<BVH_node> BVH_tree::build_SBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs) const {
+    if (obj_ptrs.empty())
+        return nullptr;
+
+    std::vector<Spatial_reference> refs(obj_ptrs.size());
+    Bounding_box bound;
+    for (size_t i = 0; i < obj_ptrs.size(); ++i) {
+        refs[i] = {static_cast<uint32_t>(i), obj_ptrs[i]->bound()};
+        bound = union_box(bound, refs[i].bound);
+    }
+
+    const auto min_overlap_area = SBVH_MIN_OVERLAP_RATIO * bound.surface_area();
+    const auto max_added_ref_num = static_cast<size_t>(_build_params.spatial_split_budget * static_cast<float>(obj_ptrs.size()));
+    auto reference_budget = max_added_ref_num;
+    auto root_ptr = recursive_build_SBVH(obj_ptrs, std::move(refs), min_overlap_area, reference_budget);
+
+    printf("\rSBVH: %zu references to %zu objects\n", obj_ptrs.size() + max_added_ref_num - reference_budget, obj_ptrs.size());
+    return root_ptr;
+}
+
+std::unique_ptr<BVH_node> BVH_tree::recursive_build_SBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs,
+    std::vector<Spatial_reference>&& refs, float min_overlap_area, size_t& reference_budget) const {
+    auto node_ptr = std::make_unique<BVH_node>();
+    Bounding_box centroid_bound;
+    for (const auto& ref : refs) {
+        node_ptr->bound = union_box(node_ptr->bound, ref.bound);
+        centroid_bound = union_box(centroid_bound, ref.bound.centroid());
+    }
+
+    const auto ref_num = refs.size();
+    if (ref_num == 1) {
+        node_ptr->obj_ptrs.push_back(obj_ptrs[refs.front().obj_idx]);
+        return node_ptr;
+    }
+
+    // Best object split by the binned SAH over the centroids
+    Sbvh_split object_split;
+    for (int dim = 0; dim < 3; ++dim) {
+        const auto lo = centroid_bound.p_min[dim];
+        const auto extent = centroid_bound.diagonal()[dim];
+        if (extent <= 0.0f)
+            continue;
+
+        std::array<Sbvh_bin, SBVH_BIN_NUM> bins;
+        for (const auto& ref : refs) {
+            auto& bin = bins[sbvh_bin_idx(ref.bound.centroid()[dim], lo, extent)];
+            bin.bound = union_box(bin.bound, ref.bound);
+            ++bin.entry_num;
+            ++bin.exit_num;
+        }
+        sweep_sbvh_bins(bins, dim, ref_num, object_split);
+    }
+
+    // Best spatial split, where the children of the object split overlap much and the budget allows duplicates.
+    // Each reference is clipped to every bin it spans, the cut parts of an object are counted on both sides.
+    Sbvh_split spatial_split;
+    const auto overlap = intersection_box(object_split.left_bound, object_split.right_bound);
+    if (reference_budget > 0 && object_split.dim != -1 && !overlap.empty() && overlap.surface_area() > min_overlap_area) {
+        for (int dim = 0; dim < 3; ++dim) {
+            const auto lo = node_ptr->bound.p_min[dim];
+            const auto extent = node_ptr->bound.diagonal()[dim];
+            if (extent <= 0.0f)
+                continue;
+
+            std::array<Sbvh_bin, SBVH_BIN_NUM> bins;
+            for (const auto& ref : refs) {
+                const auto first_bin = sbvh_bin_idx(ref.bound.p_min[dim], lo, extent);
+                const auto last_bin = sbvh_bin_idx(ref.bound.p_max[dim], lo, extent);
+                ++bins[first_bin].entry_num;
+                ++bins[last_bin].exit_num;
+                for (auto i = first_bin; i <= last_bin; ++i) {
+                    auto slab = ref.bound;
+                    slab.p_min[dim] = std::max(slab.p_min[dim], lo + extent * static_cast<float>(i) / SBVH_BIN_NUM);
+                    slab.p_max[dim] = std::min(slab.p_max[dim], lo + extent * static_cast<float>(i + 1) / SBVH_BIN_NUM);
+                    const auto part = first_bin == last_bin ? ref.bound : obj_ptrs[ref.obj_idx]->clipped_bound(slab);
+                    if (!part.empty())
+                        bins[i].bound = union_box(bins[i].bound, part);
+                }
+            }
+            sweep_sbvh_bins(bins, dim, ref_num, spatial_split);
+        }
+        if (spatial_split.left_num + spatial_split.right_num - ref_num > reference_budget)
+            spatial_split.cost = FLOAT_INFINITY;
+    }
+
+    std::vector<Spatial_reference> left_refs, right_refs;
+    size_t added_ref_num = 0;
+    if (spatial_split.cost < object_split.cost) {
+        const auto dim = spatial_split.dim;
+        const auto lo = node_ptr->bound.p_min[dim];
+        const auto extent = node_ptr->bound.diagonal()[dim];
+        const auto plane = lo + extent * static_cast<float>(spatial_split.bin) / SBVH_BIN_NUM;
+
+        for (const auto& ref : refs) {
+            if (sbvh_bin_idx(ref.bound.p_max[dim], lo, extent) < spatial_split.bin) {
+                left_refs.push_back(ref);
+            } else if (sbvh_bin_idx(ref.bound.p_min[dim], lo, extent) >= spatial_split.bin) {
+                right_refs.push_back(ref);
+            } else {
+                // Cut the reference on the plane
+                auto left_box = ref.bound;
+                auto right_box = ref.bound;
+                left_box.p_max[dim] = plane;
+                right_box.p_min[dim] = plane;
+                left_box = obj_ptrs[ref.obj_idx]->clipped_bound(left_box);
+                right_box = obj_ptrs[ref.obj_idx]->clipped_bound(right_box);
+
+                if (!left_box.empty())
+                    left_refs.push_back({ref.obj_idx, left_box});
+                if (!right_box.empty())
+                    right_refs.push_back({ref.obj_idx, right_box});
+                if (!left_box.empty() && !right_box.empty())
+                    ++added_ref_num;
             }
         }
+    } else if (object_split.dim != -1) {
+        const auto dim = object_split.dim;
+        const auto lo = centroid_bound.p_min[dim];
+        const auto extent = centroid_bound.diagonal()[dim];
+        for (const auto& ref : refs)
+            (sbvh_bin_idx(ref.bound.centroid()[dim], lo, extent) < object_split.bin ? left_refs : right_refs).push_back(ref);
     }
 
-    return std::move(node_ptr);
+    // Halve the references if they could not be told apart, e.g. all centroids in one point
+    if (left_refs.empty() || right_refs.empty() || left_refs.size() == ref_num || right_refs.size() == ref_num) {
+        left_refs.assign(refs.begin(), refs.begin() + ref_num / 2);
+        right_refs.assign(refs.begin() + ref_num / 2, refs.end());
+        added_ref_num = 0;
+    }
+
+    // Make a leaf if testing all objects is cheaper than the split
+    if (ref_num <= _build_params.max_leaf_size) {
+        Bounding_box left_bound, right_bound;
+        for (const auto& ref : left_refs)
+            left_bound = union_box(left_bound, ref.bound);
+        for (const auto& ref : right_refs)
+            right_bound = union_box(right_bound, ref.bound);
+        if (leaf_is_cheaper(node_ptr->bound, ref_num, left_bound, left_refs.size(), right_bound, right_refs.size())) {
+            for (const auto& ref : refs)
+                node_ptr->obj_ptrs.push_back(obj_ptrs[ref.obj_idx]);
+            return node_ptr;
+        }
+    }
+    reference_budget -= added_ref_num;
+    std::vector<Spatial_reference>().swap(refs);
+
+    node_ptr->left_ptr = recursive_build_SBVH(obj_ptrs, std::move(left_refs), min_overlap_area, reference_budget);
+    node_ptr->right_ptr = recursive_build_SBVH(obj_ptrs, std::move(right_refs), min_overlap_area, reference_budget);
+
+    return node_ptr;
 }
 
 std::optional<Intersection> BVH_tree::intersect(const std::unique_ptr<BVH_node>& node_ptr, const Ray& ray) const {
+    if (node_ptr != nullptr)
+        ++traversal_stats().visited_node_num;
+
     // Traverse the BVH to check intersection
     if (node_ptr != nullptr && node_ptr->bound.intersect(ray)) {
-        if (node_ptr->left_ptr == nullptr && node_ptr->right_ptr == nullptr && node_ptr->obj_ptr != nullptr) {
-            return node_ptr->obj_ptr->intersect(ray);
+        if (!node_ptr->obj_ptrs.empty()) {
+            // Test all objects of the leaf and keep the closest hit
+            std::optional<Intersection> closest;
+            for (const auto& obj_ptr : node_ptr->obj_ptrs) {
+                auto intersection = obj_ptr->intersect(ray);
+                if (intersection && (!closest || intersection->time < closest->time))
+                    closest = std::move(intersection);
+            }
+            return closest;
         } else {
             const auto left_intersection = intersect(node_ptr->left_ptr, ray);
             const auto right_intersection = intersect(node_ptr->right_ptr, ray);
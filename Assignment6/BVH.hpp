@@ -1,11 +1,15 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <ctime>
 #include <optional>
+#include <unordered_map>
 
+#include "Accelerator.hpp"
 #include "Object.hpp"
 #include "Ray.hpp"
 #include "Bounding_box.hpp"
@@ -15,36 +19,118 @@ struct BVH_node {
     Bounding_box bound;
     std::unique_ptr<BVH_node> left_ptr;
     std::unique_ptr<BVH_node> right_ptr;
-    std::shared_ptr<Object> obj_ptr;
+    std::vector<std::shared_ptr<Object>> obj_ptrs;  // objects of a leaf, stored together and tested in a loop
 
-    BVH_node() : bound(), left_ptr(nullptr), right_ptr(nullptr), obj_ptr(nullptr) { }
+    BVH_node() : bound(), left_ptr(nullptr), right_ptr(nullptr) { }
 };
 
-class BVH_tree {
+// Build settings. The costs are weighed by the surface area heuristic relative to each other: a range of
+// objects becomes a leaf when testing all of them costs less than a split into two children.
+struct BVH_build_params {
+    float traversal_cost = 1.0f;        // of testing a ray against the bounds of a node
+    float intersection_cost = 1.0f;     // of testing a ray against an object of a leaf
+    size_t max_leaf_size = 4;           // objects in a leaf at most
+    // Used by SBVH only: the number of object references spatial splits may add, as a fraction of the number
+    // of objects. It bounds the memory taken beyond an object partition.
+    float spatial_split_budget = 0.3f;
+    // Seconds spent after the build restructuring treelets to lower the SAH cost of the tree, 0 for none.
+    // Passes over the tree stop early once one lowers the cost by less than min_sah_improvement of it.
+    float optimization_time = 0.0f;
+    float min_sah_improvement = 0.001f;
+};
+
+class BVH_tree : public Accelerator {
 public:
     enum class Split_method { 
         NAIVE,  // do bisection based on the axis that brings the max extent.
-        SAH     // do partition with Surface Area Heuristic
+        SAH,    // do partition with Surface Area Heuristic
+        LBVH,   // sort the objects once by the Morton codes of their centroids, then split each range
+                // where the highest bit in which its codes differ flips
+        SBVH    // SAH over object partitions and over spatial splits, which cut the objects straddling the
+                // plane into a part on each side referenced by both children
     };
 
+    // Bins per axis of the binned SAH of SBVH
+    static constexpr int SBVH_BIN_NUM = 32;
+    // Spatial splits are only tried in nodes whose best object split has children overlapping by more than
+    // this fraction of the surface area of the whole tree
+    static constexpr float SBVH_MIN_OVERLAP_RATIO = 1e-5f;
+    // Subtrees below the root of a treelet whose topology is rebuilt by the optimization
+    static constexpr int TREELET_LEAF_NUM = 7;
+
     BVH_tree();
     BVH_tree(std::vector<std::shared_ptr<Object>>& obj_ptrs,
-            Split_method split_method = Split_method::NAIVE);
+            Split_method split_method = Split_method::NAIVE, const BVH_build_params& build_params = {});
     BVH_tree(std::vector<std::shared_ptr<Object>>&& obj_ptrs,
-            Split_method split_method = Split_method::NAIVE);
+            Split_method split_method = Split_method::NAIVE, const BVH_build_params& build_params = {});
 
-    [[nodiscard]] std::optional<Intersection> intersect(const Ray &ray) const;
+    [[nodiscard]] std::optional<Intersection> intersect(const Ray &ray) const override;
 
-    [[nodiscard]] Bounding_box bound() const;
+    [[nodiscard]] Bounding_box bound() const override;
+
+    [[nodiscard]] size_t byte_size() const override;
 
     [[nodiscard]] Split_method split_method() const { return _split_method; }
 
+    // Expected cost of tracing a ray through the tree by the surface area heuristic, relative to the root
+    [[nodiscard]] float sah_cost() const;
+
 private:
     [[nodiscard]] std::unique_ptr<BVH_node> recursive_build(std::vector<std::shared_ptr<Object>>& obj_ptr_list, size_t start, size_t end);
 
+    // Whether *obj_num* objects in *bound* cost less in a leaf than split into children with
+    // *left_num* objects in *left_bound* and *right_num* objects in *right_bound*
+    [[nodiscard]] bool leaf_is_cheaper(const Bounding_box& bound, size_t obj_num, const Bounding_box& left_bound, size_t left_num,
+                                       const Bounding_box& right_bound, size_t right_num) const;
+
+    // Object of a leaf of the LBVH with its Morton code and bounding box
+    struct Morton_primitive {
+        uint64_t code;
+        uint32_t obj_idx;
+        Bounding_box bound;
+    };
+
+    [[nodiscard]] std::unique_ptr<BVH_node> build_LBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs) const;
+
+    // Build the subtree of the range [start, end) of *primitives*, sorted by their codes
+    [[nodiscard]] std::unique_ptr<BVH_node> emit_LBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs,
+                                                             const std::vector<Morton_primitive>& primitives, size_t start, size_t end) const;
+
+    // Part of an object referenced by a node of the SBVH
+    struct Spatial_reference {
+        uint32_t obj_idx;
+        Bounding_box bound;
+    };
+
+    [[nodiscard]] std::unique_ptr<BVH_node> build_SBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs) const;
+
+    // Build the subtree of *refs*, adding at most *reference_budget* references by spatial splits,
+    // and take the references added off the budget
+    [[nodiscard]] std::unique_ptr<BVH_node> recursive_build_SBVH(const std::vector<std::shared_ptr<Object>>& obj_ptrs,
+        std::vector<Spatial_reference>&& refs, float min_overlap_area, size_t& reference_budget) const;
+
+    [[nodiscard]] float sah_cost(const std::unique_ptr<BVH_node>& node_ptr) const;
+
+    // Restructure treelets until *optimization_time* of the build params has passed or a pass stops paying off
+    void optimize();
+
+    // SAH cost of a subtree, not divided by the surface area of the root, and the objects below it
+    struct Subtree_cost {
+        float cost;
+        size_t obj_num;
+    };
+
+    // Bottom-up pass over the subtree of *node_ptr* that replaces the treelet below each node by the one of
+    // least SAH cost over the same leaves, unless *deadline* has passed. Keeps the cost of each subtree in *costs*.
+    Subtree_cost restructure_treelets(std::unique_ptr<BVH_node>& node_ptr, std::unordered_map<const BVH_node*, Subtree_cost>& costs,
+                                      std::chrono::steady_clock::time_point deadline) const;
+
     [[nodiscard]] std::optional<Intersection> intersect(const std::unique_ptr<BVH_node>& node_ptr, const Ray& ray) const;
 
+    [[nodiscard]] static size_t byte_size(const std::unique_ptr<BVH_node>& node_ptr);
+
 private:
     std::unique_ptr<BVH_node> _root_ptr;
     Split_method _split_method;
+    BVH_build_params _build_params;
 };
\ No newline at end of file
@@ -11,6 +11,11 @@ Bounding_box::Axis Bounding_box::max_extent() const {
 }
 
 bool Bounding_box::intersect(const Ray& ray) const {
+    float t_enter, t_exit;
+    return intersect(ray, t_enter, t_exit);
+}
+
+bool Bounding_box::intersect(const Ray& ray, float& t_enter, float& t_exit) const {
     // Test if ray bound intersects
     const auto t_pmax = (p_max - ray.ori) * ray.inv_dir;
     const auto t_pmin = (p_min - ray.ori) * ray.inv_dir;
@@ -19,8 +24,8 @@ bool Bounding_box::intersect(const Ray& ray) const {
     const auto t_min = point_with_min_coords(t_pmin, t_pmax);
     const auto t_max = point_with_max_coords(t_pmin, t_pmax);
 
-    const auto t_enter = fmax(fmax(t_min.x, t_min.y), t_min.z);
-    const auto t_exit  = fmin(fmin(t_max.x, t_max.y), t_max.z);
+    t_enter = fmax(fmax(t_min.x, t_min.y), t_min.z);
+    t_exit  = fmin(fmin(t_max.x, t_max.y), t_max.z);
 
     return (t_exit > t_enter) && (t_exit > 0);
 }
@@ -53,6 +53,8 @@ struct Bounding_box {
     }
 
     [[nodiscard]] bool intersect(const Ray& ray) const;
+    // Also give the times the ray enters and exits the box, *t_enter* is negative if the ray starts inside
+    [[nodiscard]] bool intersect(const Ray& ray, float& t_enter, float& t_exit) const;
 
     // offset ratio from *p_min* to *p_max* on each axis
     [[nodiscard]] Vector3f offset_ratio(const Vector3f& p) const;
@@ -64,6 +66,9 @@ struct Bounding_box {
         return (x && y && z);
     }
 
+    // Whether the box contains no point, as the default box or a box of disjoint boxes' intersection
+    [[nodiscard]] bool empty() const { return p_min.x > p_max.x || p_min.y > p_max.y || p_min.z > p_max.z; }
+
     [[nodiscard]] bool inside(const Vector3f& p) const {
         return p.x >= p_min.x && p.x <= p_max.x
             && p.y >= p_min.y && p.y <= p_max.y
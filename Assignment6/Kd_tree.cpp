@@ -0,0 +1,200 @@
+#include "Kd_tree.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+Kd_tree::Kd_tree(const std::vector<std::shared_ptr<Object>>& obj_ptrs, const Kd_tree_build_params& build_params)
+    : _build_params(build_params), _obj_ptrs(obj_ptrs) {
+    // Record building time
+    const auto start = std::chrono::steady_clock::now();
+
+    _obj_bounds.reserve(_obj_ptrs.size());
+    for (const auto& obj_ptr : _obj_ptrs) {
+        _obj_bounds.push_back(obj_ptr->bound());
+        _bound = union_box(_bound, _obj_bounds.back());
+    }
+
+    auto max_depth = _build_params.max_depth;
+    if (max_depth <= 0)
+        max_depth = static_cast<int>(std::round(8.0f + 1.3f * std::log2(static_cast<float>(std::max<size_t>(_obj_ptrs.size(), 1)))));
+    max_depth = std::min(max_depth, MAX_DEPTH);
+
+    if (!_obj_ptrs.empty()) {
+        std::vector<uint32_t> obj_indices(_obj_ptrs.size());
+        for (size_t i = 0; i < obj_indices.size(); ++i)
+            obj_indices[i] = static_cast<uint32_t>(i);
+        std::array<std::vector<Edge>, 3> edges;
+        build(_bound, obj_indices, max_depth, 0, edges);
+    }
+    std::vector<Bounding_box>().swap(_obj_bounds);
+    const auto stop = std::chrono::steady_clock::now();
+
+    const auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+    printf("\rKd-tree generation complete: %zu nodes, %zu object references, %i ms\n\n",
+           _nodes.size(), _obj_indices.size(), static_cast<int>(diff));
+}
+
+size_t Kd_tree::byte_size() const {
+    return _nodes.size() * sizeof(Node) + _obj_indices.size() * sizeof(uint32_t)
+         + _obj_ptrs.size() * sizeof(std::shared_ptr<Object>);
+}
+
+void Kd_tree::make_leaf(const std::vector<uint32_t>& obj_indices) {
+    auto& node = _nodes.back();
+    node.first_obj_idx = static_cast<uint32_t>(_obj_indices.size());
+    node.flags = LEAF | static_cast<uint32_t>(obj_indices.size()) << 2;
+    _obj_indices.insert(_obj_indices.end(), obj_indices.begin(), obj_indices.end());
+}
+
+void Kd_tree::build(const Bounding_box& node_bound, const std::vector<uint32_t>& obj_indices, int depth, int bad_refine_num,
+                    std::array<std::vector<Edge>, 3>& edges) {
+    const auto node_idx = _nodes.size();
+    _nodes.emplace_back();
+
+    const auto obj_num = obj_indices.size();
+    if (obj_num <= _build_params.max_leaf_size || depth == 0) {
+        make_leaf(obj_indices);
+        return;
+    }
+
+    // Sweep the edges of the objects on each axis, starting from the one of max extent, and keep the plane
+    // of the lowest cost. Objects starting before a plane go below it, objects ending after it go above.
+    auto best_cost = FLOAT_INFINITY;
+    int best_axis = -1;
+    size_t best_offset = 0;
+    const auto leaf_cost = _build_params.intersection_cost * static_cast<float>(obj_num);
+    const auto inv_surface_area = 1.0f / node_bound.surface_area();
+    const auto d = node_bound.diagonal();
+
+    const auto first_axis = Bounding_box::axis_to_dim(node_bound.max_extent());
+    for (int retry = 0; retry < 3 && best_axis == -1; ++retry) {
+        const auto axis = (first_axis + retry) % 3;
+        auto& axis_edges = edges[axis];
+        axis_edges.clear();
+        for (const auto obj_idx : obj_indices) {
+            axis_edges.push_back({_obj_bounds[obj_idx].p_min[axis], obj_idx, true});
+            axis_edges.push_back({_obj_bounds[obj_idx].p_max[axis], obj_idx, false});
+        }
+        std::sort(axis_edges.begin(), axis_edges.end());
+
+        const auto other_axis0 = (axis + 1) % 3;
+        const auto other_axis1 = (axis + 2) % 3;
+        const auto cap_area = d[other_axis0] * d[other_axis1];
+        const auto side_length = d[other_axis0] + d[other_axis1];
+        size_t below_num = 0;
+        size_t above_num = obj_num;
+        for (size_t i = 0; i < axis_edges.size(); ++i) {
+            const auto& edge = axis_edges[i];
+            if (!edge.start)
+                --above_num;
+
+            if (edge.pos > node_bound.p_min[axis] && edge.pos < node_bound.p_max[axis]) {
+                const auto below_area = 2.0f * (cap_area + (edge.pos - node_bound.p_min[axis]) * side_length);
+                const auto above_area = 2.0f * (cap_area + (node_bound.p_max[axis] - edge.pos) * side_length);
+                const auto empty_bonus = (below_num == 0 || above_num == 0) ? _build_params.empty_bonus : 0.0f;
+                const auto cost = _build_params.traversal_cost + _build_params.intersection_cost * (1.0f - empty_bonus)
+                                * (below_area * static_cast<float>(below_num) + above_area * static_cast<float>(above_num)) * inv_surface_area;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_offset = i;
+                }
+            }
+
+            if (edge.start)
+                ++below_num;
+        }
+    }
+
+    if (best_cost > leaf_cost)
+        ++bad_refine_num;
+    if ((best_cost > 4.0f * leaf_cost && obj_num < 16) || best_axis == -1 || bad_refine_num == 3) {
+        make_leaf(obj_indices);
+        return;
+    }
+
+    // Split the objects on the plane
+    const auto& axis_edges = edges[best_axis];
+    std::vector<uint32_t> below_indices, above_indices;
+    for (size_t i = 0; i < best_offset; ++i) {
+        if (axis_edges[i].start)
+            below_indices.push_back(axis_edges[i].obj_idx);
+    }
+    for (auto i = best_offset + 1; i < axis_edges.size(); ++i) {
+        if (!axis_edges[i].start)
+            above_indices.push_back(axis_edges[i].obj_idx);
+    }
+
+    const auto split = axis_edges[best_offset].pos;
+    auto below_bound = node_bound;
+    auto above_bound = node_bound;
+    below_bound.p_max[best_axis] = split;
+    above_bound.p_min[best_axis] = split;
+
+    build(below_bound, below_indices, depth - 1, bad_refine_num, edges);
+    auto& node = _nodes[node_idx];
+    node.split = split;
+    node.flags = static_cast<uint32_t>(best_axis) | static_cast<uint32_t>(_nodes.size()) << 2;
+    build(above_bound, above_indices, depth - 1, bad_refine_num, edges);
+}
+
+std::optional<Intersection> Kd_tree::intersect(const Ray& ray) const {
+    float t_min, t_max;
+    if (_nodes.empty() || !_bound.intersect(ray, t_min, t_max))
+        return std::nullopt;
+    t_min = std::max(t_min, 0.0f);
+
+    // Far children still to visit with the part of the ray inside them
+    struct Pending_node {
+        uint32_t node_idx;
+        float t_min, t_max;
+    };
+    std::array<Pending_node, MAX_DEPTH> pending_nodes;
+    int pending_num = 0;
+
+    auto& stats = traversal_stats();
+    std::optional<Intersection> closest;
+    uint32_t node_idx = 0;
+    while (true) {
+        // The remaining nodes are all behind the closest hit
+        if (closest && closest->time < t_min)
+            break;
+
+        ++stats.visited_node_num;
+        const auto& node = _nodes[node_idx];
+        if (!node.leaf()) {
+            // Visit the child on the side of the ray origin first, and the other one if the ray crosses the plane
+            const auto axis = node.axis();
+            const auto t_plane = (node.split - ray.ori[axis]) * ray.inv_dir[axis];
+            const bool below_first = ray.ori[axis] < node.split || (ray.ori[axis] == node.split && ray.dir[axis] <= 0.0f);
+            const auto first_child = below_first ? node_idx + 1 : node.above_child();
+            const auto second_child = below_first ? node.above_child() : node_idx + 1;
+
+            if (t_plane > t_max || t_plane <= 0.0f) {
+                node_idx = first_child;
+            } else if (t_plane < t_min) {
+                node_idx = second_child;
+            } else {
+                pending_nodes[pending_num++] = {second_child, t_plane, t_max};
+                node_idx = first_child;
+                t_max = t_plane;
+            }
+        } else {
+            for (uint32_t i = 0; i < node.obj_num(); ++i) {
+                auto intersection = _obj_ptrs[_obj_indices[node.first_obj_idx + i]]->intersect(ray);
+                if (intersection && (!closest || intersection->time < closest->time))
+                    closest = std::move(intersection);
+            }
+
+            if (pending_num == 0)
+                break;
+            --pending_num;
+            node_idx = pending_nodes[pending_num].node_idx;
+            t_min = pending_nodes[pending_num].t_min;
+            t_max = pending_nodes[pending_num].t_max;
+        }
+    }
+
+    return closest;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Accelerator.hpp"
+#include "Object.hpp"
+
+// Build settings of the kd-tree. The costs are weighed by the surface area heuristic relative to each other.
+struct Kd_tree_build_params {
+    float traversal_cost = 1.0f;        // of stepping into a node
+    float intersection_cost = 8.0f;     // of testing a ray against an object of a leaf
+    float empty_bonus = 0.5f;           // share of the cost saved by a split leaving one side empty
+    size_t max_leaf_size = 1;           // objects below which a node is not split further
+    int max_depth = 0;                  // 0 for 8 + 1.3 log2(object count), at most MAX_DEPTH
+};
+
+// Kd-tree over the objects: each node splits its box in two on one axis, at the plane where the surface area
+// heuristic is lowest. Objects straddling the plane are referenced by both children. The nodes are stored in
+// one array of 8 bytes each, the below child right after its parent. Rays visit the leaves they pass through
+// front to back and stop at the first leaf ending beyond their closest hit.
+class Kd_tree : public Accelerator {
+public:
+    // Deepest the tree may go, also the size of the traversal stack
+    static constexpr int MAX_DEPTH = 64;
+
+    explicit Kd_tree(const std::vector<std::shared_ptr<Object>>& obj_ptrs, const Kd_tree_build_params& build_params = {});
+
+    [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray) const override;
+
+    [[nodiscard]] Bounding_box bound() const override { return _bound; }
+
+    [[nodiscard]] size_t byte_size() const override;
+
+private:
+    static constexpr uint32_t LEAF = 3;     // in the place of the axis
+
+    struct Node {
+        union {
+            float split;                // position of the plane on the axis, in an interior node
+            uint32_t first_obj_idx;     // first of the leaf's entries of *_obj_indices*, in a leaf
+        };
+        // lowest 2 bits: axis or LEAF, the rest: index of the above child, or object count of the leaf
+        uint32_t flags;
+
+        [[nodiscard]] bool leaf() const { return (flags & 3u) == LEAF; }
+        [[nodiscard]] int axis() const { return static_cast<int>(flags & 3u); }
+        [[nodiscard]] uint32_t above_child() const { return flags >> 2; }
+        [[nodiscard]] uint32_t obj_num() const { return flags >> 2; }
+    };
+
+    // Start or end of the bound of an object on an axis, swept over to find the cheapest split
+    struct Edge {
+        float pos;
+        uint32_t obj_idx;
+        bool start;
+
+        // starts before ends at the same position
+        bool operator<(const Edge& rhs) const { return pos != rhs.pos ? pos < rhs.pos : start > rhs.start; }
+    };
+
+    // Build the subtree of the objects *obj_indices* in *node_bound*, at most *depth* levels deep.
+    // *bad_refine_num* counts the splits on the path which did not lower the cost, the tree is allowed a few
+    // of them to get past local minima. *edges* is scratch space for each axis, shared by all nodes.
+    void build(const Bounding_box& node_bound, const std::vector<uint32_t>& obj_indices, int depth, int bad_refine_num,
+               std::array<std::vector<Edge>, 3>& edges);
+
+    void make_leaf(const std::vector<uint32_t>& obj_indices);
+
+private:
+    Kd_tree_build_params _build_params;
+    std::vector<std::shared_ptr<Object>> _obj_ptrs;
+    std::vector<Bounding_box> _obj_bounds;      // only kept while building
+    std::vector<uint32_t> _obj_indices;         // objects of the leaves, each leaf's together
+    std::vector<Node> _nodes;
+    Bounding_box _bound;
+};
@@ -6,6 +6,7 @@ class Light {
 public:
     Light(const Vector3f& pos, const Vector3f& inten)
      : position(pos), intensity(inten) {}
+    virtual ~Light() = default;
 
     Vector3f position;
     Vector3f intensity;
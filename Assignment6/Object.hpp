@@ -16,6 +16,10 @@ public:
 
     [[nodiscard]] virtual std::optional<Intersection> intersect(const Ray& ray) = 0;
     [[nodiscard]] virtual Bounding_box bound() const = 0;
+
+    // Bounding box of the part of the object inside *box*, used to split the object between nodes of spatial-split
+    // BVHs. The default overlap of the boxes never misses a part of the object, but may be loose.
+    [[nodiscard]] virtual Bounding_box clipped_bound(const Bounding_box& box) const { return intersection_box(bound(), box); }
 };
 
 // Deal with polymorphism
@@ -1,35 +1,163 @@
 #include "Renderer.hpp"
 
+#include <atomic>
+#include <cstring>
+
+#include "Area_light.hpp"
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+namespace {
+    // Renders started so far. The shadow cache of a thread is emptied when it first finds a new render started,
+    // so it never holds occluders of an earlier render or of a scene which was since freed.
+    std::atomic<unsigned int> render_generation = 0;
+
+    // Last object found blocking the shadow rays towards each light of the current render, per thread
+    struct Shadow_cache {
+        unsigned int generation = 0;    // render the occluders were found in
+        std::vector<std::shared_ptr<Object>> occluder_ptrs;     // by light index
+    };
+
+    Shadow_cache& shadow_cache(const Scene& scene) {
+        thread_local Shadow_cache cache;
+        const auto generation = render_generation.load(std::memory_order_relaxed);
+        if (cache.generation != generation || cache.occluder_ptrs.size() != scene.lights().size()) {
+            cache.generation = generation;
+            cache.occluder_ptrs.assign(scene.lights().size(), nullptr);
+        }
+        return cache;
+    }
+
+    // Work of the renderer done by the calling thread so far
+    Render_stats& thread_render_stats() {
+        thread_local Render_stats stats;
+        return stats;
+    }
+
+    // Whether nothing blocks the segment from *ori* to *target*. Shadow rays from nearby points towards a light
+    // are mostly blocked by the same object, so *occluder_ptr*, the last one found, is tested first, and the
+    // scene is only searched when it misses.
+    bool is_visible(const Scene& scene, const Vector3f& ori, const Vector3f& target, std::shared_ptr<Object>& occluder_ptr) {
+        const auto to_target = target - ori;
+        const auto dist_sq = to_target.magnitude_squared();
+        const Ray shadow_ray(ori, to_target.normalized());
+        auto& stats = thread_render_stats();
+        ++stats.shadow_ray_num;
+
+        // the direction vector of a ray has magnitude of 1, so the time value in the intersection record can be used as distance.
+        if (occluder_ptr != nullptr) {
+            const auto occluder_res = occluder_ptr->intersect(shadow_ray);
+            if (occluder_res && occluder_res->time * occluder_res->time < dist_sq) {
+                ++stats.shadow_cache_hit_num;
+                return false;
+            }
+        }
+
+        const auto shadow_res = scene.intersect(shadow_ray);
+        if (!shadow_res || shadow_res->time * shadow_res->time >= dist_sq)
+            return true;
+        occluder_ptr = shadow_res->obj_ptr;
+        return false;
+    }
+
+    uint32_t hash(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    // Hash of the bits of a point, which seeds the jitter of the shadow rays cast from it. The image then does
+    // not depend on which thread renders which tile.
+    uint32_t hash(const Vector3f& p) {
+        uint32_t bits[3];
+        std::memcpy(&bits[0], &p.x, sizeof(float));
+        std::memcpy(&bits[1], &p.y, sizeof(float));
+        std::memcpy(&bits[2], &p.z, sizeof(float));
+        return hash(bits[0] ^ hash(bits[1] ^ hash(bits[2])));
+    }
+
+    // Uniform float in [0, 1) from the upper 24 bits of *x*
+    float to_unit_float(uint32_t x) {
+        return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+    }
+}
+
 void Renderer::render(const Scene& scene) {
+    // the threads start with an empty shadow cache
+    render_generation.fetch_add(1, std::memory_order_relaxed);
+
     const auto scene_size = scene.width() * scene.height();
     std::vector<Vector3f> framebuffer(scene_size);
 
-    float scale = std::tan(degree_to_rad(scene.fov() * 0.5f));
-    float image_aspect_ratio = static_cast<float>(scene.width()) / static_cast<float>(scene.height());
+    const int tile_count_x = (scene.width() + TILE_SIZE - 1) / TILE_SIZE;
+    const int tile_count_y = (scene.height() + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<Progress_counter> progress_counters(_thread_pool.thread_count());
 
-    // Use this variable as the eye position to start your rays.
-    Vector3f eye_pos(-1.0f, 5.0f, 10.0f);
-    int pixel_idx = 0;
-    for (uint32_t j = 0; j < scene.height(); ++j) {
-        for (uint32_t i = 0; i < scene.width(); ++i) {
-            // generate primary ray direction
-            const auto x = (2 * (static_cast<float>(i) + 0.5f) / static_cast<float>(scene.width()) - 1.0f) * scale * image_aspect_ratio;
-            const auto y = (1.0f - 2 * (static_cast<float>(j) + 0.5f) / static_cast<float>(scene.height())) * scale;
-            
-            const auto dir = Vector3f(x, y, -1.0f).normalized();
-            const Ray ray(eye_pos, dir);
-            // Ray stops transport after its first hit in Whitted-syle light transport algorithm, so input max depth should be 0.
-            framebuffer[pixel_idx++] = cast_ray(scene, ray, 0);
+    const auto render_tile = [&](unsigned int thread_idx, size_t tile_idx) {
+        const auto traversal_stats_start = Accelerator::traversal_stats();
+        const auto render_stats_start = thread_render_stats();
+        const int tile_x = static_cast<int>(tile_idx % tile_count_x) * TILE_SIZE;
+        const int tile_y = static_cast<int>(tile_idx / tile_count_x) * TILE_SIZE;
+        const int tile_end_x = std::min(tile_x + TILE_SIZE, scene.width());
+        const int tile_end_y = std::min(tile_y + TILE_SIZE, scene.height());
+
+        for (int j = tile_y; j < tile_end_y; ++j) {
+            for (int i = tile_x; i < tile_end_x; ++i) {
+                const auto ray = camera_ray(scene, i, j);
+                // Ray stops transport after its first hit in Whitted-syle light transport algorithm, so input max depth should be 0.
+                framebuffer[j * scene.width() + i] = cast_ray(scene, ray, 0);
+            }
         }
-        update_progress(static_cast<float>(j) / static_cast<float>(scene.height()));
-    }
+
+        const auto& traversal_stats = Accelerator::traversal_stats();
+        auto& tile_traversal_stats = progress_counters[thread_idx].traversal_stats;
+        tile_traversal_stats.ray_num += traversal_stats.ray_num - traversal_stats_start.ray_num;
+        tile_traversal_stats.visited_node_num += traversal_stats.visited_node_num - traversal_stats_start.visited_node_num;
+        const auto& render_stats = thread_render_stats();
+        auto& tile_render_stats = progress_counters[thread_idx].render_stats;
+        tile_render_stats.shadow_ray_num += render_stats.shadow_ray_num - render_stats_start.shadow_ray_num;
+        tile_render_stats.shadow_cache_hit_num += render_stats.shadow_cache_hit_num - render_stats_start.shadow_cache_hit_num;
+        tile_render_stats.pruned_ray_num += render_stats.pruned_ray_num - render_stats_start.pruned_ray_num;
+
+        // Only this thread writes its counter
+        auto& pixel_count = progress_counters[thread_idx].pixel_count;
+        pixel_count.store(pixel_count.load(std::memory_order_relaxed) + (tile_end_x - tile_x) * (tile_end_y - tile_y),
+                          std::memory_order_relaxed);
+    };
+
+    const auto show_progress = [&]() {
+        size_t pixel_count = 0;
+        for (const auto& counter : progress_counters)
+            pixel_count += counter.pixel_count.load(std::memory_order_relaxed);
+        update_progress(static_cast<float>(pixel_count) / static_cast<float>(scene_size));
+    };
+
+    _thread_pool.parallel_for(static_cast<size_t>(tile_count_x) * tile_count_y, render_tile, show_progress);
 
     update_progress(1.0f);
     std::cout << std::endl;
 
+    Traversal_stats traversal_stats;
+    Render_stats render_stats;
+    for (const auto& counter : progress_counters) {
+        traversal_stats.ray_num += counter.traversal_stats.ray_num;
+        traversal_stats.visited_node_num += counter.traversal_stats.visited_node_num;
+        render_stats.shadow_ray_num += counter.render_stats.shadow_ray_num;
+        render_stats.shadow_cache_hit_num += counter.render_stats.shadow_cache_hit_num;
+        render_stats.pruned_ray_num += counter.render_stats.pruned_ray_num;
+    }
+    std::cout << " - Traced " << traversal_stats.ray_num << " rays, "
+              << static_cast<double>(traversal_stats.visited_node_num) / static_cast<double>(std::max<size_t>(traversal_stats.ray_num, 1))
+              << " acceleration structure nodes visited per ray" << std::endl;
+    std::cout << " - " << render_stats.shadow_cache_hit_num << " of " << render_stats.shadow_ray_num
+              << " shadow rays blocked by the cached occluder of their light" << std::endl;
+    std::cout << " - Pruned " << render_stats.pruned_ray_num << " reflection and refraction rays weighing less than "
+              << scene.min_ray_weight() << std::endl;
+
     // save framebuffer to file with tools from stb library
     const std::string output_file_name("output.png");
     constexpr int channel_num = 3;
@@ -46,7 +174,58 @@ void Renderer::render(const Scene& scene) {
     stbi_write_png(output_file_name.c_str(), scene.width(), scene.height(), channel_num, pixel_data_ptr.get(), stride_in_bytes); 
 }
 
-Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, int depth) const {
+Ray Renderer::camera_ray(const Scene& scene, int i, int j) {
+    float scale = std::tan(degree_to_rad(scene.fov() * 0.5f));
+    float image_aspect_ratio = static_cast<float>(scene.width()) / static_cast<float>(scene.height());
+
+    // Use this variable as the eye position to start your rays.
+    Vector3f eye_pos(-1.0f, 5.0f, 10.0f);
+
+    // generate primary ray direction
+    const auto x = (2 * (static_cast<float>(i) + 0.5f) / static_cast<float>(scene.width()) - 1.0f) * scale * image_aspect_ratio;
+    const auto y = (1.0f - 2 * (static_cast<float>(j) + 0.5f) / static_cast<float>(scene.height())) * scale;
+
+    const auto dir = Vector3f(x, y, -1.0f).normalized();
+    return Ray(eye_pos, dir);
+}
+
+float Renderer::light_visibility(const Scene& scene, const Light& light, const Vector3f& shadow_ori, std::shared_ptr<Object>& occluder_ptr) {
+    const auto area_light_ptr = dynamic_cast<const Area_light*>(&light);
+    if (area_light_ptr == nullptr || area_light_ptr->strata_num <= 1)
+        return is_visible(scene, shadow_ori, area_light_ptr != nullptr ? area_light_ptr->center() : light.position, occluder_ptr) ? 1.0f : 0.0f;
+
+    // One jittered point per stratum of the light
+    const auto n = area_light_ptr->strata_num;
+    const auto seed = hash(shadow_ori);
+    const auto is_stratum_visible = [&](int s, int t) {
+        const auto stratum_seed = hash(seed ^ static_cast<uint32_t>(t * n + s));
+        const auto jitter_s = to_unit_float(stratum_seed);
+        const auto jitter_t = to_unit_float(hash(stratum_seed));
+        const auto target = area_light_ptr->sample_point((static_cast<float>(s) + jitter_s) / static_cast<float>(n),
+                                                         (static_cast<float>(t) + jitter_t) / static_cast<float>(n));
+        return is_visible(scene, shadow_ori, target, occluder_ptr);
+    };
+    const auto is_corner = [n](int s, int t) { return (s == 0 || s == n - 1) && (t == 0 || t == n - 1); };
+
+    // The corners first: if all of them are lit or all are blocked, the point is taken to be outside the penumbra
+    int visible_num = 0;
+    for (const auto t : {0, n - 1}) {
+        for (const auto s : {0, n - 1})
+            visible_num += is_stratum_visible(s, t) ? 1 : 0;
+    }
+    if (area_light_ptr->adaptive && (visible_num == 0 || visible_num == 4))
+        return static_cast<float>(visible_num) / 4.0f;
+
+    for (int t = 0; t < n; ++t) {
+        for (int s = 0; s < n; ++s) {
+            if (!is_corner(s, t))
+                visible_num += is_stratum_visible(s, t) ? 1 : 0;
+        }
+    }
+    return static_cast<float>(visible_num) / static_cast<float>(n * n);
+}
+
+Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, int depth, float weight) const {
     // exceed max depth
     if (depth > scene.max_depth()) {
         return {0.0f, 0.0f, 0.0f};
@@ -61,32 +240,48 @@ Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, int depth) const
 
         switch (mat_ptr->type) {
             case Material_type::REFLECTION_AND_REFRACTION: {
+                const auto ior = mat_ptr->ior;
+                const auto kr = fresnel(ray.dir, normal, ior);
+                auto& stats = thread_render_stats();
+
                 // Reflection
-                const auto reflection_dir = reflect(ray.dir, normal).normalized();
-                const auto reflection_ori = (reflection_dir.dot(normal) < 0) ? (pos + normal * -EPSILON) : (pos + normal * EPSILON);
-                const Ray reflection_ray(reflection_ori, reflection_dir);
-                const auto reflection_color = cast_ray(scene, reflection_ray, depth + 1);
+                Vector3f reflection_color = {0.0f, 0.0f, 0.0f};
+                if (weight * kr >= scene.min_ray_weight()) {
+                    const auto reflection_dir = reflect(ray.dir, normal).normalized();
+                    const auto reflection_ori = (reflection_dir.dot(normal) < 0) ? (pos + normal * -EPSILON) : (pos + normal * EPSILON);
+                    const Ray reflection_ray(reflection_ori, reflection_dir);
+                    reflection_color = cast_ray(scene, reflection_ray, depth + 1, weight * kr);
+                } else {
+                    ++stats.pruned_ray_num;
+                }
+
+                // Refraction, pruned under total internal reflection, where kr is 1, unless pruning is off
+                Vector3f refraction_color = {0.0f, 0.0f, 0.0f};
+                if (weight * (1.0f - kr) >= scene.min_ray_weight()) {
+                    const auto refraction_dir = refract(ray.dir, normal, ior).normalized();
+                    const auto refraction_ori = (refraction_dir.dot(normal) < 0) ? (pos + normal * -EPSILON) : (pos + normal * EPSILON);
+                    const Ray refraction_ray(refraction_ori, refraction_dir);
+                    refraction_color = cast_ray(scene, refraction_ray, depth + 1, weight * (1.0f - kr));
+                } else {
+                    ++stats.pruned_ray_num;
+                }
 
-                // Refraction
-                const auto ior = mat_ptr->ior;
-                const auto refraction_dir = refract(ray.dir, normal, ior).normalized();
-                const auto refraction_ori = (refraction_dir.dot(normal) < 0) ? (pos + normal * -EPSILON) : (pos + normal * EPSILON);
-                const Ray refraction_ray(refraction_ori, refraction_dir);
-                
-                const auto refraction_color = cast_ray(scene, refraction_ray, depth + 1);
-                
                 // Combine two results
-                const auto kr = fresnel(ray.dir, normal, ior);
                 color = reflection_color * kr + refraction_color * (1.0f - kr);
                 break;
             } case Material_type::REFLECTION: {
                 const auto ior = mat_ptr->ior;
                 const auto kr = fresnel(ray.dir, normal, ior);
+                if (weight * kr < scene.min_ray_weight()) {
+                    ++thread_render_stats().pruned_ray_num;
+                    color = {0.0f, 0.0f, 0.0f};
+                    break;
+                }
 
                 const auto reflection_dir = reflect(ray.dir, normal).normalized();
                 const auto reflection_ori = (reflection_dir.dot(normal) < 0) ? (pos + normal * -EPSILON) : (pos + normal * EPSILON);
                 const Ray reflection_ray(reflection_ori, reflection_dir);
-                color = cast_ray(scene, reflection_ray, depth + 1) * kr;
+                color = cast_ray(scene, reflection_ray, depth + 1, weight * kr) * kr;
                 break;
             } default: {
                 // We use the Phong illumation model for the default case. The phong model
@@ -100,19 +295,18 @@ Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, int depth) const
 
                 // Loop over all lights in the scene and sum their contribution up
                 // We also apply the lambert cosine law
-                for (const auto& light : scene.lights()) {
-                    Vector3f light_dir = light->position - pos;
-                    // square of the distance between intersection position and the light
-                    float light_dist_sq = light_dir.magnitude_squared();
-                    light_dir = light_dir.normalized();
+                const auto& lights = scene.lights();
+                auto& occluder_ptrs = shadow_cache(scene).occluder_ptrs;
+                for (size_t light_idx = 0; light_idx < lights.size(); ++light_idx) {
+                    const auto& light = lights[light_idx];
+                    // area lights are shaded as a point light at their center
+                    const auto area_light_ptr = dynamic_cast<const Area_light*>(light.get());
+                    const auto light_pos = area_light_ptr != nullptr ? area_light_ptr->center() : light->position;
+                    const auto light_dir = (light_pos - pos).normalized();
                     float l_dot_n = std::max(0.0f, light_dir.dot(normal));
 
-                    // is the point in shadow, and is the nearest occluding object closer to the object than the light itself?
-                    const auto shadow_res = scene.intersect({shadow_point_ori, light_dir});
-
-                    // the direction vector of a ray has magnitude of 1, so the time value in the intersection record can be used as distance.
-                    if (!shadow_res && (shadow_res->time * shadow_res->time < light_dist_sq))
-                        light_ambient += light->intensity * l_dot_n;
+                    // how much of the light do the objects between it and the point block?
+                    light_ambient += light->intensity * l_dot_n * light_visibility(scene, *light, shadow_point_ori, occluder_ptrs[light_idx]);
 
                     const auto reflection_dir = reflect(-light_dir, normal);
 
@@ -1,15 +1,47 @@
 #pragma once
 
+#include <atomic>
+
 #include "Scene.hpp"
+#include "Thread_pool.hpp"
+
+// Work of the renderer itself done by a thread, beside the traversals counted in Traversal_stats
+struct Render_stats {
+    size_t shadow_ray_num = 0;          // shadow rays cast towards lights
+    size_t shadow_cache_hit_num = 0;    // of them blocked by the occluder cached for their light, not traced
+    size_t pruned_ray_num = 0;          // reflection and refraction rays not cast for their low weight
+};
 
 class Renderer {
 public:
+    // Square tiles of TILE_SIZE x TILE_SIZE pixels are the tasks handed out to the render threads
+    static constexpr int TILE_SIZE = 16;
+
+    // Render with *thread_count* threads, 0 for one per hardware thread
+    explicit Renderer(unsigned int thread_count = 0) : _thread_pool(thread_count) {}
+
+    [[nodiscard]] unsigned int thread_count() const { return _thread_pool.thread_count(); }
+
     // The main render function. This where we iterate over all pixels in the image,
     // generate primary rays and cast these rays into the scene. The content of the
     // framebuffer is saved to a png image file with tools from stb library.
+    //
+    // The tiles of the image are rendered in parallel. Each thread counts the pixels it has done in its own
+    // counter, which the calling thread sums up to draw the progress bar. The number of acceleration structure
+    // nodes or grid cells visited per ray is printed at the end.
     void render(const Scene& scene);
 
+    // Primary ray through the center of pixel (*i*, *j*)
+    [[nodiscard]] static Ray camera_ray(const Scene& scene, int i, int j);
+
 private:
+    // Pixels rendered by a thread, on its own cache line so that the threads do not contend for it
+    struct alignas(64) Progress_counter {
+        std::atomic<size_t> pixel_count = 0;
+        Traversal_stats traversal_stats;    // of the tiles of the thread, only read once they are all done
+        Render_stats render_stats;          // likewise
+    };
+
     // Implementation of the Whitted-syle ray tracing algorithm
     //
     // This function is the function that compute the color at the intersection point
@@ -24,5 +56,17 @@ private:
     //
     // If the surface is duffuse/glossy we use the Phong illumation model to compute the color
     // at the intersection point.
-    [[nodiscard]] Vector3f cast_ray(const Scene& scene, const Ray& ray, int depth) const;
+    //
+    // *weight* is the factor the color is scaled by in the pixel, that of the parent ray times the fresnel factor.
+    // Reflection and refraction rays weighing less than Scene::min_ray_weight, 0 by default, are not cast.
+    [[nodiscard]] Vector3f cast_ray(const Scene& scene, const Ray& ray, int depth, float weight = 1.0f) const;
+
+    // Share of *light* not blocked as seen from *shadow_ori*: 0 or 1 for a point light, the share of the shadow
+    // rays to its strata that reach it for an Area_light. *occluder_ptr* is the cached last object found
+    // blocking the light on this thread, tested before the scene and replaced when another one blocks it.
+    [[nodiscard]] static float light_visibility(const Scene& scene, const Light& light, const Vector3f& shadow_ori,
+                                                std::shared_ptr<Object>& occluder_ptr);
+
+private:
+    Thread_pool _thread_pool;
 };
@@ -1,15 +1,35 @@
 #include "Scene.hpp"
 
+#include "Accelerator_factory.hpp"
+
 void Scene::build_BVH() {
     std::cout << " - Generating BVH for Scene..." << std::endl;
-    _bvh_tree = BVH_tree(_obj_ptrs, BVH_tree::Split_method::NAIVE);
+    _accelerator_ptr = std::make_unique<BVH_tree>(_obj_ptrs, BVH_tree::Split_method::NAIVE);
 }
 
 void Scene::build_SVH() {
     std::cout << " - Generating BVH for Scene with SAH..." << std::endl;
-    _bvh_tree = BVH_tree(_obj_ptrs, BVH_tree::Split_method::SAH);
+    _accelerator_ptr = std::make_unique<BVH_tree>(_obj_ptrs, BVH_tree::Split_method::SAH);
+}
+
+void Scene::build_LBVH() {
+    std::cout << " - Generating BVH for Scene with LBVH..." << std::endl;
+    _accelerator_ptr = std::make_unique<BVH_tree>(_obj_ptrs, BVH_tree::Split_method::LBVH);
+}
+
+void Scene::build_SBVH() {
+    std::cout << " - Generating BVH for Scene with SBVH..." << std::endl;
+    _accelerator_ptr = std::make_unique<BVH_tree>(_obj_ptrs, BVH_tree::Split_method::SBVH);
+}
+
+void Scene::build_accelerator(Accelerator::Type type, BVH_tree::Split_method split_method, const BVH_build_params& bvh_params) {
+    std::cout << " - Generating " << accelerator_type_name(type) << " for Scene..." << std::endl;
+    _accelerator_ptr = make_accelerator(type, _obj_ptrs, split_method, bvh_params);
 }
 
 std::optional<Intersection> Scene::intersect(const Ray& ray) const {
-    return _bvh_tree.intersect(ray);
+    ++Accelerator::traversal_stats().ray_num;
+    if (_accelerator_ptr == nullptr)
+        return std::nullopt;
+    return _accelerator_ptr->intersect(ray);
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include "Object.hpp"
 #include "Light.hpp"
+#include "Accelerator.hpp"
 #include "BVH.hpp"
 #include "Ray.hpp"
 
@@ -17,15 +18,23 @@ public:
     [[nodiscard]] float fov() const { return _fov; }
     [[nodiscard]] Vector3f background_color() const { return _background_color; }
     [[nodiscard]] int max_depth() const { return _max_depth; }
+    // Reflection and refraction rays whose color would be scaled by less than this in the pixel are not cast
+    [[nodiscard]] float min_ray_weight() const { return _min_ray_weight; }
+    void set_min_ray_weight(float min_ray_weight) { _min_ray_weight = min_ray_weight; }
 
     [[nodiscard]] const std::vector<std::shared_ptr<Object>> objects() const { return _obj_ptrs; }
-    [[nodiscard]] const std::vector<std::shared_ptr<Light>> lights() const { return _light_ptrs; }
+    [[nodiscard]] const std::vector<std::shared_ptr<Light>>& lights() const { return _light_ptrs; }
 
     void add_object(std::shared_ptr<Object> obj_ptr) { _obj_ptrs.push_back(obj_ptr); }
     void add_light(std::shared_ptr<Light> light_ptr) { _light_ptrs.push_back(light_ptr); }
 
     void build_BVH();
     void build_SVH();
+    void build_LBVH();
+    void build_SBVH();
+    // Index the objects with an accelerator of *type*, *split_method* is used by BVH only
+    void build_accelerator(Accelerator::Type type, BVH_tree::Split_method split_method = BVH_tree::Split_method::NAIVE,
+                           const BVH_build_params& bvh_params = {});
 
     std::optional<Intersection> intersect(const Ray& ray) const;
 
@@ -35,9 +44,10 @@ private:
     float _fov = 90.0f;
     Vector3f _background_color = { 0.235294f, 0.67451f, 0.843137f };
     int _max_depth = 5;
+    float _min_ray_weight = 0.0f;
 
     std::vector<std::shared_ptr<Object>> _obj_ptrs;
     std::vector<std::shared_ptr<Light>> _light_ptrs;
 
-    BVH_tree _bvh_tree;
+    std::unique_ptr<Accelerator> _accelerator_ptr;
 };
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "Thread_pool.hpp"
+
+#include <algorithm>
+
+Thread_pool::Thread_pool(unsigned int thread_count) {
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    _threads.reserve(thread_count);
+    for (unsigned int i = 0; i < thread_count; ++i)
+        _threads.emplace_back(&Thread_pool::work, this, i);
+}
+
+Thread_pool::~Thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _start_cond.notify_all();
+
+    for (auto& thread : _threads)
+        thread.join();
+}
+
+void Thread_pool::parallel_for(size_t task_count, const std::function<void(unsigned int, size_t)>& task,
+                               const std::function<void()>& on_wait, std::chrono::milliseconds wait_interval) {
+    if (task_count == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _task_ptr = &task;
+    _task_count = task_count;
+    _next_task_idx = 0;
+    _busy_thread_count = thread_count();
+    ++_generation;
+    _start_cond.notify_all();
+
+    // Wait for every worker to leave the loop, so that none still refers to *task* after returning
+    while (!_done_cond.wait_for(lock, wait_interval, [this] { return _busy_thread_count == 0; })) {
+        if (on_wait) {
+            lock.unlock();
+            on_wait();
+            lock.lock();
+        }
+    }
+    _task_ptr = nullptr;
+}
+
+void Thread_pool::work(unsigned int thread_idx) {
+    unsigned long long done_generation = 0;
+    while (true) {
+        const std::function<void(unsigned int, size_t)>* task_ptr;
+        size_t task_count;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _start_cond.wait(lock, [&] { return _stopping || _generation != done_generation; });
+            if (_stopping)
+                return;
+            done_generation = _generation;
+            task_ptr = _task_ptr;
+            task_count = _task_count;
+        }
+
+        for (auto task_idx = _next_task_idx.fetch_add(1, std::memory_order_relaxed); task_idx < task_count;
+             task_idx = _next_task_idx.fetch_add(1, std::memory_order_relaxed))
+            (*task_ptr)(thread_idx, task_idx);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_busy_thread_count == 0)
+                _done_cond.notify_one();
+        }
+    }
+}
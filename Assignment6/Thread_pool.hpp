@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads which run the tasks of one parallel loop at a time.
+// The workers are created once and sleep between loops.
+class Thread_pool {
+public:
+    // *thread_count* 0 means one worker per hardware thread
+    explicit Thread_pool(unsigned int thread_count = 0);
+    ~Thread_pool();
+
+    Thread_pool(const Thread_pool&) = delete;
+    Thread_pool& operator=(const Thread_pool&) = delete;
+
+    [[nodiscard]] unsigned int thread_count() const { return static_cast<unsigned int>(_threads.size()); }
+
+    // Run task(thread_idx, task_idx) for every task_idx in [0, task_count). Each worker takes the next task
+    // index when it is done with its last one, so uneven tasks balance out. Blocks until all tasks are done,
+    // calling *on_wait* from the calling thread every *wait_interval* meanwhile.
+    void parallel_for(size_t task_count, const std::function<void(unsigned int, size_t)>& task,
+                      const std::function<void()>& on_wait = nullptr,
+                      std::chrono::milliseconds wait_interval = std::chrono::milliseconds(100));
+
+private:
+    void work(unsigned int thread_idx);
+
+private:
+    std::vector<std::thread> _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _start_cond;
+    std::condition_variable _done_cond;
+
+    // Current loop, guarded by *_mutex* except *_next_task_idx*
+    const std::function<void(unsigned int, size_t)>* _task_ptr = nullptr;
+    size_t _task_count = 0;
+    std::atomic<size_t> _next_task_idx = 0;
+    unsigned int _busy_thread_count = 0;
+    unsigned long long _generation = 0;     // number of loops started, tells the workers a new loop is ready
+    bool _stopping = false;
+};
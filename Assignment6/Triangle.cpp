@@ -1,5 +1,7 @@
 #include "Triangle.hpp"
 
+#include "Accelerator_factory.hpp"
+
 Triangle::Triangle(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2,
                 std::shared_ptr<Material> material_ptr)
  : _v0((v0)), _v1((v1)), _v2(v2), _mat_ptr(std::move(material_ptr)) {
@@ -37,6 +39,43 @@ Bounding_box Triangle::bound() const {
     return union_box({_v0, _v1}, _v2);
 }
 
+Bounding_box Triangle::clipped_bound(const Bounding_box& box) const {
+    // Sutherland-Hodgman clipping against the 6 planes of the box. Each plane adds at most one vertex
+    // to the convex polygon, so it never has more than 9.
+    std::array<Vector3f, 9> polygon = {_v0, _v1, _v2};
+    size_t vertex_num = 3;
+    for (int dim = 0; dim < 3; ++dim) {
+        for (const bool is_max_plane : {false, true}) {
+            const auto plane = is_max_plane ? box.p_max[dim] : box.p_min[dim];
+            const auto inside = [=](const Vector3f& p) { return is_max_plane ? p[dim] <= plane : p[dim] >= plane; };
+
+            std::array<Vector3f, 9> clipped_polygon;
+            size_t clipped_vertex_num = 0;
+            for (size_t i = 0; i < vertex_num; ++i) {
+                const auto& p = polygon[i];
+                const auto& q = polygon[(i + 1) % vertex_num];
+                if (inside(p))
+                    clipped_polygon[clipped_vertex_num++] = p;
+                if (inside(p) != inside(q)) {
+                    auto crossing = p + (q - p) * ((plane - p[dim]) / (q[dim] - p[dim]));
+                    crossing[dim] = plane;
+                    clipped_polygon[clipped_vertex_num++] = crossing;
+                }
+            }
+
+            if (clipped_vertex_num == 0)
+                return {};
+            polygon = clipped_polygon;
+            vertex_num = clipped_vertex_num;
+        }
+    }
+
+    Bounding_box clipped_box;
+    for (size_t i = 0; i < vertex_num; ++i)
+        clipped_box = union_box(clipped_box, polygon[i]);
+    return intersection_box(clipped_box, box);
+}
+
 std::vector<std::shared_ptr<Triangle>> load_triangles_from_model_file(const std::string& file_name) {
     objl::Loader loader;
     loader.LoadFile(file_name);
@@ -81,6 +120,8 @@ std::vector<std::shared_ptr<Triangle>> load_triangles_from_model_file(const std:
 }
 
 Triangle_mesh::Triangle_mesh(const std::vector<std::shared_ptr<Triangle>>& triangle_ptr_list,
-                            BVH_tree::Split_method split_method)
-     : _triangle_ptrs(triangle_ptr_list),
-       _bvh_tree(transform_to_object_vector<Triangle>(triangle_ptr_list), split_method) {}
\ No newline at end of file
+                            BVH_tree::Split_method split_method, Accelerator::Type type, const BVH_build_params& bvh_params)
+     : _triangle_ptrs(triangle_ptr_list) {
+    auto obj_ptrs = transform_to_object_vector<Triangle>(triangle_ptr_list);
+    _accelerator_ptr = make_accelerator(type, obj_ptrs, split_method, bvh_params);
+}
\ No newline at end of file
@@ -20,6 +20,9 @@ public:
 
     Bounding_box bound() const override;
 
+    // Bounding box of the polygon left after clipping the triangle to *box*
+    Bounding_box clipped_bound(const Bounding_box& box) const override;
+
 private:
     Vector3f _v0, _v1, _v2; // vertices in counter-clockwise order
     Vector3f _e1, _e2;     // 2 edges v1-v0, v2-v0;
@@ -32,18 +35,20 @@ std::vector<std::shared_ptr<Triangle>> load_triangles_from_model_file(const std:
 
 class Triangle_mesh : public Object {
 public:
+    // The triangles are indexed by an accelerator of *type*, *split_method* and *bvh_params* are used by BVH only
     Triangle_mesh(const std::vector<std::shared_ptr<Triangle>>& triangle_ptr_list,
-                BVH_tree::Split_method split_method = BVH_tree::Split_method::NAIVE);
+                BVH_tree::Split_method split_method = BVH_tree::Split_method::NAIVE,
+                Accelerator::Type type = Accelerator::Type::BVH, const BVH_build_params& bvh_params = {});
 
     std::optional<Intersection> intersect(const Ray& ray) override {
-        return _bvh_tree.intersect(ray);
+        return _accelerator_ptr->intersect(ray);
     }
 
-    [[nodiscard]] Bounding_box bound() const override { return _bvh_tree.bound(); }
+    [[nodiscard]] Bounding_box bound() const override { return _accelerator_ptr->bound(); }
 
     [[nodiscard]] std::vector<std::shared_ptr<Triangle>> triangles() const { return _triangle_ptrs; }
 
 private:
     std::vector<std::shared_ptr<Triangle>> _triangle_ptrs;
-    BVH_tree _bvh_tree;
+    std::unique_ptr<Accelerator> _accelerator_ptr;
 };
\ No newline at end of file
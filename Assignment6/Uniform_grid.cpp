@@ -0,0 +1,200 @@
+#include "Uniform_grid.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+    // Cell of *grid_bound* split into *resolution* cells of *cell_size* holding *v* on *axis*, clamped into the grid
+    int position_to_cell(float v, int axis, const Bounding_box& grid_bound, const Vector3f& cell_size, const std::array<int, 3>& resolution) {
+        if (cell_size[axis] <= 0.0f)
+            return 0;
+        const auto cell = static_cast<int>(std::floor((v - grid_bound.p_min[axis]) / cell_size[axis]));
+        return std::max(0, std::min(resolution[axis] - 1, cell));
+    }
+}
+
+Uniform_grid::Uniform_grid(const std::vector<std::shared_ptr<Object>>& obj_ptrs, const Grid_build_params& build_params)
+    : _build_params(build_params), _obj_ptrs(obj_ptrs) {
+    // Record building time
+    const auto start = std::chrono::steady_clock::now();
+
+    Bounding_box bound;
+    _obj_bounds.reserve(_obj_ptrs.size());
+    for (const auto& obj_ptr : _obj_ptrs) {
+        _obj_bounds.push_back(obj_ptr->bound());
+        bound = union_box(bound, _obj_bounds.back());
+    }
+
+    if (!_obj_ptrs.empty()) {
+        std::vector<uint32_t> obj_indices(_obj_ptrs.size());
+        for (size_t i = 0; i < obj_indices.size(); ++i)
+            obj_indices[i] = static_cast<uint32_t>(i);
+        build(bound, obj_indices, 0);
+    }
+    std::vector<Bounding_box>().swap(_obj_bounds);
+    const auto stop = std::chrono::steady_clock::now();
+
+    const auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+    const auto& top = _grids.empty() ? Grid() : _grids.front();
+    printf("\rGrid generation complete: %ix%ix%i top cells, %zu grids, %zu cells, %zu object references, %i ms\n\n",
+           top.resolution[0], top.resolution[1], top.resolution[2], _grids.size(), _cells.size(), _obj_indices.size(), static_cast<int>(diff));
+}
+
+size_t Uniform_grid::byte_size() const {
+    return _grids.size() * sizeof(Grid) + _cells.size() * sizeof(Cell) + _obj_indices.size() * sizeof(uint32_t)
+         + _obj_ptrs.size() * sizeof(std::shared_ptr<Object>);
+}
+
+uint32_t Uniform_grid::build(const Bounding_box& bound, const std::vector<uint32_t>& obj_indices, int level) {
+    // Cubic cells as near as possible, about density * object count of them
+    Grid grid {};
+    grid.bound = bound;
+    const auto d = bound.diagonal();
+    const auto cell_num = _build_params.density * static_cast<float>(obj_indices.size());
+    const auto volume = d.x * d.y * d.z;
+    const auto max_width = std::max(d.x, std::max(d.y, d.z));
+    auto cells_per_unit = 0.0f;
+    if (volume > 0.0f)
+        cells_per_unit = std::cbrt(cell_num / volume);
+    else if (max_width > 0.0f)
+        cells_per_unit = std::cbrt(cell_num) / max_width;
+    for (int axis = 0; axis < 3; ++axis) {
+        const auto resolution = static_cast<int>(std::round(d[axis] * cells_per_unit));
+        grid.resolution[axis] = std::max(1, std::min(_build_params.max_resolution, resolution));
+        grid.cell_size[axis] = d[axis] / static_cast<float>(grid.resolution[axis]);
+    }
+    grid.first_cell_idx = _cells.size();
+
+    const auto grid_idx = static_cast<uint32_t>(_grids.size());
+    _grids.push_back(grid);
+    _cells.resize(_cells.size() + static_cast<size_t>(grid.resolution[0]) * grid.resolution[1] * grid.resolution[2]);
+
+    const auto cell_bound = [&grid](int x, int y, int z) {
+        const Vector3f p_min = grid.bound.p_min + Vector3f(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) * grid.cell_size;
+        return Bounding_box(p_min, p_min + grid.cell_size);
+    };
+
+    // List the objects overlapping each cell. An object spanning several cells is clipped to each of them,
+    // grown a little so that rounding does not drop a triangle touching it.
+    std::vector<std::vector<uint32_t>> cell_obj_indices(_cells.size() - grid.first_cell_idx);
+    for (const auto obj_idx : obj_indices) {
+        const auto& obj_bound = _obj_bounds[obj_idx];
+        std::array<int, 3> lo{}, hi{};
+        for (int axis = 0; axis < 3; ++axis) {
+            lo[axis] = position_to_cell(obj_bound.p_min[axis], axis, grid.bound, grid.cell_size, grid.resolution);
+            hi[axis] = position_to_cell(obj_bound.p_max[axis], axis, grid.bound, grid.cell_size, grid.resolution);
+        }
+        const bool single_cell = lo == hi;
+
+        for (int z = lo[2]; z <= hi[2]; ++z) {
+            for (int y = lo[1]; y <= hi[1]; ++y) {
+                for (int x = lo[0]; x <= hi[0]; ++x) {
+                    if (!single_cell) {
+                        auto box = cell_bound(x, y, z);
+                        const auto margin = 1e-3f * grid.cell_size;
+                        box.p_min = box.p_min - margin;
+                        box.p_max = box.p_max + margin;
+                        if (_obj_ptrs[obj_idx]->clipped_bound(box).empty())
+                            continue;
+                    }
+                    cell_obj_indices[grid.cell_index(x, y, z) - grid.first_cell_idx].push_back(obj_idx);
+                }
+            }
+        }
+    }
+
+    // Store the object lists, or grids over the crowded cells
+    for (int z = 0; z < grid.resolution[2]; ++z) {
+        for (int y = 0; y < grid.resolution[1]; ++y) {
+            for (int x = 0; x < grid.resolution[0]; ++x) {
+                const auto cell_idx = grid.cell_index(x, y, z);
+                auto& indices = cell_obj_indices[cell_idx - grid.first_cell_idx];
+                if (indices.size() > _build_params.max_cell_size && level + 1 < _build_params.max_level) {
+                    const auto child_grid = build(cell_bound(x, y, z), indices, level + 1);
+                    _cells[cell_idx].child_grid = child_grid;
+                } else {
+                    _cells[cell_idx].first_obj_idx = static_cast<uint32_t>(_obj_indices.size());
+                    _cells[cell_idx].obj_num = static_cast<uint32_t>(indices.size());
+                    _obj_indices.insert(_obj_indices.end(), indices.begin(), indices.end());
+                }
+                std::vector<uint32_t>().swap(indices);
+            }
+        }
+    }
+
+    return grid_idx;
+}
+
+std::optional<Intersection> Uniform_grid::intersect(const Ray& ray) const {
+    float t_min, t_max;
+    if (_grids.empty() || !_grids.front().bound.intersect(ray, t_min, t_max))
+        return std::nullopt;
+
+    std::optional<Intersection> closest;
+    intersect(_grids.front(), ray, std::max(t_min, 0.0f), t_max, closest);
+    return closest;
+}
+
+bool Uniform_grid::intersect(const Grid& grid, const Ray& ray, float t_min, float t_max, std::optional<Intersection>& closest) const {
+    // Cell of the entry point, and on each axis the time the ray crosses into the next cell
+    const auto entry = ray.at_time(t_min);
+    std::array<int, 3> cell{}, step{}, out{};
+    std::array<float, 3> next_crossing{}, crossing_delta{};
+    for (int axis = 0; axis < 3; ++axis) {
+        cell[axis] = position_to_cell(entry[axis], axis, grid.bound, grid.cell_size, grid.resolution);
+        if (ray.dir[axis] > 0.0f) {
+            const auto boundary = grid.bound.p_min[axis] + static_cast<float>(cell[axis] + 1) * grid.cell_size[axis];
+            next_crossing[axis] = t_min + (boundary - entry[axis]) * ray.inv_dir[axis];
+            crossing_delta[axis] = grid.cell_size[axis] * ray.inv_dir[axis];
+            step[axis] = 1;
+            out[axis] = grid.resolution[axis];
+        } else if (ray.dir[axis] < 0.0f) {
+            const auto boundary = grid.bound.p_min[axis] + static_cast<float>(cell[axis]) * grid.cell_size[axis];
+            next_crossing[axis] = t_min + (boundary - entry[axis]) * ray.inv_dir[axis];
+            crossing_delta[axis] = -grid.cell_size[axis] * ray.inv_dir[axis];
+            step[axis] = -1;
+            out[axis] = -1;
+        } else {
+            next_crossing[axis] = FLOAT_INFINITY;
+            crossing_delta[axis] = FLOAT_INFINITY;
+            step[axis] = 0;
+            out[axis] = -1;
+        }
+    }
+
+    auto& stats = traversal_stats();
+    auto t_enter = t_min;
+    while (true) {
+        int axis = next_crossing[0] < next_crossing[1] ? 0 : 1;
+        axis = next_crossing[axis] < next_crossing[2] ? axis : 2;
+        const auto t_exit = std::min(next_crossing[axis], t_max);
+
+        ++stats.visited_node_num;
+        const auto& c = _cells[grid.cell_index(cell[0], cell[1], cell[2])];
+        if (c.child_grid != NO_CHILD) {
+            if (intersect(_grids[c.child_grid], ray, t_enter, t_exit, closest))
+                return true;
+        } else {
+            for (uint32_t i = 0; i < c.obj_num; ++i) {
+                auto intersection = _obj_ptrs[_obj_indices[c.first_obj_idx + i]]->intersect(ray);
+                if (intersection && (!closest || intersection->time < closest->time))
+                    closest = std::move(intersection);
+            }
+        }
+
+        // A hit in this cell or before it is the closest
+        if (closest && closest->time <= t_exit)
+            return true;
+
+        if (next_crossing[axis] > t_max)
+            break;
+        cell[axis] += step[axis];
+        if (cell[axis] == out[axis])
+            break;
+        t_enter = next_crossing[axis];
+        next_crossing[axis] += crossing_delta[axis];
+    }
+
+    return closest && closest->time <= t_max;
+}
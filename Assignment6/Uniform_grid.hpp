@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Accelerator.hpp"
+#include "Object.hpp"
+
+// Build settings of the grid
+struct Grid_build_params {
+    float density = 3.0f;           // cells per object on average: the cells are cubes as near as possible,
+                                    // about density * object count of them
+    int max_resolution = 128;       // cells on an axis at most
+    size_t max_cell_size = 16;      // objects a cell holds before it is split into a grid of its own
+    int max_level = 2;              // levels of grids, 1 for a single uniform grid
+};
+
+// Grid of equal cells over the box of the objects, each listing the objects overlapping it. A cell holding more
+// than *max_cell_size* objects holds a finer grid over its box instead, so that a few crowded cells do not force
+// a fine grid everywhere. Rays step through the cells they pass in order (3D-DDA) and stop at the end of the
+// first cell containing their closest hit.
+class Uniform_grid : public Accelerator {
+public:
+    explicit Uniform_grid(const std::vector<std::shared_ptr<Object>>& obj_ptrs, const Grid_build_params& build_params = {});
+
+    [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray) const override;
+
+    [[nodiscard]] Bounding_box bound() const override { return _grids.empty() ? Bounding_box() : _grids.front().bound; }
+
+    [[nodiscard]] size_t byte_size() const override;
+
+private:
+    static constexpr uint32_t NO_CHILD = 0xffffffffu;
+
+    struct Cell {
+        uint32_t first_obj_idx = 0;     // first of the cell's entries of *_obj_indices*
+        uint32_t obj_num = 0;
+        uint32_t child_grid = NO_CHILD; // index of the grid over the cell, which holds its objects instead
+    };
+
+    struct Grid {
+        Bounding_box bound;
+        std::array<int, 3> resolution;
+        Vector3f cell_size;
+        size_t first_cell_idx;          // first of the grid's cells in *_cells*, x fastest
+
+        [[nodiscard]] size_t cell_index(int x, int y, int z) const {
+            return first_cell_idx + (static_cast<size_t>(z) * resolution[1] + y) * resolution[0] + x;
+        }
+    };
+
+    // Build a grid over *obj_indices* in *bound* at *level* (0 for the top) and return its index
+    uint32_t build(const Bounding_box& bound, const std::vector<uint32_t>& obj_indices, int level);
+
+    // Step through the cells of *grid* the ray passes between *t_min* and *t_max*, keeping the closest hit in
+    // *closest*. Returns whether the closest hit lies before *t_max*, so that the traversal is done.
+    bool intersect(const Grid& grid, const Ray& ray, float t_min, float t_max, std::optional<Intersection>& closest) const;
+
+private:
+    Grid_build_params _build_params;
+    std::vector<std::shared_ptr<Object>> _obj_ptrs;
+    std::vector<Bounding_box> _obj_bounds;      // only kept while building
+    std::vector<uint32_t> _obj_indices;         // objects of the cells, each cell's together
+    std::vector<Cell> _cells;
+    std::vector<Grid> _grids;                   // the top grid first
+};
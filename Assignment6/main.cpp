@@ -1,8 +1,18 @@
 // Bonus part
 // #define SVH
+// Build the BVHs from Morton codes instead (faster to build, slower to trace than SAH)
+// #define LINEAR_BVH
+// Build the BVHs with spatial splits, for meshes of long or large overlapping triangles
+// #define SPATIAL_BVH
 
 #include <chrono>
+#include <cstring>
+#include <optional>
+#include <string>
 
+#include "Accelerator_benchmark.hpp"
+#include "Area_light.hpp"
+#include "Accelerator_factory.hpp"
 #include "Renderer.hpp"
 #include "Scene.hpp"
 #include "Triangle.hpp"
@@ -12,32 +22,76 @@
 // lights) as well as set the options for the render (image width and height,
 // maximum recursion depth, field-of-view, etc.). We then call the render
 // function().
+//
+// Pass `--threads <count>` to render with *count* threads instead of one per hardware thread.
+// Pass `--accelerator bvh|kd-tree|grid` to index the bunny and the scene with a kd-tree or a grid instead of BVHs.
+// Pass `--optimize-bvh <seconds>` to spend up to *seconds* per BVH restructuring its treelets after the build.
+// Pass `--area-lights <size>` to light the scene with square area lights of edge *size*, which cast soft shadows.
+// Pass `--min-ray-weight <weight>` to cast reflection and refraction rays only while they weigh at least *weight*,
+// by default all of them are cast.
+// Pass `--benchmark-accelerators` to compare the build time, memory and traversal speed of all of them on the bunny.
 int main(int argc, char** argv) {
+    unsigned int thread_count = 0;
+    auto accelerator_type = Accelerator::Type::BVH;
+    BVH_build_params bvh_params;
+    float area_light_size = 0.0f;
+    std::optional<float> min_ray_weight;
+    bool benchmark_accelerators = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            thread_count = static_cast<unsigned int>(std::stoul(argv[++i]));
+        else if (std::strcmp(argv[i], "--accelerator") == 0 && i + 1 < argc)
+            accelerator_type = parse_accelerator_type(argv[++i]);
+        else if (std::strcmp(argv[i], "--optimize-bvh") == 0 && i + 1 < argc)
+            bvh_params.optimization_time = std::stof(argv[++i]);
+        else if (std::strcmp(argv[i], "--area-lights") == 0 && i + 1 < argc)
+            area_light_size = std::stof(argv[++i]);
+        else if (std::strcmp(argv[i], "--min-ray-weight") == 0 && i + 1 < argc)
+            min_ray_weight = std::stof(argv[++i]);
+        else if (std::strcmp(argv[i], "--benchmark-accelerators") == 0)
+            benchmark_accelerators = true;
+    }
+
     Scene scene(1280, 960);
+    if (min_ray_weight)
+        scene.set_min_ray_weight(*min_ray_weight);
 
     const auto bunny_triangles = load_triangles_from_model_file("../models/bunny/bunny.obj");
+    if (benchmark_accelerators) {
+        run_accelerator_benchmark(scene, bunny_triangles);
+        return 0;
+    }
 
-    #ifdef SVH
-    std::cout << " - Generating BVH for Bunny with SAH..." << std::endl;
-    const auto bunny_ptr = std::make_shared<Triangle_mesh>(bunny_triangles, BVH_tree::Split_method::SAH);
+    #if defined(SVH)
+    const auto split_method = BVH_tree::Split_method::SAH;
+    #elif defined(LINEAR_BVH)
+    const auto split_method = BVH_tree::Split_method::LBVH;
+    #elif defined(SPATIAL_BVH)
+    const auto split_method = BVH_tree::Split_method::SBVH;
     #else
-    std::cout << " - Generating BVH for Bunny..." << std::endl;
-    const auto bunny_ptr = std::make_shared<Triangle_mesh>(bunny_triangles, BVH_tree::Split_method::NAIVE);
+    const auto split_method = BVH_tree::Split_method::NAIVE;
     #endif
 
+    std::cout << " - Generating " << accelerator_type_name(accelerator_type) << " for Bunny..." << std::endl;
+    const auto bunny_ptr = std::make_shared<Triangle_mesh>(bunny_triangles, split_method, accelerator_type, bvh_params);
+
     scene.add_object(bunny_ptr);
 
-    scene.add_light(std::make_shared<Light>(Vector3f{-20.0f, 70.0f, 20.0f}, Vector3f{1.0f, 1.0f, 1.0f}));
-    scene.add_light(std::make_shared<Light>(Vector3f{20.0f, 70.0f, 20.0f}, Vector3f{1.0f, 1.0f, 1.0f}));
-    #ifdef SVH
-    scene.build_SVH();
-    #else
-    scene.build_BVH();
-    #endif
+    for (const auto& light_pos : {Vector3f{-20.0f, 70.0f, 20.0f}, Vector3f{20.0f, 70.0f, 20.0f}}) {
+        if (area_light_size > 0.0f) {
+            // centered on the point light it replaces
+            const Vector3f u(area_light_size, 0.0f, 0.0f);
+            const Vector3f v(0.0f, 0.0f, area_light_size);
+            scene.add_light(std::make_shared<Area_light>(light_pos - 0.5f * (u + v), Vector3f{1.0f, 1.0f, 1.0f}, u, v));
+        } else {
+            scene.add_light(std::make_shared<Light>(light_pos, Vector3f{1.0f, 1.0f, 1.0f}));
+        }
+    }
+    scene.build_accelerator(accelerator_type, split_method, bvh_params);
 
-    Renderer r;
+    Renderer r(thread_count);
 
-    std::cout << " - Rendering Scene..." << std::endl;
+    std::cout << " - Rendering Scene with " << r.thread_count() << " threads..." << std::endl;
     const auto start = std::chrono::system_clock::now();
     r.render(scene);
     const auto stop = std::chrono::system_clock::now();
@@ -46,6 +100,7 @@ int main(int argc, char** argv) {
     std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << " hours\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
+    std::cout << "          : " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << " milliseconds\n";
 
     return 0;
 }
\ No newline at end of file
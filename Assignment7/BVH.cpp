@@ -3,16 +3,29 @@
 #include <algorithm>
 #include <ctime>
 #include <cassert>
+#include <future>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
 
 BVH_tree::BVH_tree() : _root_ptr(nullptr), _split_method(SplitMethod::NAIVE) { }
 
-BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>& obj_ptrs, SplitMethod split_method)
-    : _split_method(split_method) {
+BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>& obj_ptrs, SplitMethod split_method, bool print_stats,
+                   const BVH_build_params& build_params)
+    : _split_method(split_method), _build_params(build_params) {
+    if (_build_params.max_leaf_size == 0 || _build_params.max_leaf_size > static_cast<size_t>(Vector3f_soa::WIDTH))
+        throw std::runtime_error("the leaves of a BVH hold 1 to " + std::to_string(Vector3f_soa::WIDTH) + " objects");
+
     // Record building time
     time_t start, stop;
     time(&start);
     _root_ptr = recursive_build(obj_ptrs, 0, obj_ptrs.size());
+    _built_sah_cost = sah_cost();
+    quantize();
     time(&stop);
+    if (!print_stats)
+        return;
 
     // Print results
     const auto diff = static_cast<float>(difftime(stop, start));
@@ -20,78 +33,412 @@ BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>& obj_ptrs, SplitMethod s
     const auto mins = static_cast<int>(diff / 60.0f) - (hrs * 60);
     const auto secs = static_cast<int>(diff) - (hrs * 3600) - (mins * 60);
 
-    printf( "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n\n", hrs, mins, secs);
+    printf( "\rBVH Generation complete: \nTime Taken: %i hrs, %i mins, %i secs\n", hrs, mins, secs);
+#ifdef USE_QUANTIZED_BVH
+    printf("Quantized nodes: %zu, %zu bytes per node (%zu bytes per node of the node tree), %zu triangle leaves\n\n",
+           _quantized_bvh.node_count(), QuantizedBVH::bytes_per_node(), sizeof(BVH_node), _quantized_bvh.triangle_leaf_count());
+#else
+    printf("\n");
+#endif
 }
 
-BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>&& obj_ptrs, SplitMethod split_method)
-    : BVH_tree(obj_ptrs, split_method) { }
+BVH_tree::BVH_tree(std::vector<std::shared_ptr<Object>>&& obj_ptrs, SplitMethod split_method, bool print_stats,
+                   const BVH_build_params& build_params)
+    : BVH_tree(obj_ptrs, split_method, print_stats, build_params) { }
 
 std::optional<Intersection> BVH_tree::intersect(const Ray& ray, Culling culling) const {
+#ifdef USE_QUANTIZED_BVH
+    if (!_quantized_bvh_dirty)
+        return _quantized_bvh.intersect(ray, culling);
+#endif
     return intersect(_root_ptr, ray, culling);
 }
 
+void BVH_tree::intersect(Span<const Ray> rays, Culling culling, RayQuery query, Span<HitRecord> hits) const {
+#ifdef USE_QUANTIZED_BVH
+    if (!_quantized_bvh_dirty) {
+        _quantized_bvh.intersect(rays, culling, query, hits);
+        return;
+    }
+#endif
+    if (hits.size() != rays.size())
+        throw std::runtime_error("one hit record per ray is needed");
+    for (size_t i = 0; i < rays.size(); ++i) {
+        const auto intersection = intersect(_root_ptr, rays[i], culling);
+        hits[i] = (intersection && intersection->time < rays[i].t_max) ? make_hit_record(intersection, query) : HitRecord();
+    }
+}
+
 std::optional<Sample> BVH_tree::sample() const {
+    // an empty tree, or one whose last object was removed, has no surface to sample
+    if (_root_ptr == nullptr)
+        return std::nullopt;
+
     const auto threshold = std::sqrt(get_random_float()) * _root_ptr->area;
     auto s = sample(_root_ptr, threshold);
     if (s) s->pdf /= _root_ptr->area;
     return s;
 }
 
-std::unique_ptr<BVH_node> BVH_tree::recursive_build(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end) {
-    if (start >= end)
-        return nullptr;
+bool BVH_tree::update() {
+    if (_root_ptr == nullptr)
+        return false;
 
-    // Build current node
-    const auto obj_span = end - start;
-    if (obj_span == 1) {
-        auto node_ptr = std::make_unique<BVH_node>();
+    refit(*_root_ptr, 0);
+    if (sah_cost() <= REBUILD_COST_RATIO * _built_sah_cost) {
+        quantize();
+        return false;
+    }
 
-        // Create leaf node and return early
-        node_ptr->bound = obj_ptrs[start]->bound();
-        node_ptr->area = obj_ptrs[start]->area();
-        node_ptr->obj_ptr = obj_ptrs[start];
+    // the objects have moved too far from the partition they were built with
+    std::vector<std::shared_ptr<Object>> obj_ptrs;
+    collect_objects(_root_ptr, obj_ptrs);
+    _root_ptr = recursive_build(obj_ptrs, 0, obj_ptrs.size());
+    _leaf_ptrs.clear();
+    _leaf_ptrs_built = false;
+    _built_sah_cost = sah_cost();
+    quantize();
+    return true;
+}
 
-        return node_ptr;
-    } else if (obj_span == 2) {
-        auto node_ptr = std::make_unique<BVH_node>();
+void BVH_tree::quantize() {
+#ifdef USE_QUANTIZED_BVH
+    _quantized_bvh = QuantizedBVH(_root_ptr.get());
+#endif
+    _quantized_bvh_dirty = false;
+}
 
-        const auto left_idx = start;
-        const auto right_idx = start + 1;
+void BVH_tree::commit() {
+    if (_quantized_bvh_dirty)
+        quantize();
+}
 
-        // Assign first object to left
-        node_ptr->left_ptr = std::make_unique<BVH_node>();
-        node_ptr->left_ptr->bound = obj_ptrs[left_idx]->bound();
-        node_ptr->left_ptr->area = obj_ptrs[left_idx]->area();
-        node_ptr->left_ptr->obj_ptr = obj_ptrs[left_idx];
+float BVH_tree::sah_cost() const {
+    if (_root_ptr == nullptr)
+        return 0.0f;
+    const auto root_surface_area = _root_ptr->bound.surface_area();
+    return root_surface_area > 0.0f ? surface_area_cost(_root_ptr) / root_surface_area : 0.0f;
+}
 
-        // Assign second object to right
-        node_ptr->right_ptr = std::make_unique<BVH_node>();
-        node_ptr->right_ptr->bound = obj_ptrs[right_idx]->bound();
-        node_ptr->right_ptr->area = obj_ptrs[right_idx]->area();
-        node_ptr->right_ptr->obj_ptr = obj_ptrs[right_idx];
+void BVH_tree::refit(BVH_node& node, unsigned int depth) {
+    if (node.left_ptr == nullptr && node.right_ptr == nullptr) {
+        if (!node.obj_ptrs.empty()) {
+            node.bound = BoundingBox();
+            node.area = 0.0f;
+            for (const auto& obj_ptr : node.obj_ptrs) {
+                node.bound = union_box(node.bound, obj_ptr->bound());
+                node.area += obj_ptr->area();
+            }
+        }
+        return;
+    }
 
-        // Construct return node
-        node_ptr->bound = union_box(node_ptr->left_ptr->bound, node_ptr->right_ptr->bound);
-        node_ptr->area = node_ptr->left_ptr->area + node_ptr->right_ptr->area;
+    // the children are independent, refit the left one on another thread near the root
+    std::future<void> left_handle;
+    if (node.left_ptr != nullptr) {
+        if (depth < PARALLEL_REFIT_DEPTH && node.right_ptr != nullptr)
+            left_handle = std::async(std::launch::async, &BVH_tree::refit, std::ref(*node.left_ptr), depth + 1);
+        else
+            refit(*node.left_ptr, depth + 1);
+    }
+    if (node.right_ptr != nullptr)
+        refit(*node.right_ptr, depth + 1);
+    if (left_handle.valid())
+        left_handle.get();
 
-        return node_ptr;
+    fit_to_children(node);
+}
+
+void BVH_tree::fit_to_children(BVH_node& node) {
+    node.bound = BoundingBox();
+    node.area = 0.0f;
+    if (node.left_ptr != nullptr) {
+        node.bound = union_box(node.bound, node.left_ptr->bound);
+        node.area += node.left_ptr->area;
+    }
+    if (node.right_ptr != nullptr) {
+        node.bound = union_box(node.bound, node.right_ptr->bound);
+        node.area += node.right_ptr->area;
+    }
+}
+
+void BVH_tree::insert(const std::shared_ptr<Object>& obj_ptr) {
+    auto leaf_ptr = std::make_unique<BVH_node>();
+    leaf_ptr->obj_ptrs.push_back(obj_ptr);
+    leaf_ptr->bound = obj_ptr->bound();
+    leaf_ptr->area = obj_ptr->area();
+    if (_leaf_ptrs_built)
+        _leaf_ptrs[obj_ptr.get()] = leaf_ptr.get();
+    _quantized_bvh_dirty = true;
+
+    if (_root_ptr == nullptr) {
+        _root_ptr = std::move(leaf_ptr);
+        _built_sah_cost = sah_cost();
+        return;
+    }
+
+    // Pairing the leaf with a sibling adds a parent bounding both, and grows the bounds of all the sibling's
+    // ancestors. The growth of the ancestors is inherited by the children of a node, and the area of the leaf
+    // itself bounds the cost below, so subtrees that cannot beat the best sibling so far are skipped.
+    struct Candidate {
+        std::unique_ptr<BVH_node>* slot;
+        int parent;         // index of the candidate of the parent, -1 for the root
+        float inherited;    // growth of the surface areas of the ancestors
+    };
+    std::vector<Candidate> candidates = {{&_root_ptr, -1, 0.0f}};
+    using Entry = std::pair<float, int>;    // lower bound of the cost, index of the candidate
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<>> queue;
+    queue.emplace(0.0f, 0);
+
+    const auto leaf_area = leaf_ptr->bound.surface_area();
+    auto best_cost = std::numeric_limits<float>::infinity();
+    int best = 0;
+    while (!queue.empty()) {
+        const auto [lower_bound, idx] = queue.top();
+        queue.pop();
+        if (lower_bound >= best_cost)
+            break;
+
+        const auto candidate = candidates[idx];
+        auto& node = **candidate.slot;
+        const auto merged_area = union_box(node.bound, leaf_ptr->bound).surface_area();
+        const auto cost = merged_area + candidate.inherited;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = idx;
+        }
+
+        const auto inherited = candidate.inherited + merged_area - node.bound.surface_area();
+        if (node.left_ptr == nullptr || node.right_ptr == nullptr || leaf_area + inherited >= best_cost)
+            continue;
+        for (auto child_slot : {&node.left_ptr, &node.right_ptr}) {
+            candidates.push_back({child_slot, idx, inherited});
+            queue.emplace(leaf_area + inherited, static_cast<int>(candidates.size()) - 1);
+        }
+    }
+
+    std::vector<std::unique_ptr<BVH_node>*> path;
+    for (auto idx = best; idx != -1; idx = candidates[idx].parent)
+        path.push_back(candidates[idx].slot);
+    std::reverse(path.begin(), path.end());
+
+    auto& sibling_slot = *path.back();
+    auto parent_ptr = std::make_unique<BVH_node>();
+    parent_ptr->parent_ptr = sibling_slot->parent_ptr;
+    sibling_slot->parent_ptr = parent_ptr.get();
+    leaf_ptr->parent_ptr = parent_ptr.get();
+    parent_ptr->left_ptr = std::move(sibling_slot);
+    parent_ptr->right_ptr = std::move(leaf_ptr);
+    sibling_slot = std::move(parent_ptr);
+
+    refit_path(path);
+}
+
+bool BVH_tree::remove(const std::shared_ptr<Object>& obj_ptr) {
+    const auto leaf_ptr = find_leaf(obj_ptr.get());
+    if (leaf_ptr == nullptr)
+        return false;
+    _leaf_ptrs.erase(obj_ptr.get());
+    _quantized_bvh_dirty = true;
+
+    auto path = path_to(leaf_ptr);
+    auto& leaf = *leaf_ptr;
+    leaf.obj_ptrs.erase(std::find(leaf.obj_ptrs.begin(), leaf.obj_ptrs.end(), obj_ptr));
+    if (leaf.obj_ptrs.empty()) {
+        path.pop_back();
+        if (path.empty()) {
+            _root_ptr = nullptr;
+        } else {
+            // the parent of the leaf is replaced by the other child
+            auto& parent_slot = *path.back();
+            auto sibling_ptr = std::move(parent_slot->left_ptr.get() == leaf_ptr ? parent_slot->right_ptr : parent_slot->left_ptr);
+            sibling_ptr->parent_ptr = parent_slot->parent_ptr;
+            parent_slot = std::move(sibling_ptr);
+            path.pop_back();
+        }
     } else {
-        // Split the objects based on chosen method
+        leaf.bound = BoundingBox();
+        leaf.area = 0.0f;
+        for (const auto& leaf_obj_ptr : leaf.obj_ptrs) {
+            leaf.bound = union_box(leaf.bound, leaf_obj_ptr->bound());
+            leaf.area += leaf_obj_ptr->area();
+        }
+        path.pop_back();
+    }
+
+    refit_path(path);
+    return true;
+}
+
+void BVH_tree::refit_path(const std::vector<std::unique_ptr<BVH_node>*>& path) {
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        auto& node = ***it;
+        if (node.left_ptr == nullptr || node.right_ptr == nullptr)
+            continue;
+        fit_to_children(node);
+        rotate(node);
+    }
+}
+
+void BVH_tree::rotate(BVH_node& node) {
+    // swapping a child with a grandchild only changes the bound of the inner child the grandchild belongs to
+    std::unique_ptr<BVH_node>* best_child = nullptr;
+    std::unique_ptr<BVH_node>* best_grandchild = nullptr;
+    auto best_gain = 0.0f;
+    const auto try_rotations = [&](std::unique_ptr<BVH_node>& child_ptr, std::unique_ptr<BVH_node>& inner_ptr) {
+        if (inner_ptr->left_ptr == nullptr || inner_ptr->right_ptr == nullptr)
+            return;
+        const auto area = inner_ptr->bound.surface_area();
+        const auto gain_left = area - union_box(child_ptr->bound, inner_ptr->right_ptr->bound).surface_area();
+        if (gain_left > best_gain) {
+            best_gain = gain_left;
+            best_child = &child_ptr;
+            best_grandchild = &inner_ptr->left_ptr;
+        }
+        const auto gain_right = area - union_box(child_ptr->bound, inner_ptr->left_ptr->bound).surface_area();
+        if (gain_right > best_gain) {
+            best_gain = gain_right;
+            best_child = &child_ptr;
+            best_grandchild = &inner_ptr->right_ptr;
+        }
+    };
+    try_rotations(node.left_ptr, node.right_ptr);
+    try_rotations(node.right_ptr, node.left_ptr);
+    if (best_child == nullptr)
+        return;
+
+    auto& inner = best_child == &node.left_ptr ? *node.right_ptr : *node.left_ptr;
+    std::swap(*best_child, *best_grandchild);
+    (*best_child)->parent_ptr = &node;
+    (*best_grandchild)->parent_ptr = &inner;
+    fit_to_children(inner);
+}
+
+BVH_node* BVH_tree::find_leaf(const Object* obj_ptr) {
+    if (!_leaf_ptrs_built) {
+        const auto collect = [&](BVH_node* node_ptr, const auto& self) -> void {
+            if (node_ptr == nullptr)
+                return;
+            for (const auto& leaf_obj_ptr : node_ptr->obj_ptrs)
+                _leaf_ptrs[leaf_obj_ptr.get()] = node_ptr;
+            self(node_ptr->left_ptr.get(), self);
+            self(node_ptr->right_ptr.get(), self);
+        };
+        collect(_root_ptr.get(), collect);
+        _leaf_ptrs_built = true;
+    }
+    const auto it = _leaf_ptrs.find(obj_ptr);
+    return it != _leaf_ptrs.end() ? it->second : nullptr;
+}
+
+std::vector<std::unique_ptr<BVH_node>*> BVH_tree::path_to(BVH_node* node_ptr) {
+    std::vector<std::unique_ptr<BVH_node>*> path;
+    for (; node_ptr != nullptr; node_ptr = node_ptr->parent_ptr) {
+        const auto parent_ptr = node_ptr->parent_ptr;
+        if (parent_ptr == nullptr)
+            path.push_back(&_root_ptr);
+        else
+            path.push_back(parent_ptr->left_ptr.get() == node_ptr ? &parent_ptr->left_ptr : &parent_ptr->right_ptr);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+float BVH_tree::surface_area_cost(const std::unique_ptr<BVH_node>& node_ptr) const {
+    if (node_ptr == nullptr)
+        return 0.0f;
+    const auto surface_area = node_ptr->bound.surface_area();
+    if (node_ptr->left_ptr == nullptr && node_ptr->right_ptr == nullptr)
+        return surface_area * _build_params.intersection_cost * static_cast<float>(node_ptr->obj_ptrs.size());
+    return surface_area * _build_params.traversal_cost + surface_area_cost(node_ptr->left_ptr) + surface_area_cost(node_ptr->right_ptr);
+}
+
+void BVH_tree::collect_objects(const std::unique_ptr<BVH_node>& node_ptr, std::vector<std::shared_ptr<Object>>& obj_ptrs) {
+    if (node_ptr == nullptr)
+        return;
+    obj_ptrs.insert(obj_ptrs.end(), node_ptr->obj_ptrs.begin(), node_ptr->obj_ptrs.end());
+    collect_objects(node_ptr->left_ptr, obj_ptrs);
+    collect_objects(node_ptr->right_ptr, obj_ptrs);
+}
+
+std::unique_ptr<BVH_node> BVH_tree::recursive_build(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end) {
+    if (start >= end)
+        return nullptr;
+
+    // Split the objects based on chosen method
+    const auto obj_span = end - start;
+    auto mid = start;
+    if (obj_span > 1) {
         switch(_split_method) {
             case SplitMethod::NAIVE: {
-                return naive_partition(obj_ptrs, start, end, obj_span);
+                mid = naive_partition(obj_ptrs, start, end);
+                break;
             } case SplitMethod::SAH: {
-                return sah_partition(obj_ptrs, start, end);
+                mid = sah_partition(obj_ptrs, start, end);
+                break;
             } default: {
                 throw std::runtime_error("unknown split method");
             }
         }
     }
-}
 
-std::unique_ptr<BVH_node> BVH_tree::naive_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end, size_t obj_span) {
+    // Build current node
     auto node_ptr = std::make_unique<BVH_node>();
+    if (obj_span == 1 || leaf_is_cheaper(obj_ptrs, start, mid, end)) {
+        // Create leaf node and return early
+        node_ptr->obj_ptrs.assign(obj_ptrs.begin() + start, obj_ptrs.begin() + end);
+        for (const auto& obj_ptr : node_ptr->obj_ptrs) {
+            node_ptr->bound = union_box(node_ptr->bound, obj_ptr->bound());
+            node_ptr->area += obj_ptr->area();
+        }
+        return node_ptr;
+    }
+
+    // Recursively build nodes
+    node_ptr->left_ptr = recursive_build(obj_ptrs, start, mid);
+    node_ptr->right_ptr = recursive_build(obj_ptrs, mid, end);
+    node_ptr->left_ptr->parent_ptr = node_ptr.get();
+    node_ptr->right_ptr->parent_ptr = node_ptr.get();
+    node_ptr->bound = union_box(node_ptr->left_ptr->bound, node_ptr->right_ptr->bound);
+    node_ptr->area = node_ptr->left_ptr->area + node_ptr->right_ptr->area;
 
+    return node_ptr;
+}
+
+bool BVH_tree::leaf_is_cheaper(const std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t mid, size_t end) const {
+    const auto obj_span = end - start;
+    if (obj_span > _build_params.max_leaf_size)
+        return false;
+    // only triangles share leaves, the other objects may be meshes with BVHs of their own
+    for (auto i = start; i < end; ++i) {
+        if (dynamic_cast<const Triangle*>(obj_ptrs[i].get()) == nullptr)
+            return false;
+    }
+
+    BoundingBox left_bound, right_bound;
+    for (auto i = start; i < mid; ++i)
+        left_bound = union_box(left_bound, obj_ptrs[i]->bound());
+    for (auto i = mid; i < end; ++i)
+        right_bound = union_box(right_bound, obj_ptrs[i]->bound());
+    const auto surface_area = union_box(left_bound, right_bound).surface_area();
+    if (surface_area <= 0.0f)
+        return true;
+
+    const auto left_area = left_bound.surface_area() / surface_area;
+    const auto right_area = right_bound.surface_area() / surface_area;
+#ifdef USE_QUANTIZED_BVH
+    // The triangles of a leaf are tested together, see *QuantizedBVH::intersect*
+    const auto leaf_cost = _build_params.intersection_cost;
+    const auto split_cost = _build_params.traversal_cost + _build_params.intersection_cost * (left_area + right_area);
+#else
+    const auto leaf_cost = _build_params.intersection_cost * static_cast<float>(obj_span);
+    const auto split_cost = _build_params.traversal_cost + _build_params.intersection_cost
+                          * (left_area * static_cast<float>(mid - start) + right_area * static_cast<float>(end - mid));
+#endif
+    return leaf_cost <= split_cost;
+}
+
+size_t BVH_tree::naive_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end) {
     // Compute the union bounding box of the centroids
     // of the bounding boxes of given range of objects.
     BoundingBox centroid_bound;
@@ -110,35 +457,20 @@ std::unique_ptr<BVH_node> BVH_tree::naive_partition(std::vector<std::shared_ptr<
         return lhs_box_centroid[dim] < rhs_box_centroid[dim];
     });
 
-    const auto mid = start + obj_span / 2;
-
-    // Recursively build nodes
-    node_ptr->left_ptr = recursive_build(obj_ptrs, start, mid);
-    node_ptr->right_ptr = recursive_build(obj_ptrs, mid, end);
-    node_ptr->area = 0.0f;
-
-    if (node_ptr->left_ptr != nullptr) {
-        node_ptr->bound = union_box(node_ptr->bound, node_ptr->left_ptr->bound);
-        node_ptr->area += node_ptr->left_ptr->area;
-    }
-    if (node_ptr->right_ptr != nullptr) {
-        node_ptr->bound = union_box(node_ptr->bound, node_ptr->right_ptr->bound);
-        node_ptr->area += node_ptr->right_ptr->area;
-    }
-
-    return node_ptr;
+    return start + (end - start) / 2;
 }
 
-std::unique_ptr<BVH_node> BVH_tree::sah_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end) {
+size_t BVH_tree::sah_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end) {
     constexpr int bucket_num = 16;
 
-    auto node_ptr = std::make_unique<BVH_node>();
-
     // Compute bounding box of all objects in BVH node
     BoundingBox bound;
     for (auto i = start; i < end; ++i)
         bound = union_box(bound, obj_ptrs[i]->bound());
-    node_ptr->bound = bound;
+
+    const auto bucket_idx = [&bound](const BoundingBox& box, int dim) {
+        return std::min(bucket_num - 1, static_cast<int>(bound.offset_ratio(box.centroid())[dim] * bucket_num));
+    };
 
     // Record variables
     auto min_cost = FLOAT_INFINITY;
@@ -154,9 +486,8 @@ std::unique_ptr<BVH_node> BVH_tree::sah_partition(std::vector<std::shared_ptr<Ob
         std::vector<size_t> object_counters(bucket_num);
 
         for (auto i = start; i < end; ++i) {
-            const auto& obj_ptr = obj_ptrs[i];
-            const auto box = obj_ptr->bound();
-            const auto idx = static_cast<int>(bound.offset_ratio(box.centroid())[dim] * bucket_num);
+            const auto box = obj_ptrs[i]->bound();
+            const auto idx = bucket_idx(box, dim);
             box_buckets[idx] = union_box(box_buckets[idx], box);
             ++object_counters[idx];
         }
@@ -185,8 +516,11 @@ std::unique_ptr<BVH_node> BVH_tree::sah_partition(std::vector<std::shared_ptr<Ob
             right_accumulation[current_split] = object_counters[right_first_idx] + right_accumulation[prev_split];
         }
 
-        // Find out the split with minimum cost
+        // Find out the split with minimum cost, among those leaving objects on both sides
         for (int current_split = 1; current_split < bucket_num; ++current_split) {
+            if (left_accumulation[current_split] == 0 || right_accumulation[current_split] == 0)
+                continue;
+
             const auto current_cost = left_union_boxes[current_split].surface_area() * left_accumulation[current_split]
                                       + right_union_boxes[current_split].surface_area() * right_accumulation[current_split];
 
@@ -196,36 +530,19 @@ std::unique_ptr<BVH_node> BVH_tree::sah_partition(std::vector<std::shared_ptr<Ob
                 axis = current_axis;
             }
         }
-
-        return node_ptr;
     }
 
-    assert(split != -1);
+    // all centroids fall into one bucket, halve the objects
+    if (split == -1)
+        return naive_partition(obj_ptrs, start, end);
 
+    // Move the objects of the buckets left of the split to the front
     const auto dim = BoundingBox::axis_to_dim(axis);
-
-    const auto iter_start = obj_ptrs.begin() + start;
-    const auto iter_end = obj_ptrs.begin() + end;
-    std::sort(iter_start, iter_end, [dim](const auto& lhs, const auto& rhs) {
-        return lhs->bound().centroid()[dim] < rhs->bound().centroid()[dim];
+    const auto mid_iter = std::partition(obj_ptrs.begin() + start, obj_ptrs.begin() + end, [&](const std::shared_ptr<Object>& obj_ptr) {
+        return bucket_idx(obj_ptr->bound(), dim) < split;
     });
 
-    // Find the mid with the split we just calculated
-    const auto threshold = bound.p_min[dim] + bound.diagonal()[dim] * (static_cast<float>(split) / static_cast<float>(bucket_num));
-    const auto comparator = [dim](const float threshold, const std::shared_ptr<Object>& obj_ptr) {
-        return obj_ptr->bound().centroid()[dim] > threshold;
-    };
-    const auto mid = static_cast<size_t>(std::upper_bound(iter_start, std::prev(iter_end), threshold, comparator) - obj_ptrs.begin());
-
-    // Recursively build nodes
-    node_ptr->left_ptr = recursive_build(obj_ptrs, start, mid);
-    node_ptr->right_ptr = recursive_build(obj_ptrs, mid, end);
-
-    node_ptr->area = 0.0f;
-    if (node_ptr->left_ptr != nullptr) node_ptr->area += node_ptr->left_ptr->area;
-    if (node_ptr->right_ptr != nullptr) node_ptr->area += node_ptr->right_ptr->area;
-
-    return node_ptr;
+    return static_cast<size_t>(mid_iter - obj_ptrs.begin());
 }
 
 std::optional<Intersection> BVH_tree::intersect(const std::unique_ptr<BVH_node>& node_ptr, const Ray& ray, Culling culling) const {
@@ -233,8 +550,14 @@ std::optional<Intersection> BVH_tree::intersect(const std::unique_ptr<BVH_node>&
     if (node_ptr == nullptr || !node_ptr->bound.intersect(ray))
         return std::nullopt;
 
-    if (node_ptr->left_ptr == nullptr && node_ptr->right_ptr == nullptr && node_ptr->obj_ptr != nullptr) {
-        return node_ptr->obj_ptr->intersect(ray, culling);
+    if (node_ptr->left_ptr == nullptr && node_ptr->right_ptr == nullptr) {
+        std::optional<Intersection> closest;
+        for (const auto& obj_ptr : node_ptr->obj_ptrs) {
+            auto intersection = obj_ptr->intersect(ray, culling);
+            if (intersection && (!closest || intersection->time < closest->time))
+                closest = std::move(intersection);
+        }
+        return closest;
     } else {
         const auto left_intersection = intersect(node_ptr->left_ptr, ray, culling);
         const auto right_intersection = intersect(node_ptr->right_ptr, ray, culling);
@@ -255,10 +578,19 @@ std::optional<Sample> BVH_tree::sample(const std::unique_ptr<BVH_node>& node_ptr
     if (node_ptr == nullptr)
         return std::nullopt;
 
-    if (node_ptr->left_ptr == nullptr && node_ptr->right_ptr == nullptr && node_ptr->obj_ptr != nullptr) {
-        auto s = node_ptr->obj_ptr->sample();
-        if (s) s->pdf *= node_ptr->area;
-        return s;
+    if (node_ptr->left_ptr == nullptr && node_ptr->right_ptr == nullptr) {
+        // pick an object of the leaf by area
+        for (size_t i = 0; i < node_ptr->obj_ptrs.size(); ++i) {
+            const auto& obj_ptr = node_ptr->obj_ptrs[i];
+            const auto obj_area = obj_ptr->area();
+            if (threshold < obj_area || i + 1 == node_ptr->obj_ptrs.size()) {
+                auto s = obj_ptr->sample();
+                if (s) s->pdf *= obj_area;
+                return s;
+            }
+            threshold -= obj_area;
+        }
+        return std::nullopt;
     } else {
         if (node_ptr->left_ptr != nullptr && node_ptr->right_ptr != nullptr) {
             return (node_ptr->left_ptr->area > threshold) ? sample(node_ptr->left_ptr, threshold) : sample(node_ptr->right_ptr, threshold - node_ptr->left_ptr->area);
@@ -3,20 +3,36 @@
 #include <vector>
 #include <memory>
 #include <optional>
+#include <unordered_map>
 
 #include "Object.hpp"
 #include "Ray.hpp"
 #include "BoundingBox.hpp"
 #include "Intersection.hpp"
+#include "QuantizedBVH.hpp"
+#include "RayQuery.hpp"
 
 struct BVH_node {
     BoundingBox bound;
     float area;
     std::unique_ptr<BVH_node> left_ptr;
     std::unique_ptr<BVH_node> right_ptr;
-    std::shared_ptr<Object> obj_ptr;
+    std::vector<std::shared_ptr<Object>> obj_ptrs;     // objects of a leaf
+    BVH_node* parent_ptr;       // nullptr for the root
 
-    BVH_node() : bound(), area(0.0f), left_ptr(nullptr), right_ptr(nullptr), obj_ptr(nullptr) { }
+    BVH_node() : bound(), area(0.0f), left_ptr(nullptr), right_ptr(nullptr), parent_ptr(nullptr) { }
+};
+
+// Costs weighed by the surface area heuristic, relative to each other. A range of objects becomes a leaf
+// when testing all of them costs less than a split into two children.
+struct BVH_build_params {
+    float traversal_cost = 0.5f;        // of testing a ray against the bounds of a node
+    // of testing a ray against an object of a leaf, or against all the triangles of a leaf at once with
+    // USE_QUANTIZED_BVH
+    float intersection_cost = 1.0f;
+    // Objects in a leaf at most. Only triangles share leaves, they are tested together with Vector3f_soa
+    // in the quantized BVH, so there are at most Vector3f_soa::WIDTH.
+    size_t max_leaf_size = 4;
 };
 
 class BVH_tree {
@@ -27,28 +43,93 @@ public:
     };
 
     BVH_tree();
+    // *print_stats* prints the build time and node counts
     BVH_tree(std::vector<std::shared_ptr<Object>>& obj_ptrs,
-            SplitMethod split_method = SplitMethod::NAIVE);
+            SplitMethod split_method = SplitMethod::NAIVE, bool print_stats = true, const BVH_build_params& build_params = {});
     BVH_tree(std::vector<std::shared_ptr<Object>>&& obj_ptrs,
-            SplitMethod split_method = SplitMethod::NAIVE);
-    BVH_tree(BVH_tree&& rhs) noexcept : _root_ptr(std::move(rhs._root_ptr)), _split_method(rhs._split_method) {};
+            SplitMethod split_method = SplitMethod::NAIVE, bool print_stats = true, const BVH_build_params& build_params = {});
+    BVH_tree(BVH_tree&& rhs) noexcept
+        : _root_ptr(std::move(rhs._root_ptr)), _split_method(rhs._split_method), _build_params(rhs._build_params),
+          _built_sah_cost(rhs._built_sah_cost), _quantized_bvh(std::move(rhs._quantized_bvh)),
+          _quantized_bvh_dirty(rhs._quantized_bvh_dirty), _leaf_ptrs(std::move(rhs._leaf_ptrs)), _leaf_ptrs_built(rhs._leaf_ptrs_built) {};
 
     float area() const { return _root_ptr == nullptr ? 0.0f : _root_ptr->area; };
-    BoundingBox bound() const { return _root_ptr == nullptr ? bound() : _root_ptr->bound; }
+    BoundingBox bound() const { return _root_ptr == nullptr ? BoundingBox() : _root_ptr->bound; }
     SplitMethod split_method() const { return _split_method; }
 
     [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray, Culling culling) const;
+    // Answer *query* for a batch of rays, interleaving the traversals with USE_QUANTIZED_BVH, see *QuantizedBVH::intersect*
+    void intersect(Span<const Ray> rays, Culling culling, RayQuery query, Span<HitRecord> hits) const;
     [[nodiscard]] std::optional<Sample> sample() const;
 
+    // Compact copy of the tree, empty without USE_QUANTIZED_BVH and out of date after *insert* or *remove*
+    // until *commit*
+    const QuantizedBVH& quantized_bvh() const { return _quantized_bvh; }
+
+    // Refit the bounds and areas of the nodes bottom-up after the objects have moved, keeping the topology.
+    // Once the SAH cost of the refitted tree exceeds REBUILD_COST_RATIO times its cost right after
+    // the last build, the tree is rebuilt from its objects instead. Returns true if it was rebuilt.
+    bool update();
+
+    // Insert *obj_ptr* in a leaf of its own. Its sibling is the node where the SAH cost of the tree grows the
+    // least, found by a branch and bound search from the root. The ancestors are refitted bottom-up and rotated
+    // where swapping a child with a grandchild lowers their surface area, which keeps the tree balanced under
+    // many edits without a rebuild.
+    void insert(const std::shared_ptr<Object>& obj_ptr);
+    // Remove *obj_ptr* from its leaf, a leaf left empty is replaced by its sibling, then refit and rotate the
+    // ancestors as *insert* does. Returns false if the tree does not hold the object.
+    bool remove(const std::shared_ptr<Object>& obj_ptr);
+    // Rebuild the compact copy of the tree after a batch of *insert* and *remove*. Until then rays traverse
+    // the node tree, which is correct but slower.
+    void commit();
+
+    // Surface area heuristic cost of the tree: the surface areas of the inner nodes times the traversal cost
+    // plus those of the leaves times the cost of their objects, relative to the root, i.e. the expected cost
+    // of the nodes and objects a random ray is tested against
+    [[nodiscard]] float sah_cost() const;
+
 private:
     [[nodiscard]] std::unique_ptr<BVH_node> recursive_build(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end);
-    [[nodiscard]] std::unique_ptr<BVH_node> naive_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end, size_t obj_span);
-    [[nodiscard]] std::unique_ptr<BVH_node> sah_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end);
+    // Index splitting [start, end) into the children, reordering the objects
+    [[nodiscard]] size_t naive_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end);
+    [[nodiscard]] size_t sah_partition(std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t end);
+    // Whether testing the objects in [start, end) costs less by the SAH than splitting them at *mid*
+    [[nodiscard]] bool leaf_is_cheaper(const std::vector<std::shared_ptr<Object>>& obj_ptrs, size_t start, size_t mid, size_t end) const;
 
     [[nodiscard]] std::optional<Intersection> intersect(const std::unique_ptr<BVH_node>& node_ptr, const Ray& ray, Culling culling) const;
     [[nodiscard]] std::optional<Sample> sample(const std::unique_ptr<BVH_node>& node_ptr, float threshold) const;
 
+    // Rebuild the compact copy of the tree used for traversal after the nodes have changed
+    void quantize();
+
+    // Refit the subtree of *node*, the subtrees down to PARALLEL_REFIT_DEPTH are refitted in parallel
+    static void refit(BVH_node& node, unsigned int depth);
+    // Bound and area of an inner *node* from those of its children
+    static void fit_to_children(BVH_node& node);
+    // Refit the nodes of *path* from the last one up to the root, rotating each of them
+    static void refit_path(const std::vector<std::unique_ptr<BVH_node>*>& path);
+    // Swap a child of *node* with a grandchild on the other side if that lowers the surface area of the
+    // inner child, see Kensler, "Tree Rotations for Improving Bounding Volume Hierarchies"
+    static void rotate(BVH_node& node);
+    // Leaf holding *obj_ptr*, nullptr if there is none. The map from the objects to their leaves is
+    // collected on the first call and then kept up to date by *insert* and *remove*.
+    [[nodiscard]] BVH_node* find_leaf(const Object* obj_ptr);
+    // Slots from the root down to *node_ptr*
+    [[nodiscard]] std::vector<std::unique_ptr<BVH_node>*> path_to(BVH_node* node_ptr);
+    float surface_area_cost(const std::unique_ptr<BVH_node>& node_ptr) const;
+    static void collect_objects(const std::unique_ptr<BVH_node>& node_ptr, std::vector<std::shared_ptr<Object>>& obj_ptrs);
+
 private:
+    static constexpr float REBUILD_COST_RATIO = 1.15f;
+    static constexpr unsigned int PARALLEL_REFIT_DEPTH = 4;
+
     std::unique_ptr<BVH_node> _root_ptr;
     SplitMethod _split_method;
+    BVH_build_params _build_params;
+    float _built_sah_cost = 0.0f;
+    // traversed instead of the node tree with USE_QUANTIZED_BVH, which is still used for sampling and refitting
+    QuantizedBVH _quantized_bvh;
+    bool _quantized_bvh_dirty = false;      // edited since the last quantization
+    std::unordered_map<const Object*, BVH_node*> _leaf_ptrs;
+    bool _leaf_ptrs_built = false;
 };
\ No newline at end of file
@@ -11,6 +11,11 @@ BoundingBox::Axis BoundingBox::max_extent() const {
 }
 
 bool BoundingBox::intersect(const Ray& ray) const {
+    float t_enter;
+    return intersect(ray, t_enter);
+}
+
+bool BoundingBox::intersect(const Ray& ray, float& t_enter) const {
     // Test if ray bound intersects
     const auto t_pmax = (p_max - ray.ori) * ray.inv_dir;
     const auto t_pmin = (p_min - ray.ori) * ray.inv_dir;
@@ -19,7 +24,7 @@ bool BoundingBox::intersect(const Ray& ray) const {
     const auto t_min = Vector3f::min_elems(t_pmin, t_pmax);
     const auto t_max = Vector3f::max_elems(t_pmin, t_pmax);
 
-    const auto t_enter = std::max(std::max(t_min.x, t_min.y), t_min.z);
+    t_enter = std::max(std::max(t_min.x, t_min.y), t_min.z);
     const auto t_exit = std::min(std::min(t_max.x, t_max.y), t_max.z);
 
     return (t_exit >= t_enter) && (t_exit > 0.0f);
@@ -37,6 +37,8 @@ struct BoundingBox {
     }
 
     bool intersect(const Ray& ray) const;
+    // Also give the time *t_enter* the ray enters the box, negative if it starts inside
+    bool intersect(const Ray& ray, float& t_enter) const;
 
     // offset ratio from *p_min* to *p_max* on each axis
     Vector3f offset_ratio(const Vector3f& p) const;
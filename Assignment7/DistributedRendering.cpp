@@ -0,0 +1,425 @@
+#include "DistributedRendering.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define DISTRIBUTED_RENDERING_SUPPORTED
+#endif
+
+TileCoordinator::TileCoordinator(const Scene& scene, unsigned int spp, unsigned int tile_size, unsigned int samples_per_job)
+    : _width(scene.width()), _height(scene.height()), _eye_pos(scene.eye_pos()), _fov(scene.fov()),
+      _color_sum(static_cast<size_t>(scene.width()) * static_cast<size_t>(scene.height())),
+      _sample_count(static_cast<size_t>(scene.width()) * static_cast<size_t>(scene.height()), 0) {
+    tile_size = std::max(tile_size, 1u);
+    samples_per_job = std::max(samples_per_job, 1u);
+
+    // all the tiles get their first samples before any tile gets more, so that the jobs left
+    // at the end, when the workers run out of work, are spread over the image
+    uint32_t id = 0;
+    for (unsigned int rendered_spp = 0; rendered_spp < spp; rendered_spp += samples_per_job) {
+        for (unsigned int y = 0; y < _height; y += tile_size) {
+            for (unsigned int x = 0; x < _width; x += tile_size) {
+                Job job;
+                job.id = id++;
+                job.tile = { x, y, std::min(tile_size, _width - x), std::min(tile_size, _height - y) };
+                job.spp = std::min(samples_per_job, spp - rendered_spp);
+                _pending_jobs.push_back(job);
+            }
+        }
+    }
+    _job_count = _pending_jobs.size();
+}
+
+bool TileCoordinator::next_job(Job& job) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    // the jobs of the other workers may still come back if they disconnect
+    _cv.wait(lock, [this] { return !_pending_jobs.empty() || _merged_job_count == _job_count; });
+    if (_pending_jobs.empty())
+        return false;
+
+    job = _pending_jobs.front();
+    _pending_jobs.pop_front();
+    return true;
+}
+
+void TileCoordinator::requeue_job(const Job& job) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending_jobs.push_front(job);
+    _cv.notify_one();
+}
+
+void TileCoordinator::merge_job(const Job& job, const std::vector<float>& colors, unsigned int sample_count) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const auto weight = static_cast<float>(sample_count);
+    for (unsigned int row = 0; row < job.tile.height; ++row) {
+        for (unsigned int col = 0; col < job.tile.width; ++col) {
+            const auto tile_idx = 3 * (static_cast<size_t>(row) * job.tile.width + col);
+            const auto pixel_idx = static_cast<size_t>(job.tile.y + row) * _width + job.tile.x + col;
+            _color_sum[pixel_idx] += Vector3f(colors[tile_idx], colors[tile_idx + 1], colors[tile_idx + 2]) * weight;
+            _sample_count[pixel_idx] += sample_count;
+        }
+    }
+
+    ++_merged_job_count;
+    update_progress(static_cast<float>(_merged_job_count) / static_cast<float>(_job_count));
+    if (_merged_job_count == _job_count)
+        _cv.notify_all();
+}
+
+bool TileCoordinator::finished() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _merged_job_count == _job_count;
+}
+
+#ifdef DISTRIBUTED_RENDERING_SUPPORTED
+
+namespace {
+    enum MessageType : uint32_t {
+        TILE = 1,
+        RESULT = 2,
+        FINISH = 3
+    };
+
+    // Messages are sent as 32-bit words in network byte order, floats as their IEEE 754 bits
+    struct MessageHeader {
+        uint32_t type = 0;
+        uint32_t size = 0;      // of the payload in bytes
+    };
+
+    struct TileMessage {
+        uint32_t id, image_width, image_height, x, y, width, height, spp;
+        float eye_x, eye_y, eye_z, fov;
+
+        static constexpr size_t WORD_COUNT = 12;
+    };
+
+    struct ResultMessage {
+        uint32_t id, width, height, sample_count;
+
+        static constexpr size_t WORD_COUNT = 4;
+    };
+
+    uint32_t float_to_bits(float f) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+
+    float bits_to_float(uint32_t bits) {
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // how long a worker keeps trying to reach a coordinator which is not listening yet
+    constexpr unsigned int CONNECT_ATTEMPT_COUNT = 50;
+    constexpr auto CONNECT_RETRY_INTERVAL = std::chrono::milliseconds(100);
+
+    // How long the coordinator waits on a worker before its job is handed to another one. A job of 32 x 32 pixels
+    // and 16 spp takes a few seconds, so only stalled workers run into it.
+    constexpr time_t WORKER_TIMEOUT_SECONDS = 120;
+    // TCP keepalive probes on idle worker connections, to notice machines which went away without closing them
+    constexpr int KEEPALIVE_IDLE_SECONDS = 30;
+    constexpr int KEEPALIVE_INTERVAL_SECONDS = 10;
+    constexpr int KEEPALIVE_PROBE_COUNT = 3;
+
+    // Make the sends and receives on *fd* fail after WORKER_TIMEOUT_SECONDS and probe the connection while it is idle
+    void set_worker_deadlines(int fd) {
+        timeval timeout{};
+        timeout.tv_sec = WORKER_TIMEOUT_SECONDS;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        const int keepalive = 1;
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+#ifdef TCP_KEEPIDLE
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &KEEPALIVE_IDLE_SECONDS, sizeof(KEEPALIVE_IDLE_SECONDS));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &KEEPALIVE_INTERVAL_SECONDS, sizeof(KEEPALIVE_INTERVAL_SECONDS));
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &KEEPALIVE_PROBE_COUNT, sizeof(KEEPALIVE_PROBE_COUNT));
+#endif
+    }
+
+    bool send_all(int fd, const void* data, size_t size) {
+        const auto* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            const auto n = write(fd, bytes, size);
+            if (n <= 0)
+                return false;
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool receive_all(int fd, void* data, size_t size) {
+        auto* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            const auto n = read(fd, bytes, size);
+            if (n <= 0)
+                return false;
+            bytes += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Send the header and the payload *words*, given in host byte order
+    bool send_message(int fd, MessageType type, std::vector<uint32_t> words = {}) {
+        words.insert(words.begin(), { type, static_cast<uint32_t>(words.size() * sizeof(uint32_t)) });
+        for (auto& word : words)
+            word = htonl(word);
+        return send_all(fd, words.data(), words.size() * sizeof(uint32_t));
+    }
+
+    // Receive *count* words into *words* in host byte order
+    bool receive_words(int fd, uint32_t* words, size_t count) {
+        if (!receive_all(fd, words, count * sizeof(uint32_t)))
+            return false;
+        for (size_t i = 0; i < count; ++i)
+            words[i] = ntohl(words[i]);
+        return true;
+    }
+
+    bool receive_header(int fd, MessageHeader& header) {
+        uint32_t words[2];
+        if (!receive_words(fd, words, 2))
+            return false;
+        header = { words[0], words[1] };
+        return true;
+    }
+
+    std::vector<uint32_t> encode(const TileMessage& message) {
+        return { message.id, message.image_width, message.image_height, message.x, message.y, message.width, message.height, message.spp,
+                 float_to_bits(message.eye_x), float_to_bits(message.eye_y), float_to_bits(message.eye_z), float_to_bits(message.fov) };
+    }
+
+    TileMessage decode_tile(const uint32_t* words) {
+        return { words[0], words[1], words[2], words[3], words[4], words[5], words[6], words[7],
+                 bits_to_float(words[8]), bits_to_float(words[9]), bits_to_float(words[10]), bits_to_float(words[11]) };
+    }
+}
+
+void TileWorker::run(const std::string& host, uint16_t port) {
+    std::signal(SIGPIPE, SIG_IGN);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+        throw std::runtime_error("cannot resolve coordinator " + host);
+
+    int fd = -1;
+    for (unsigned int attempt = 0; attempt < CONNECT_ATTEMPT_COUNT && fd < 0; ++attempt) {
+        if (attempt > 0)
+            std::this_thread::sleep_for(CONNECT_RETRY_INTERVAL);
+        for (auto* address = addresses; address != nullptr && fd < 0; address = address->ai_next) {
+            fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) < 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0)
+        throw std::runtime_error("cannot connect to coordinator " + host + ":" + std::to_string(port));
+
+    std::cout << " - Tile worker connected to " << host << ":" << port << std::endl;
+    unsigned int job_count = 0;
+    for (;;) {
+        MessageHeader header;
+        if (!receive_header(fd, header)) {
+            close(fd);
+            throw std::runtime_error("lost connection to coordinator");
+        }
+        if (header.type == FINISH)
+            break;
+
+        uint32_t words[TileMessage::WORD_COUNT];
+        if (header.type != TILE || header.size != sizeof(words) || !receive_words(fd, words, TileMessage::WORD_COUNT)) {
+            close(fd);
+            throw std::runtime_error("invalid message from coordinator");
+        }
+        const auto message = decode_tile(words);
+        if (message.width == 0 || message.height == 0 || message.spp == 0
+            || message.x + message.width > message.image_width || message.y + message.height > message.image_height) {
+            close(fd);
+            throw std::runtime_error("invalid tile from coordinator");
+        }
+
+        // the jobs run one after another, so the scene is only touched by this thread while rendering
+        _scene.set_camera(message.image_width, message.image_height, Vector3f(message.eye_x, message.eye_y, message.eye_z), message.fov);
+
+        const Renderer::ImageTile tile{ message.x, message.y, message.width, message.height };
+        const auto colors = _renderer.render_tile(_scene, tile, message.spp, _total_thread_count);
+
+        std::vector<uint32_t> result{ message.id, message.width, message.height, message.spp };
+        result.reserve(ResultMessage::WORD_COUNT + 3 * colors.size());
+        for (const auto& color : colors) {
+            result.push_back(float_to_bits(color.x));
+            result.push_back(float_to_bits(color.y));
+            result.push_back(float_to_bits(color.z));
+        }
+        if (!send_message(fd, RESULT, std::move(result))) {
+            close(fd);
+            throw std::runtime_error("lost connection to coordinator");
+        }
+        ++job_count;
+    }
+
+    close(fd);
+    std::cout << " - Tile worker finished after " << job_count << " jobs" << std::endl;
+}
+
+std::vector<Vector3f> TileCoordinator::run(uint16_t port, unsigned int local_worker_count, const std::vector<std::string>& worker_command) {
+    // workers may hang up in the middle of a job
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const auto listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw std::runtime_error("cannot create socket");
+
+    const int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        close(listen_fd);
+        throw std::runtime_error("cannot listen on port " + std::to_string(port));
+    }
+    std::cout << " - Tile coordinator listening on port " << port << " with " << _job_count << " jobs" << std::endl;
+
+    std::vector<pid_t> local_workers;
+    if (local_worker_count > 0 && worker_command.empty())
+        throw std::runtime_error("no command to start the local workers with");
+    for (unsigned int i = 0; i < local_worker_count; ++i) {
+        const auto pid = fork();
+        if (pid == 0) {
+            std::vector<char*> argv;
+            for (const auto& arg : worker_command)
+                argv.push_back(const_cast<char*>(arg.c_str()));
+            argv.push_back(nullptr);
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        if (pid > 0)
+            local_workers.push_back(pid);
+    }
+
+    std::vector<std::thread> worker_threads;
+    auto running_local_worker_count = local_workers.size();
+    while (!finished()) {
+        pollfd listen_poll{ listen_fd, POLLIN, 0 };
+        if (poll(&listen_poll, 1, 100) > 0) {
+            const auto worker_fd = accept(listen_fd, nullptr, nullptr);
+            if (worker_fd >= 0) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                ++_active_worker_count;
+                worker_threads.emplace_back(&TileCoordinator::serve_worker, this, worker_fd);
+            }
+        }
+
+        // without remote workers the jobs can no longer be finished once all the local ones are gone
+        for (auto& pid : local_workers) {
+            if (pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid) {
+                pid = 0;
+                --running_local_worker_count;
+            }
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (local_worker_count > 0 && running_local_worker_count == 0 && _active_worker_count == 0
+            && _merged_job_count < _job_count) {
+            close(listen_fd);
+            for (auto& thread : worker_threads)
+                thread.join();
+            throw std::runtime_error("all local workers exited before the image was finished");
+        }
+    }
+
+    close(listen_fd);
+    for (auto& thread : worker_threads)
+        thread.join();
+    for (const auto pid : local_workers) {
+        if (pid > 0)
+            waitpid(pid, nullptr, 0);
+    }
+    std::cout << std::endl;
+
+    std::vector<Vector3f> frame_buffer(_color_sum.size());
+    for (size_t i = 0; i < frame_buffer.size(); ++i)
+        frame_buffer[i] = _sample_count[i] > 0 ? _color_sum[i] / static_cast<float>(_sample_count[i]) : Vector3f(0.0f);
+    return frame_buffer;
+}
+
+void TileCoordinator::serve_worker(int worker_fd) {
+    // a worker which stalls or dies without closing the connection times out and its job is requeued
+    set_worker_deadlines(worker_fd);
+
+    Job job;
+    std::vector<uint32_t> color_bits;
+    std::vector<float> colors;
+    auto connected = true;
+    while (connected && next_job(job)) {
+        const TileMessage message{ job.id, _width, _height, job.tile.x, job.tile.y, job.tile.width, job.tile.height, job.spp,
+                                   _eye_pos.x, _eye_pos.y, _eye_pos.z, _fov };
+        MessageHeader header;
+        uint32_t result_words[ResultMessage::WORD_COUNT] = {};
+        color_bits.resize(3 * static_cast<size_t>(job.tile.width) * job.tile.height);
+
+        connected = send_message(worker_fd, TILE, encode(message))
+            && receive_header(worker_fd, header)
+            && header.type == RESULT && header.size == (ResultMessage::WORD_COUNT + color_bits.size()) * sizeof(uint32_t)
+            && receive_words(worker_fd, result_words, ResultMessage::WORD_COUNT);
+        const ResultMessage result{ result_words[0], result_words[1], result_words[2], result_words[3] };
+        connected = connected
+            && result.id == job.id && result.width == job.tile.width && result.height == job.tile.height && result.sample_count > 0
+            && receive_words(worker_fd, color_bits.data(), color_bits.size());
+
+        if (connected) {
+            colors.resize(color_bits.size());
+            std::transform(color_bits.begin(), color_bits.end(), colors.begin(), bits_to_float);
+            merge_job(job, colors, result.sample_count);
+        }
+        else
+            requeue_job(job);
+    }
+
+    if (connected)
+        send_message(worker_fd, FINISH);
+    close(worker_fd);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    --_active_worker_count;
+}
+
+#else
+
+void TileWorker::run(const std::string& host, uint16_t port) {
+    throw std::runtime_error("distributed rendering requires POSIX sockets");
+}
+
+std::vector<Vector3f> TileCoordinator::run(uint16_t port, unsigned int local_worker_count, const std::vector<std::string>& worker_command) {
+    throw std::runtime_error("distributed rendering requires POSIX sockets");
+}
+
+void TileCoordinator::serve_worker(int worker_fd) { }
+
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Renderer.hpp"
+#include "Scene.hpp"
+
+// Distributed tile rendering over TCP.
+//
+// The coordinator splits the image into tiles and the samples of each tile into jobs. Workers, which are
+// separate processes with the same scene loaded, connect to the coordinator and are handed one job at a
+// time. They return the mean color of the tile with the number of samples it is made of, and the coordinator
+// merges the tiles weighted by their sample counts, so a tile may be rendered by several workers.
+// The jobs of a worker which disconnects, or does not answer within WORKER_TIMEOUT_SECONDS, are handed to the others.
+//
+// Protocol: binary messages of a header { uint32 type, uint32 payload size } and a payload, all sent as
+// 32-bit words in network byte order, with floats as their IEEE 754 bits.
+//     coordinator -> worker: TILE { uint32 id, image width, image height, x, y, width, height, spp;
+//                                   float eye_x, eye_y, eye_z, fov }
+//     worker -> coordinator: RESULT { uint32 id, width, height, sample count } followed by width * height RGB floats
+//     coordinator -> worker: FINISH once all the jobs are merged
+
+// Renders the jobs sent by a *TileCoordinator* with all the rendering threads of the process
+class TileWorker {
+public:
+    TileWorker(Scene& scene, const Renderer& renderer, unsigned int total_thread_count)
+        : _scene(scene), _renderer(renderer), _total_thread_count(total_thread_count) {}
+
+    // Connect to the coordinator at *host*:*port* and render jobs until it finishes. Only supported on POSIX systems.
+    void run(const std::string& host, uint16_t port);
+
+private:
+    Scene& _scene;
+    const Renderer& _renderer;
+    unsigned int _total_thread_count;
+};
+
+class TileCoordinator {
+public:
+    // Jobs of *tile_size* x *tile_size* pixels with at most *samples_per_job* of the *spp* samples,
+    // for the image size and camera of *scene*
+    TileCoordinator(const Scene& scene, unsigned int spp, unsigned int tile_size = 32, unsigned int samples_per_job = 16);
+
+    // Listen on TCP *port*, start *local_worker_count* local workers with the command line *worker_command*
+    // and serve the jobs to every worker which connects until all of them are merged.
+    // Returns the linear colors of the image. Only supported on POSIX systems.
+    std::vector<Vector3f> run(uint16_t port, unsigned int local_worker_count, const std::vector<std::string>& worker_command);
+
+    size_t job_count() const { return _job_count; }
+
+private:
+    struct Job {
+        uint32_t id = 0;
+        Renderer::ImageTile tile;
+        unsigned int spp = 0;
+    };
+
+    // Send jobs to the worker connected on *worker_fd* and merge its results
+    void serve_worker(int worker_fd);
+
+    // Wait for a job to hand out, false once all jobs are merged
+    [[nodiscard]] bool next_job(Job& job);
+    // Hand *job* to another worker
+    void requeue_job(const Job& job);
+    // Add the mean colors *colors* of *sample_count* samples of the tile of *job* to the image
+    void merge_job(const Job& job, const std::vector<float>& colors, unsigned int sample_count);
+
+    [[nodiscard]] bool finished();
+
+private:
+    unsigned int _width;
+    unsigned int _height;
+    Vector3f _eye_pos;
+    float _fov;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Job> _pending_jobs;
+    size_t _job_count = 0;
+    size_t _merged_job_count = 0;
+    unsigned int _active_worker_count = 0;
+
+    std::vector<Vector3f> _color_sum;       // colors weighted by sample count
+    std::vector<unsigned int> _sample_count;
+};
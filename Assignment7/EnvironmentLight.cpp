@@ -0,0 +1,173 @@
+#include "EnvironmentLight.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    // Find the segment [cdf[i], cdf[i + 1]) containing *p* and the offset ratio of *p* inside it
+    size_t sample_cdf(const std::vector<float>::const_iterator cdf_begin, size_t segment_num, float p, float& offset) {
+        const auto cdf_end = cdf_begin + static_cast<std::ptrdiff_t>(segment_num) + 1;
+        auto idx = static_cast<size_t>(std::upper_bound(cdf_begin, cdf_end, p) - cdf_begin);
+        idx = std::min(std::max(idx, static_cast<size_t>(1)), segment_num) - 1;
+
+        const auto lo = *(cdf_begin + static_cast<std::ptrdiff_t>(idx));
+        const auto hi = *(cdf_begin + static_cast<std::ptrdiff_t>(idx) + 1);
+        offset = hi > lo ? (p - lo) / (hi - lo) : 0.0f;
+        return idx;
+    }
+}
+
+EnvironmentLight::EnvironmentLight(const std::string& file_name, float scale) {
+    load_pfm(file_name, scale);
+    build_distribution();
+
+    std::cout << " - Environment map " << file_name << " (" << _width << " x " << _height << ") loaded" << std::endl;
+}
+
+Vector3f EnvironmentLight::radiance(const Vector3f& dir) const {
+    const auto uv = dir_to_uv(dir);
+    const auto col = std::min(static_cast<unsigned int>(uv.x * static_cast<float>(_width)), _width - 1);
+    const auto row = std::min(static_cast<unsigned int>(uv.y * static_cast<float>(_height)), _height - 1);
+    return texel(col, row);
+}
+
+std::optional<EnvironmentSample> EnvironmentLight::sample() const {
+    if (_integral <= 0.0f)
+        return std::nullopt;
+
+    // sample a row from the marginal distribution, then a column from its conditional distribution
+    float row_offset, col_offset;
+    const auto row = sample_cdf(_marginal_cdf.begin(), _height, get_random_float(), row_offset);
+    const auto row_cdf_begin = _conditional_cdfs.begin() + static_cast<std::ptrdiff_t>(row * (_width + 1));
+    const auto col = sample_cdf(row_cdf_begin, _width, get_random_float(), col_offset);
+
+    const auto u = (static_cast<float>(col) + col_offset) / static_cast<float>(_width);
+    const auto v = (static_cast<float>(row) + row_offset) / static_cast<float>(_height);
+
+    EnvironmentSample s;
+    s.dir = uv_to_dir(u, v);
+    s.radiance = radiance(s.dir);
+    s.pdf = pdf(s.dir);
+    if (s.pdf <= 0.0f)
+        return std::nullopt;
+
+    return s;
+}
+
+float EnvironmentLight::pdf(const Vector3f& dir) const {
+    if (_integral <= 0.0f)
+        return 0.0f;
+
+    const auto uv = dir_to_uv(dir);
+    const auto sin_theta = std::sqrt(std::max(0.0f, 1.0f - dir.y * dir.y));
+    if (sin_theta <= 0.0f)
+        return 0.0f;
+
+    const auto col = std::min(static_cast<unsigned int>(uv.x * static_cast<float>(_width)), _width - 1);
+    const auto row = std::min(static_cast<unsigned int>(uv.y * static_cast<float>(_height)), _height - 1);
+    const auto row_sin_theta = std::sin(PI * (static_cast<float>(row) + 0.5f) / static_cast<float>(_height));
+
+    // PDF over the texture coordinates, then change of variables (u, v) -> (theta, phi) -> solid angle
+    const auto pdf_uv = luminance(texel(col, row)) * row_sin_theta / _integral;
+    return pdf_uv / (2.0f * PI * PI * sin_theta);
+}
+
+void EnvironmentLight::load_pfm(const std::string& file_name, float scale) {
+    std::ifstream file(file_name, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot open environment map " + file_name);
+
+    // header: "PF" (RGB) or "Pf" (grayscale), width, height, scale (negative for little-endian)
+    std::string magic;
+    int width, height;
+    float endian_scale;
+    file >> magic >> width >> height >> endian_scale;
+    file.get();     // single whitespace before the raster
+
+    if (!file || (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0)
+        throw std::runtime_error("invalid PFM file " + file_name);
+
+    const size_t channel_num = magic == "PF" ? 3 : 1;
+    std::vector<float> raster(static_cast<size_t>(width) * static_cast<size_t>(height) * channel_num);
+    file.read(reinterpret_cast<char*>(raster.data()), static_cast<std::streamsize>(raster.size() * sizeof(float)));
+    if (!file)
+        throw std::runtime_error("truncated PFM file " + file_name);
+
+    // swap byte order if the file differs from the host
+    const uint16_t endian_probe = 1;
+    const auto host_little_endian = *reinterpret_cast<const uint8_t*>(&endian_probe) == 1;
+    if ((endian_scale < 0.0f) != host_little_endian) {
+        for (auto& value : raster) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits = (bits >> 24) | ((bits >> 8) & 0xFF00u) | ((bits << 8) & 0xFF0000u) | (bits << 24);
+            std::memcpy(&value, &bits, sizeof(bits));
+        }
+    }
+
+    _width = static_cast<unsigned int>(width);
+    _height = static_cast<unsigned int>(height);
+    _texels.resize(raster.size() / channel_num);
+
+    // PFM stores rows from bottom to top
+    for (unsigned int row = 0; row < _height; ++row) {
+        const auto src_row = _height - 1 - row;
+        for (unsigned int col = 0; col < _width; ++col) {
+            const auto src = (static_cast<size_t>(src_row) * _width + col) * channel_num;
+            const auto r = raster[src];
+            const auto g = channel_num == 3 ? raster[src + 1] : r;
+            const auto b = channel_num == 3 ? raster[src + 2] : r;
+            _texels[static_cast<size_t>(row) * _width + col] = scale * Vector3f(std::max(0.0f, r), std::max(0.0f, g), std::max(0.0f, b));
+        }
+    }
+}
+
+void EnvironmentLight::build_distribution() {
+    _conditional_cdfs.assign(static_cast<size_t>(_height) * (_width + 1), 0.0f);
+    _marginal_cdf.assign(_height + 1, 0.0f);
+
+    const auto inv_width = 1.0f / static_cast<float>(_width);
+    const auto inv_height = 1.0f / static_cast<float>(_height);
+
+    for (unsigned int row = 0; row < _height; ++row) {
+        // rows near the poles cover less solid angle
+        const auto sin_theta = std::sin(PI * (static_cast<float>(row) + 0.5f) * inv_height);
+        const auto cdf = _conditional_cdfs.begin() + static_cast<std::ptrdiff_t>(row) * (_width + 1);
+
+        for (unsigned int col = 0; col < _width; ++col)
+            cdf[col + 1] = cdf[col] + luminance(texel(col, row)) * sin_theta * inv_width;
+
+        const auto row_integral = cdf[_width];
+        for (unsigned int col = 1; col <= _width; ++col)
+            cdf[col] = row_integral > 0.0f ? cdf[col] / row_integral : static_cast<float>(col) * inv_width;
+
+        _marginal_cdf[row + 1] = _marginal_cdf[row] + row_integral * inv_height;
+    }
+
+    _integral = _marginal_cdf[_height];
+    for (unsigned int row = 1; row <= _height; ++row)
+        _marginal_cdf[row] = _integral > 0.0f ? _marginal_cdf[row] / _integral : static_cast<float>(row) * inv_height;
+}
+
+Vector2f EnvironmentLight::dir_to_uv(const Vector3f& dir) {
+    const auto phi = shading_math::atan2(dir.z, dir.x);                 // [-pi, pi]
+    const auto theta = shading_math::acos(clamp(-1.0f, 1.0f, dir.y));    // [0, pi]
+    return {
+        clamp(0.0f, 1.0f, (phi + PI) * 0.5f * INV_PI),
+        clamp(0.0f, 1.0f, theta * INV_PI)
+    };
+}
+
+Vector3f EnvironmentLight::uv_to_dir(float u, float v) {
+    const auto phi = 2.0f * PI * u - PI;
+    const auto theta = PI * v;
+
+    float sin_theta, cos_theta, sin_phi, cos_phi;
+    shading_math::sincos(theta, sin_theta, cos_theta);
+    shading_math::sincos(phi, sin_phi, cos_phi);
+    return { sin_theta * cos_phi, cos_theta, sin_theta * sin_phi };
+}
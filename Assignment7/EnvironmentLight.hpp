@@ -0,0 +1,54 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Math.hpp"
+
+// Radiance from a direction on the environment map sampled by *EnvironmentLight*.
+struct EnvironmentSample {
+    Vector3f dir;           // direction from the shading point towards the environment
+    Vector3f radiance;
+    float pdf = 0.0f;       // PDF in solid angle measure
+};
+
+// HDR environment light in latitude-longitude layout (y-axis up), loaded from a PFM (portable float map) image.
+//
+// A 2D piecewise-constant distribution (marginal CDF over rows and conditional CDF in each row)
+// proportional to luminance * sin(theta) is precomputed, so that bright regions are sampled more often.
+class EnvironmentLight {
+public:
+    explicit EnvironmentLight(const std::string& file_name, float scale = 1.0f);
+
+    unsigned int width() const { return _width; }
+    unsigned int height() const { return _height; }
+
+    // Radiance coming from the given (unit) direction
+    [[nodiscard]] Vector3f radiance(const Vector3f& dir) const;
+
+    // Sample a direction proportional to the radiance of the map
+    [[nodiscard]] std::optional<EnvironmentSample> sample() const;
+
+    // PDF (solid angle measure) of sampling the given (unit) direction with *sample*
+    [[nodiscard]] float pdf(const Vector3f& dir) const;
+
+private:
+    void load_pfm(const std::string& file_name, float scale);
+    void build_distribution();
+
+    // direction <-> texture coordinates in [0, 1)^2
+    static Vector2f dir_to_uv(const Vector3f& dir);
+    static Vector3f uv_to_dir(float u, float v);
+
+    const Vector3f& texel(unsigned int col, unsigned int row) const { return _texels[row * _width + col]; }
+
+private:
+    unsigned int _width = 0;
+    unsigned int _height = 0;
+    std::vector<Vector3f> _texels;      // row 0 is the top (theta = 0)
+
+    std::vector<float> _conditional_cdfs;   // height * (width + 1), one CDF for each row
+    std::vector<float> _marginal_cdf;       // height + 1
+    float _integral = 0.0f;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+// Polynomial approximations of the transcendental functions used in sampling and shading.
+//
+// All functions are branch-free apart from selects, so loops over them can be vectorized.
+// Maximum absolute errors against std in their valid range:
+//     sincos : 1e-7 for |x| <= 1e4
+//     pow5   : exact up to float rounding (4 multiplications)
+//     acos   : 5e-7 for x in [-1, 1]
+//     atan   : 2e-6 for any finite x
+//     atan2  : 2e-6 for any finite x and y
+namespace fast_math {
+    constexpr float PI = 3.141592653589793f;
+
+    // sin(x) and cos(x) with one range reduction to [-pi/4, pi/4] (Cephes minimax polynomials)
+    inline void sincos(float x, float& sin_x, float& cos_x) {
+        constexpr float TWO_OVER_PI = 0.636619772367581f;
+        // pi / 2 split into three parts (Cody-Waite reduction)
+        constexpr float PI_OVER_2_HI = 1.5703125f;
+        constexpr float PI_OVER_2_MID = 4.837512969970703125e-4f;
+        constexpr float PI_OVER_2_LO = 7.54978995489188216e-8f;
+
+        const auto quadrant = std::nearbyint(x * TWO_OVER_PI);
+        const auto r = ((x - quadrant * PI_OVER_2_HI) - quadrant * PI_OVER_2_MID) - quadrant * PI_OVER_2_LO;
+        const auto r_sq = r * r;
+
+        const auto s = r + r * r_sq * ((-1.9515295891e-4f * r_sq + 8.3321608736e-3f) * r_sq - 1.6666654611e-1f);
+        const auto c = 1.0f - 0.5f * r_sq + r_sq * r_sq * ((2.443315711809948e-5f * r_sq - 1.388731625493765e-3f) * r_sq + 4.166664568298827e-2f);
+
+        const auto q = static_cast<int>(quadrant) & 3;
+        const auto swap = (q & 1) != 0;
+        sin_x = swap ? c : s;
+        cos_x = swap ? s : c;
+        if (q == 1 || q == 2) cos_x = -cos_x;
+        if (q >= 2) sin_x = -sin_x;
+    }
+
+    // x^5 for the Fresnel-Schlick term
+    inline float pow5(float x) {
+        const auto x_sq = x * x;
+        return x_sq * x_sq * x;
+    }
+
+    // Abramowitz & Stegun 4.4.46 on |x|, mirrored for negative x
+    inline float acos(float x) {
+        const auto a = std::min(std::fabs(x), 1.0f);
+        auto p = -0.0012624911f;
+        p = p * a + 0.0066700901f;
+        p = p * a - 0.0170881256f;
+        p = p * a + 0.0308918810f;
+        p = p * a - 0.0501743046f;
+        p = p * a + 0.0889789874f;
+        p = p * a - 0.2145988016f;
+        p = p * a + 1.5707963050f;
+        const auto r = std::sqrt(1.0f - a) * p;
+        return x < 0.0f ? PI - r : r;
+    }
+
+    // minimax polynomial of atan(t) for t in [0, 1]
+    inline float atan_unit(float t) {
+        const auto t_sq = t * t;
+        auto p = -0.01172120f;
+        p = p * t_sq + 0.05265332f;
+        p = p * t_sq - 0.11643287f;
+        p = p * t_sq + 0.19354346f;
+        p = p * t_sq - 0.33262347f;
+        p = p * t_sq + 0.99997726f;
+        return p * t;
+    }
+
+    // atan_unit on |x|, using atan(x) = pi / 2 - atan(1 / x) for |x| > 1
+    inline float atan(float x) {
+        const auto a = std::fabs(x);
+        const auto invert = a > 1.0f;
+        const auto t = invert ? 1.0f / a : a;
+        auto r = atan_unit(t);
+        r = invert ? 0.5f * PI - r : r;
+        return std::copysign(r, x);
+    }
+
+    inline float atan2(float y, float x) {
+        const auto abs_x = std::fabs(x);
+        const auto abs_y = std::fabs(y);
+        const auto max_xy = std::max(abs_x, abs_y);
+        const auto t = max_xy > 0.0f ? std::min(abs_x, abs_y) / max_xy : 0.0f;
+        auto r = atan_unit(t);
+        r = abs_y > abs_x ? 0.5f * PI - r : r;
+        r = x < 0.0f ? PI - r : r;
+        return std::copysign(r, y);
+    }
+}
+
+// Reference implementations with the same interface.
+namespace std_math {
+    inline void sincos(float x, float& sin_x, float& cos_x) { sin_x = std::sin(x), cos_x = std::cos(x); }
+    inline float pow5(float x) { return std::pow(x, 5.0f); }
+    inline float acos(float x) { return std::acos(x); }
+    inline float atan(float x) { return std::atan(x); }
+    inline float atan2(float y, float x) { return std::atan2(y, x); }
+}
+
+// Functions used by sampling and shading code, selected at compile time.
+// Define *USE_FAST_MATH* to use the polynomial approximations.
+#ifdef USE_FAST_MATH
+namespace shading_math = fast_math;
+#else
+namespace shading_math = std_math;
+#endif
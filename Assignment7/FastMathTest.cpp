@@ -0,0 +1,53 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#include "FastMath.hpp"
+
+// Checks the error bounds documented in FastMath.hpp by sweeping each function over its valid range.
+// Exits with a non-zero status if any bound is exceeded.
+
+namespace {
+    constexpr int SAMPLE_NUM = 1 << 20;
+
+    // Maximum absolute error of *f* against *reference* at SAMPLE_NUM evenly spaced points in [lo, hi]
+    double max_error(float lo, float hi, const std::function<double(float)>& f, const std::function<double(double)>& reference) {
+        auto error = 0.0;
+        for (int i = 0; i <= SAMPLE_NUM; ++i) {
+            const auto x = lo + (hi - lo) * static_cast<float>(i) / SAMPLE_NUM;
+            error = std::max(error, std::fabs(f(x) - reference(x)));
+        }
+        return error;
+    }
+
+    bool check(const char* name, double error, double bound) {
+        const auto passed = error <= bound;
+        std::printf("%-12s max error %.3e (bound %.1e) %s\n", name, error, bound, passed ? "ok" : "FAILED");
+        return passed;
+    }
+}
+
+int main() {
+    auto passed = true;
+
+    passed &= check("sin", max_error(-1e4f, 1e4f, [](float x) { float s, c; fast_math::sincos(x, s, c); return s; },
+        [](double x) { return std::sin(x); }), 1e-7);
+    passed &= check("cos", max_error(-1e4f, 1e4f, [](float x) { float s, c; fast_math::sincos(x, s, c); return c; },
+        [](double x) { return std::cos(x); }), 1e-7);
+    // pow5 rounds four times, each by up to half a float epsilon
+    passed &= check("pow5", max_error(0.0f, 1.0f, fast_math::pow5, [](double x) { return std::pow(x, 5.0); }), 2.0 * FLT_EPSILON);
+    passed &= check("acos", max_error(-1.0f, 1.0f, fast_math::acos, [](double x) { return std::acos(x); }), 5e-7);
+    passed &= check("atan", max_error(-1e3f, 1e3f, fast_math::atan, [](double x) { return std::atan(x); }), 2e-6);
+
+    // atan2 around circles of several radii, covering all four quadrants and the axes
+    for (const auto radius : {1e-3f, 1.0f, 1e3f}) {
+        passed &= check("atan2", max_error(-fast_math::PI, fast_math::PI,
+            [=](float angle) { return fast_math::atan2(radius * std::sin(angle), radius * std::cos(angle)); },
+            [=](double angle) { return std::atan2(static_cast<double>(radius * std::sin(static_cast<float>(angle))),
+                                                  static_cast<double>(radius * std::cos(static_cast<float>(angle)))); }), 2e-6);
+    }
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -54,7 +54,7 @@ float Microfacet::distribution(float normal_dot_micro_surface_normal, float roug
 }
 
 Vector3f Microfacet::fresnel_schlick(float micro_surface_normal_dot_ray_out_dir, const Vector3f& f0) {
-    return f0 + (Vector3f(1.0f) - f0) * pow(1.0f - micro_surface_normal_dot_ray_out_dir, 5);
+    return f0 + (Vector3f(1.0f) - f0) * shading_math::pow5(1.0f - micro_surface_normal_dot_ray_out_dir);
 }
 
 float Microfacet::geometry(float normal_dot_light_source_dir, float normal_dot_observer_dir, float roughness) {
@@ -64,7 +64,7 @@ float Microfacet::geometry(float normal_dot_light_source_dir, float normal_dot_o
 Vector3f Microfacet::sample_micro_surface(const Vector3f& normal, float roughness_sq) {
     const auto r0 = get_random_float();
     const auto r1 = get_random_float();
-    const auto theta = std::acosf(std::sqrtf((1.0f - r0) / ((roughness_sq - 1.0f) * r0 + 1.0f)));
+    const auto theta = shading_math::acos(std::sqrtf((1.0f - r0) / ((roughness_sq - 1.0f) * r0 + 1.0f)));
     const auto phi = 2 * PI * r1;
 	
     const auto local_micro_surface_normal = polar_to_cartesian(theta, phi);
@@ -122,9 +122,11 @@ Vector3f Diffuse::sample_ray_source_dir(const Vector3f& ray_out_dir, const Vecto
     const auto z = std::fabs(1.0f - 2.0f * x1);
     const auto r = std::sqrt(1.0f - z * z);
     const auto phi = 2 * PI * x2;
+    float sin_phi, cos_phi;
+    shading_math::sincos(phi, sin_phi, cos_phi);
 
     // get local direction of the ray out
-    const Vector3f local_ray_out_dir = { r * std::cos(phi), r * std::sin(phi), z };
+    const Vector3f local_ray_out_dir = { r * cos_phi, r * sin_phi, z };
 
     // transform to the world space
     return local_to_world(local_ray_out_dir, normal);
@@ -132,11 +134,16 @@ Vector3f Diffuse::sample_ray_source_dir(const Vector3f& ray_out_dir, const Vecto
 
 float Diffuse::pdf(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const {
     // uniformly sampling from hemisphere results in probability 1 / (2 * PI)
-    return ray_out_dir.dot(normal) > 0.0f ? 0.5f * INV_PI : 0.0f;
+    return (ray_out_dir.dot(normal) > 0.0f && ray_source_dir.dot(normal) > 0.0f) ? 0.5f * INV_PI : 0.0f;
 }
 
 Vector3f Diffuse::contribution(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const {
-    return ray_out_dir.dot(normal) > 0.0f ? _albedo * INV_PI : Vector3f(0.0f);
+    // no transmission, the ray source must be in the hemisphere of the observer
+    return (ray_out_dir.dot(normal) > 0.0f && ray_source_dir.dot(normal) > 0.0f) ? _albedo * INV_PI : Vector3f(0.0f);
+}
+
+bool Diffuse::near_specular() const {
+    return false;
 }
 
 
@@ -198,6 +205,10 @@ Vector3f MetalRough::contribution(const Vector3f& ray_source_dir, const Vector3f
     return diffuse + specular;
 }
 
+bool MetalRough::near_specular() const {
+    return _roughness < NEAR_SPECULAR_ROUGHNESS;
+}
+
 
 
 bool FrostedGlass::emitting() const {
@@ -292,4 +303,8 @@ Vector3f FrostedGlass::contribution(const Vector3f& ray_source_dir, const Vector
         return Microfacet::refract_jacobian(micro_surface_normal_dot_ray_source_dir, ior_in, micro_surface_normal_dot_ray_out_dir, ior_out)
             * abs(micro_surface_normal_dot_ray_source_dir) * D * (1.0f - F) * G;
     }
+}
+
+bool FrostedGlass::near_specular() const {
+    return _roughness < NEAR_SPECULAR_ROUGHNESS;
 }
\ No newline at end of file
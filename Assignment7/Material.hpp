@@ -2,6 +2,9 @@
 
 #include "Math.hpp"
 
+// Roughness below which a microfacet lobe is treated as near-specular
+constexpr float NEAR_SPECULAR_ROUGHNESS = 0.2f;
+
 // Compute reflection direction
 Vector3f reflect(const Vector3f& ray_in_dir, const Vector3f& normal);
 
@@ -29,6 +32,9 @@ public:
     // Given the directions of the ray source and ray out and a normal vector,
     // calculate its contribution from BSDF (bidirectional scattering distribution function).
     [[nodiscard]] virtual Vector3f contribution(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const = 0;
+
+    // Whether the BSDF is concentrated in a narrow lobe, so that sampling it directly beats any learned distribution.
+    [[nodiscard]] virtual bool near_specular() const = 0;
 };
 
 class Microfacet {
@@ -69,6 +75,10 @@ public:
     [[nodiscard]] Vector3f sample_ray_source_dir(const Vector3f& ray_out_dir, const Vector3f& normal) const override;
     [[nodiscard]] float pdf(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const override;
     [[nodiscard]] Vector3f contribution(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const override;
+    [[nodiscard]] bool near_specular() const override;
+
+    // Parameter edits are seen by the next render, see *Renderer::reshade*
+    void set_albedo(const Vector3f& albedo) { _albedo = albedo; }
 	
 private:
     Vector3f _albedo;
@@ -89,6 +99,12 @@ public:
     [[nodiscard]] Vector3f sample_ray_source_dir(const Vector3f& ray_out_dir, const Vector3f& normal) const override;
     [[nodiscard]] float pdf(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const override;
     [[nodiscard]] Vector3f contribution(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const override;
+    [[nodiscard]] bool near_specular() const override;
+
+    // Parameter edits are seen by the next render, see *Renderer::reshade*
+    void set_albedo(const Vector3f& albedo) { _albedo = albedo; }
+    void set_roughness(float roughness) { _roughness = roughness; _roughness_sq = roughness * roughness; }
+    void set_metallic(float metallic) { _metallic = metallic; }
 
 private:
     Vector3f _albedo;
@@ -111,6 +127,11 @@ public:
     [[nodiscard]] Vector3f sample_ray_source_dir(const Vector3f& ray_out_dir, const Vector3f& normal) const override;
     [[nodiscard]] float pdf(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const override;
     [[nodiscard]] Vector3f contribution(const Vector3f& ray_source_dir, const Vector3f& ray_out_dir, const Vector3f& normal) const override;
+    [[nodiscard]] bool near_specular() const override;
+
+    // Parameter edits are seen by the next render, see *Renderer::reshade*
+    void set_roughness(float roughness) { _roughness = roughness; _roughness_sq = roughness * roughness; }
+    void set_ior(float ior) { _ior = ior; }
 
 private:
     float _roughness;
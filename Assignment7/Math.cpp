@@ -32,16 +32,6 @@ float get_random_float() {
     return dist(rng);
 }
 
-Vector3f Vector3f::normalized() const {
-    const auto mag_sq = magnitude_squared();
-    if (mag_sq > 0) {
-        const auto inv_mag = 1 / sqrtf(mag_sq);
-        return { x * inv_mag, y * inv_mag, z * inv_mag };
-    } else {
-        return { 0.0f, 0.0f, 0.0f };
-    }
-}
-
 Vector3f local_to_world(const Vector3f& local_dir, const Vector3f& normal) {
     Vector3f t;
     if (std::fabs(normal.x) > std::fabs(normal.y)) {
@@ -5,6 +5,15 @@
 #include <ostream>
 #include <cmath>
 
+#include "FastMath.hpp"
+
+// SSE/AVX implementation of vector types is selected at compile time.
+// Define *DISABLE_SIMD* to fall back to the portable scalar implementation.
+#if !defined(DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define USE_SIMD
+#include <immintrin.h>
+#endif
+
 constexpr float PI = 3.141592653589793f;            // pi
 constexpr float INV_PI = 1.0f / PI;                 // 1 / pi
 constexpr float DEGREE_TO_RAD_RATIO = PI / 180.0f;  // (2 * pi) / 360
@@ -23,6 +32,94 @@ std::optional<std::tuple<float, float>> solve_quadratic(float a, float b, float
 
 float get_random_float();
 
+// Fast approximation of 1 / sqrt(v), returns 0 if v is not positive.
+// Hardware estimation refined by one Newton-Raphson step (relative error < 1e-6).
+inline float fast_rsqrt(float v) {
+#ifdef USE_SIMD
+    const auto x = _mm_set_ss(v);
+    auto y = _mm_rsqrt_ss(x);
+    // y' = y * (1.5 - 0.5 * x * y * y)
+    y = _mm_mul_ss(y, _mm_sub_ss(_mm_set_ss(1.5f), _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), x), _mm_mul_ss(y, y))));
+    return v > 0.0f ? _mm_cvtss_f32(y) : 0.0f;
+#else
+    return v > 0.0f ? 1.0f / std::sqrt(v) : 0.0f;
+#endif
+}
+
+#ifdef USE_SIMD
+
+// 16-byte aligned vector operated on in one SSE register, the 4th lane *w* is kept as padding.
+// The lanes are plain members, moved in and out of the register with aligned loads and stores.
+struct alignas(16) Vector3f {
+    float x, y, z, w;
+
+    Vector3f() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+    Vector3f(float k) : x(k), y(k), z(k), w(0.0f) {}
+    Vector3f(float x_val, float y_val, float z_val) : x(x_val), y(y_val), z(z_val), w(0.0f) {}
+    Vector3f(__m128 v) { _mm_store_ps(&x, v); }
+
+    __m128 simd() const { return _mm_load_ps(&x); }
+
+    static Vector3f min_elems(const Vector3f& v1, const Vector3f& v2) { return _mm_min_ps(v1.simd(), v2.simd()); }
+
+    static Vector3f max_elems(const Vector3f& v1, const Vector3f& v2) { return _mm_max_ps(v1.simd(), v2.simd()); }
+
+    Vector3f operator -() const { return _mm_sub_ps(_mm_setzero_ps(), simd()); }
+
+    Vector3f operator +(const Vector3f& v) const { return _mm_add_ps(simd(), v.simd()); }
+
+    Vector3f operator -(const Vector3f& v) const { return _mm_sub_ps(simd(), v.simd()); }
+
+    Vector3f operator *(const Vector3f& v) const { return _mm_mul_ps(simd(), v.simd()); }
+    Vector3f operator *(float k) const { return _mm_mul_ps(simd(), _mm_set1_ps(k)); }
+
+    Vector3f operator /(float k) const { return _mm_mul_ps(simd(), _mm_set1_ps(1 / k)); }
+
+    Vector3f& operator +=(const Vector3f& v) { _mm_store_ps(&x, _mm_add_ps(simd(), v.simd())); return *this; }
+
+    float operator [](int index) const { return (&x)[index]; }
+    float& operator [](int index) { return (&x)[index]; }
+
+    Vector3f normalized() const {
+        const auto mag_sq = dot_broadcast(*this);
+        auto inv_mag = _mm_rsqrt_ps(mag_sq);
+        inv_mag = _mm_mul_ps(inv_mag, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), mag_sq), _mm_mul_ps(inv_mag, inv_mag))));
+        // zero vector stays zero
+        inv_mag = _mm_and_ps(inv_mag, _mm_cmpgt_ps(mag_sq, _mm_setzero_ps()));
+        return _mm_mul_ps(simd(), inv_mag);
+    }
+
+    float magnitude_squared() const { return dot(*this); }
+
+    float magnitude() const { return sqrtf(magnitude_squared()); }
+
+    float dot(const Vector3f& rhs) const { return _mm_cvtss_f32(dot_broadcast(rhs)); }
+
+    Vector3f cross(const Vector3f& rhs) const {
+        // (a.yzx * b - a * b.yzx).yzx
+        const auto a_yzx = _mm_shuffle_ps(simd(), simd(), _MM_SHUFFLE(3, 0, 2, 1));
+        const auto b_yzx = _mm_shuffle_ps(rhs.simd(), rhs.simd(), _MM_SHUFFLE(3, 0, 2, 1));
+        const auto c = _mm_sub_ps(_mm_mul_ps(simd(), b_yzx), _mm_mul_ps(a_yzx, rhs.simd()));
+        return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+    }
+
+private:
+    // dot product of x/y/z lanes broadcast to all lanes
+    __m128 dot_broadcast(const Vector3f& rhs) const {
+#ifdef __SSE4_1__
+        return _mm_dp_ps(simd(), rhs.simd(), 0x7F);
+#else
+        const auto m = _mm_mul_ps(simd(), rhs.simd());
+        const auto s = _mm_add_ss(_mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(m, m));
+        return _mm_shuffle_ps(s, s, _MM_SHUFFLE(0, 0, 0, 0));
+#endif
+    }
+};
+
+static_assert(sizeof(Vector3f) == 16, "Vector3f must fit one SSE register");
+
+#else
+
 struct Vector3f {
     float x, y, z;
 
@@ -54,23 +151,129 @@ struct Vector3f {
     float operator [](int index) const { return (&x)[index]; }
     float& operator [](int index) { return (&x)[index]; }
 
-    Vector3f normalized() const;
+    Vector3f normalized() const {
+        const auto inv_mag = fast_rsqrt(magnitude_squared());
+        return { x * inv_mag, y * inv_mag, z * inv_mag };
+    }
 
     float magnitude_squared() const { return x * x + y * y + z * z; }
 
     float magnitude() const { return sqrtf(x * x + y * y + z * z); }
 
-    float dot(const Vector3f rhs) const { return x * rhs.x + y * rhs.y + z * rhs.z; }
+    float dot(const Vector3f& rhs) const { return x * rhs.x + y * rhs.y + z * rhs.z; }
 
-    Vector3f cross(const Vector3f rhs) const { return { y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z, x * rhs.y - y * rhs.x }; }
+    Vector3f cross(const Vector3f& rhs) const { return { y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z, x * rhs.y - y * rhs.x }; }
 };
 
-inline Vector3f operator *(float k, const Vector3f& v) { return { v.x * k, v.y * k, v.z * k }; }
+#endif
+
+inline Vector3f operator *(float k, const Vector3f& v) { return v * k; }
 
 inline std::ostream& operator <<(std::ostream& os, const Vector3f& v) { return os << v.x << ", " << v.y << ", " << v.z; }
 
 inline Vector3f lerp(const Vector3f& a, const Vector3f& b, float t) {  return a * (1.0f - t) + b * t; }
 
+// 8 floats processed together, backed by one AVX register when available.
+struct alignas(32) Float8 {
+    static constexpr int WIDTH = 8;
+
+#if defined(USE_SIMD) && defined(__AVX__)
+    __m256 simd;
+
+    Float8() : simd(_mm256_setzero_ps()) {}
+    Float8(float k) : simd(_mm256_set1_ps(k)) {}
+    Float8(__m256 v) : simd(v) {}
+
+    static Float8 load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, simd); }
+
+    Float8 operator +(const Float8& v) const { return _mm256_add_ps(simd, v.simd); }
+    Float8 operator -(const Float8& v) const { return _mm256_sub_ps(simd, v.simd); }
+    Float8 operator *(const Float8& v) const { return _mm256_mul_ps(simd, v.simd); }
+    Float8 operator /(const Float8& v) const { return _mm256_div_ps(simd, v.simd); }
+
+    static Float8 min_elems(const Float8& v1, const Float8& v2) { return _mm256_min_ps(v1.simd, v2.simd); }
+    static Float8 max_elems(const Float8& v1, const Float8& v2) { return _mm256_max_ps(v1.simd, v2.simd); }
+
+    // Fast approximation of 1 / sqrt(v) on each lane, lanes that are not positive become 0.
+    Float8 rsqrt() const {
+        auto y = _mm256_rsqrt_ps(simd);
+        y = _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), simd), _mm256_mul_ps(y, y))));
+        return _mm256_and_ps(y, _mm256_cmp_ps(simd, _mm256_setzero_ps(), _CMP_GT_OQ));
+    }
+
+    float operator [](int index) const { return reinterpret_cast<const float*>(&simd)[index]; }
+    float& operator [](int index) { return reinterpret_cast<float*>(&simd)[index]; }
+#else
+    float lanes[WIDTH];
+
+    Float8() : lanes{} {}
+    Float8(float k) { for (auto& l : lanes) l = k; }
+
+    static Float8 load(const float* p) { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = p[i]; return r; }
+    void store(float* p) const { for (int i = 0; i < WIDTH; ++i) p[i] = lanes[i]; }
+
+    Float8 operator +(const Float8& v) const { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = lanes[i] + v.lanes[i]; return r; }
+    Float8 operator -(const Float8& v) const { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = lanes[i] - v.lanes[i]; return r; }
+    Float8 operator *(const Float8& v) const { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = lanes[i] * v.lanes[i]; return r; }
+    Float8 operator /(const Float8& v) const { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = lanes[i] / v.lanes[i]; return r; }
+
+    static Float8 min_elems(const Float8& v1, const Float8& v2) { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = std::min(v1.lanes[i], v2.lanes[i]); return r; }
+    static Float8 max_elems(const Float8& v1, const Float8& v2) { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = std::max(v1.lanes[i], v2.lanes[i]); return r; }
+
+    // Fast approximation of 1 / sqrt(v) on each lane, lanes that are not positive become 0.
+    Float8 rsqrt() const { Float8 r; for (int i = 0; i < WIDTH; ++i) r.lanes[i] = fast_rsqrt(lanes[i]); return r; }
+
+    float operator [](int index) const { return lanes[index]; }
+    float& operator [](int index) { return lanes[index]; }
+#endif
+};
+
+// Structure-of-arrays batch of 8 vectors, so that one operation is applied to 8 vectors at once.
+struct Vector3f_soa {
+    static constexpr int WIDTH = Float8::WIDTH;
+
+    Float8 x, y, z;
+
+    Vector3f_soa() = default;
+    Vector3f_soa(const Vector3f& v) : x(v.x), y(v.y), z(v.z) {}
+    Vector3f_soa(const Float8& x_val, const Float8& y_val, const Float8& z_val) : x(x_val), y(y_val), z(z_val) {}
+
+    // Gather up to *WIDTH* vectors into a batch, unused lanes are set to zero.
+    static Vector3f_soa load(const Vector3f* vs, size_t count) {
+        Vector3f_soa batch;
+        for (size_t i = 0; i < std::min(count, static_cast<size_t>(WIDTH)); ++i)
+            batch.set(static_cast<int>(i), vs[i]);
+        return batch;
+    }
+
+    Vector3f get(int lane) const { return { x[lane], y[lane], z[lane] }; }
+    void set(int lane, const Vector3f& v) { x[lane] = v.x, y[lane] = v.y, z[lane] = v.z; }
+
+    static Vector3f_soa min_elems(const Vector3f_soa& v1, const Vector3f_soa& v2) {
+        return { Float8::min_elems(v1.x, v2.x), Float8::min_elems(v1.y, v2.y), Float8::min_elems(v1.z, v2.z) };
+    }
+
+    static Vector3f_soa max_elems(const Vector3f_soa& v1, const Vector3f_soa& v2) {
+        return { Float8::max_elems(v1.x, v2.x), Float8::max_elems(v1.y, v2.y), Float8::max_elems(v1.z, v2.z) };
+    }
+
+    Vector3f_soa operator +(const Vector3f_soa& v) const { return { x + v.x, y + v.y, z + v.z }; }
+
+    Vector3f_soa operator -(const Vector3f_soa& v) const { return { x - v.x, y - v.y, z - v.z }; }
+
+    Vector3f_soa operator *(const Vector3f_soa& v) const { return { x * v.x, y * v.y, z * v.z }; }
+    Vector3f_soa operator *(const Float8& k) const { return { x * k, y * k, z * k }; }
+
+    Vector3f_soa normalized() const { return *this * magnitude_squared().rsqrt(); }
+
+    Float8 magnitude_squared() const { return dot(*this); }
+
+    Float8 dot(const Vector3f_soa& rhs) const { return x * rhs.x + y * rhs.y + z * rhs.z; }
+
+    Vector3f_soa cross(const Vector3f_soa& rhs) const { return { y * rhs.z - z * rhs.y, z * rhs.x - x * rhs.z, x * rhs.y - y * rhs.x }; }
+};
+
 struct Vector2f {
     float x, y;
 
@@ -86,15 +289,21 @@ inline Vector2f operator *(float k, const Vector2f& v) { return { v.x * k, v.y *
 
 inline std::ostream& operator <<(std::ostream& os, const Vector2f& v) { return os << v.x << ", " << v.y; }
 
+// relative luminance of a linear RGB color (Rec. 709)
+inline float luminance(const Vector3f& c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
+
 // transform direction from local to world space
 Vector3f local_to_world(const Vector3f& local_dir, const Vector3f& normal);
 
 // transform polar coordinates to cartesian coordinates
 inline Vector3f polar_to_cartesian(float theta, float phi) {
+    float sin_theta, cos_theta, sin_phi, cos_phi;
+    shading_math::sincos(theta, sin_theta, cos_theta);
+    shading_math::sincos(phi, sin_phi, cos_phi);
 	return {
-        std::sin(theta) * std::cos(phi),
-        std::sin(theta) * std::sin(phi),
-         std::cos(theta)
+        sin_theta * cos_phi,
+        sin_theta * sin_phi,
+        cos_theta
 	};
 }
 
@@ -44,4 +44,15 @@ TriangleMesh::TriangleMesh(const std::vector<std::shared_ptr<Triangle>>& triangl
             break;
         }
     }
+
+    _rest_vertices.reserve(_triangle_ptrs.size());
+    for (const auto& tri_ptr : _triangle_ptrs)
+        _rest_vertices.push_back({ tri_ptr->v0(), tri_ptr->v1(), tri_ptr->v2() });
+}
+
+void TriangleMesh::transform(const std::function<Vector3f(const Vector3f&)>& vertex_transform) {
+    for (size_t i = 0; i < _triangle_ptrs.size(); ++i) {
+        const auto& v = _rest_vertices[i];
+        _triangle_ptrs[i]->set_vertices(vertex_transform(v[0]), vertex_transform(v[1]), vertex_transform(v[2]));
+    }
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <functional>
+
 #include "OBJ_Loader.h"
 
 #include "BVH.hpp"
@@ -22,8 +25,15 @@ public:
     [[nodiscard]] std::optional<Sample> sample() override { return _bvh_tree.sample(); }
     [[nodiscard]] std::vector<std::shared_ptr<Triangle>> triangles() const { return _triangle_ptrs; }
 
+    // Place each vertex at *vertex_transform* of its position when the mesh was created, for rigid
+    // transforms and deformations alike. Call *refit* (or *Scene::update_BVH*) before rendering.
+    void transform(const std::function<Vector3f(const Vector3f&)>& vertex_transform);
+    bool refit() override { return _bvh_tree.update(); }
+    const QuantizedBVH* quantized_bvh() const override { return &_bvh_tree.quantized_bvh(); }
+
 private:
     std::vector<std::shared_ptr<Triangle>> _triangle_ptrs;
+    std::vector<std::array<Vector3f, 3>> _rest_vertices;
     BVH_tree _bvh_tree;
     bool _emitting;
 };
\ No newline at end of file
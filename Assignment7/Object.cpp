@@ -29,7 +29,7 @@ std::optional<Intersection> Sphere::intersect(const Ray& ray, Culling culling) {
     const auto r = intersection.pos - _center;
     intersection.normal = r.normalized();
     intersection.uv = {
-        std::atan(intersection.pos.y / intersection.pos.x) * 0.5f * INV_PI,
+        shading_math::atan(intersection.pos.y / intersection.pos.x) * 0.5f * INV_PI,
         std::asin(intersection.pos.z / r.magnitude()) * INV_PI + 0.5f
     };
     intersection.obj_ptr = shared_from_this();
@@ -50,11 +50,15 @@ std::optional<Sample> Sphere::sample() {
     const auto theta = 2.0f * PI * get_random_float();
     const auto phi = PI * get_random_float();
 
+    float sin_theta, cos_theta, sin_phi, cos_phi;
+    shading_math::sincos(theta, sin_theta, cos_theta);
+    shading_math::sincos(phi, sin_phi, cos_phi);
+
     Intersection intersection;
     intersection.normal = {
-        std::cos(phi),
-        std::sin(phi) * std::cos(theta),
-        std::sin(phi) * std::sin(theta)
+        cos_phi,
+        sin_phi * cos_theta,
+        sin_phi * sin_theta
     };
     intersection.pos = _center + _radius * intersection.normal;
     intersection.uv = { phi * 0.5f * INV_PI, 1.0f - theta * INV_PI };
@@ -68,13 +72,20 @@ std::optional<Sample> Sphere::sample() {
 
 Triangle::Triangle(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2,
                 std::shared_ptr<Material> material_ptr)
- : _v0(v0), _v1(v1), _v2(v2), _mat_ptr(std::move(material_ptr)) {
-    _e1 = _v1 - _v0;
-    _e2 = _v2 - _v0;
-
+ : _mat_ptr(std::move(material_ptr)) {
     // default
     _t0 = _t1 = _t2 = {0.0f, 0.0f};
 
+    set_vertices(v0, v1, v2);
+}
+
+void Triangle::set_vertices(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2) {
+    _v0 = v0;
+    _v1 = v1;
+    _v2 = v2;
+    _e1 = _v1 - _v0;
+    _e2 = _v2 - _v0;
+
     const auto n = _e1.cross(_e2);
     _normal = n.normalized();
     _area = 0.5f * n.magnitude() ;
@@ -10,6 +10,8 @@
 
 enum class Culling { NONE, BACK, FRONT };
 
+class QuantizedBVH;
+
 struct Sample {
     Intersection intersection;
     float pdf = 0.0f;
@@ -25,7 +27,13 @@ public:
 	
     [[nodiscard]] virtual std::optional<Intersection> intersect(const Ray& ray, Culling culling) = 0;
     [[nodiscard]] virtual std::optional<Sample> sample() = 0;
-    
+
+    // Update the acceleration structure inside the object after its geometry has changed,
+    // returns true if it had to be rebuilt
+    virtual bool refit() { return false; }
+
+    // BVH over the parts of the object, which interleaved traversal descends into, if there is one
+    virtual const QuantizedBVH* quantized_bvh() const { return nullptr; }
 };
 
 // Deal with polymorphism
@@ -50,6 +58,7 @@ public:
     [[nodiscard]] std::optional<Sample> sample() override;
 
     Vector3f center() const { return _center; }
+    void set_center(const Vector3f& center) { _center = center; }
     float radius() const { return _radius; }
     float radius_sq() const { return _radius_sq; }
 
@@ -72,6 +81,12 @@ public:
     [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray, Culling culling) override;
     [[nodiscard]] std::optional<Sample> sample() override;
 
+    Vector3f v0() const { return _v0; }
+    Vector3f v1() const { return _v1; }
+    Vector3f v2() const { return _v2; }
+    // Move the vertices, the bounds of the BVHs containing the triangle have to be refitted afterwards
+    void set_vertices(const Vector3f& v0, const Vector3f& v1, const Vector3f& v2);
+
 private:
     Vector3f _v0, _v1, _v2; // vertices in counter-clockwise order
     Vector3f _e1, _e2;      // 2 edges v1-v0, v2-v0;
@@ -0,0 +1,374 @@
+#include "OutOfCoreMesh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace {
+    constexpr char PAGE_FILE_MAGIC[4] = { 'R', 'T', 'P', 'G' };
+    constexpr uint32_t PAGE_FILE_VERSION = 1;
+
+    struct PageFileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t cluster_count;
+        uint32_t padding;
+        uint64_t triangle_count;
+        uint64_t cluster_table_offset;
+    };
+    static_assert(sizeof(PageFileHeader) == 32, "unexpected padding in the page file header");
+
+    struct ClusterRecord {
+        uint64_t offset;
+        uint32_t triangle_count;
+        float area;
+        float p_min[3];
+        float p_max[3];
+    };
+    static_assert(sizeof(ClusterRecord) == 40, "unexpected padding in the cluster table");
+
+    using TriangleRecord = std::array<float, 9>;
+
+    // size of the control block of a shared_ptr and of the allocation overhead of a node, roughly
+    constexpr size_t ALLOCATION_OVERHEAD = 16;
+
+    // Spread the lower 10 bits of *v* to every third bit
+    uint32_t expand_bits(uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // 30-bit Morton code of the point *ratio* in the unit cube
+    uint32_t morton_code(const Vector3f& ratio) {
+        const auto quantize = [](float x) { return static_cast<uint32_t>(std::clamp(x * 1024.0f, 0.0f, 1023.0f)); };
+        return (expand_bits(quantize(ratio.x)) << 2) | (expand_bits(quantize(ratio.y)) << 1) | expand_bits(quantize(ratio.z));
+    }
+
+    Vector3f triangle_centroid(const TriangleRecord& tri) {
+        return { (tri[0] + tri[3] + tri[6]) / 3.0f, (tri[1] + tri[4] + tri[7]) / 3.0f, (tri[2] + tri[5] + tri[8]) / 3.0f };
+    }
+
+    // Index into *positions* of the vertex reference *token* ("v", "v/vt", "v//vn" or "v/vt/vn") of a face
+    size_t parse_vertex_index(const char* token, size_t position_count, const std::string& model_file_name) {
+        char* end;
+        const auto idx = std::strtol(token, &end, 10);
+        // OBJ indices start at 1, negative ones count back from the last vertex
+        const auto resolved = idx > 0 ? idx - 1 : static_cast<long>(position_count) + idx;
+        if (end == token || idx == 0 || resolved < 0 || static_cast<size_t>(resolved) >= position_count)
+            throw std::runtime_error("invalid face in model " + model_file_name);
+        return static_cast<size_t>(resolved);
+    }
+}
+
+void build_page_file(const std::string& model_file_name, const std::string& page_file_name, unsigned int cluster_triangle_count) {
+    if (cluster_triangle_count == 0)
+        throw std::runtime_error("clusters must hold at least one triangle");
+
+    std::ifstream model_file(model_file_name);
+    if (!model_file)
+        throw std::runtime_error("cannot open model " + model_file_name);
+
+    // pass 1: triangulate the faces into a temporary file in file order
+    const auto face_file_name = page_file_name + ".faces";
+    std::ofstream face_file(face_file_name, std::ios::binary | std::ios::trunc);
+    if (!face_file)
+        throw std::runtime_error("cannot create " + face_file_name);
+
+    std::vector<std::array<float, 3>> positions;
+    BoundingBox centroid_bound;
+    uint64_t triangle_count = 0;
+    std::string line;
+    std::vector<size_t> face_indices;
+    while (std::getline(model_file, line)) {
+        if (line.size() < 2 || line[1] != ' ')
+            continue;
+
+        if (line[0] == 'v') {
+            std::array<float, 3> position{};
+            const char* cursor = line.c_str() + 2;
+            for (auto& coord : position) {
+                char* end;
+                coord = std::strtof(cursor, &end);
+                cursor = end;
+            }
+            positions.push_back(position);
+        } else if (line[0] == 'f') {
+            face_indices.clear();
+            const char* cursor = line.c_str() + 2;
+            while (true) {
+                cursor += std::strspn(cursor, " \t\r");
+                if (*cursor == '\0')
+                    break;
+                face_indices.push_back(parse_vertex_index(cursor, positions.size(), model_file_name));
+                cursor += std::strcspn(cursor, " \t\r");
+            }
+
+            // fan triangulation of polygons
+            for (size_t k = 2; k < face_indices.size(); ++k) {
+                TriangleRecord tri;
+                const std::array<size_t, 3> corner_indices = { face_indices[0], face_indices[k - 1], face_indices[k] };
+                for (size_t j = 0; j < 3; ++j)
+                    std::copy(positions[corner_indices[j]].begin(), positions[corner_indices[j]].end(), tri.begin() + 3 * j);
+                face_file.write(reinterpret_cast<const char*>(tri.data()), sizeof(TriangleRecord));
+                centroid_bound = union_box(centroid_bound, triangle_centroid(tri));
+                ++triangle_count;
+            }
+        }
+    }
+    positions = {};
+    face_file.close();
+    if (!face_file)
+        throw std::runtime_error("cannot write " + face_file_name);
+    // the lower half of a sort key is the index of the triangle
+    if (triangle_count > 0xFFFFFFFFu)
+        throw std::runtime_error("too many triangles in model " + model_file_name);
+
+    // pass 2: sort the triangles along a Morton curve of their centroids, runs of it are spatially coherent
+    std::ifstream face_input(face_file_name, std::ios::binary);
+    std::vector<uint64_t> keys(triangle_count);
+    for (uint64_t i = 0; i < triangle_count; ++i) {
+        TriangleRecord tri;
+        face_input.read(reinterpret_cast<char*>(tri.data()), sizeof(TriangleRecord));
+        keys[i] = (static_cast<uint64_t>(morton_code(centroid_bound.offset_ratio(triangle_centroid(tri)))) << 32) | i;
+    }
+    if (!face_input)
+        throw std::runtime_error("cannot read " + face_file_name);
+    std::sort(keys.begin(), keys.end());
+
+    // pass 3: gather the clusters into the page file
+    std::ofstream page_file(page_file_name, std::ios::binary | std::ios::trunc);
+    if (!page_file)
+        throw std::runtime_error("cannot create page file " + page_file_name);
+
+    PageFileHeader header{};
+    std::memcpy(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic));
+    header.version = PAGE_FILE_VERSION;
+    header.triangle_count = triangle_count;
+    page_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<ClusterRecord> cluster_records;
+    std::vector<uint64_t> cluster_triangle_indices;
+    for (uint64_t start = 0; start < triangle_count; start += cluster_triangle_count) {
+        const auto end = std::min(triangle_count, start + cluster_triangle_count);
+
+        // read the triangles of the cluster in file order
+        cluster_triangle_indices.clear();
+        for (auto i = start; i < end; ++i)
+            cluster_triangle_indices.push_back(keys[i] & 0xFFFFFFFFu);
+        std::sort(cluster_triangle_indices.begin(), cluster_triangle_indices.end());
+
+        ClusterRecord record{};
+        record.offset = static_cast<uint64_t>(page_file.tellp());
+        record.triangle_count = static_cast<uint32_t>(end - start);
+        BoundingBox bound;
+        for (const auto idx : cluster_triangle_indices) {
+            TriangleRecord tri;
+            face_input.seekg(static_cast<std::streamoff>(idx * sizeof(TriangleRecord)));
+            face_input.read(reinterpret_cast<char*>(tri.data()), sizeof(TriangleRecord));
+            page_file.write(reinterpret_cast<const char*>(tri.data()), sizeof(TriangleRecord));
+
+            const Vector3f v0(tri[0], tri[1], tri[2]), v1(tri[3], tri[4], tri[5]), v2(tri[6], tri[7], tri[8]);
+            bound = union_box(union_box(bound, v0), union_box(BoundingBox(v1), v2));
+            record.area += 0.5f * (v1 - v0).cross(v2 - v0).magnitude();
+        }
+        if (!face_input)
+            throw std::runtime_error("cannot read " + face_file_name);
+
+        for (int dim = 0; dim < 3; ++dim) {
+            record.p_min[dim] = bound.p_min[dim];
+            record.p_max[dim] = bound.p_max[dim];
+        }
+        cluster_records.push_back(record);
+    }
+    face_input.close();
+    std::remove(face_file_name.c_str());
+
+    header.cluster_count = static_cast<uint32_t>(cluster_records.size());
+    header.cluster_table_offset = static_cast<uint64_t>(page_file.tellp());
+    page_file.write(reinterpret_cast<const char*>(cluster_records.data()), static_cast<std::streamsize>(cluster_records.size() * sizeof(ClusterRecord)));
+    page_file.seekp(0);
+    page_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!page_file)
+        throw std::runtime_error("cannot write page file " + page_file_name);
+}
+
+ClusterGeometry::ClusterGeometry(std::vector<std::shared_ptr<Triangle>>&& triangles)
+    : triangle_ptrs(std::move(triangles)),
+      bvh_tree(transform_to_object_vector<Triangle>(triangle_ptrs), BVH_tree::SplitMethod::NAIVE, false) {
+    // triangles and their shared pointers, the pointer tree with one leaf per triangle and the quantized copy
+    const auto triangle_count = triangle_ptrs.size();
+    byte_size = sizeof(ClusterGeometry)
+              + triangle_count * (sizeof(Triangle) + sizeof(std::shared_ptr<Triangle>) + ALLOCATION_OVERHEAD)
+              + 2 * triangle_count * (sizeof(BVH_node) + ALLOCATION_OVERHEAD)
+              + bvh_tree.quantized_bvh().node_count() * QuantizedBVH::bytes_per_node() + triangle_count * sizeof(Object*);
+}
+
+std::shared_ptr<const ClusterGeometry> GeometryCluster::load() const {
+    std::ifstream page_file(_page_file_name, std::ios::binary);
+    if (!page_file)
+        throw std::runtime_error("cannot open page file " + _page_file_name);
+
+    std::vector<TriangleRecord> records(_triangle_count);
+    page_file.seekg(static_cast<std::streamoff>(_offset));
+    page_file.read(reinterpret_cast<char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(TriangleRecord)));
+    if (!page_file)
+        throw std::runtime_error("truncated page file " + _page_file_name);
+
+    std::vector<std::shared_ptr<Triangle>> triangle_ptrs;
+    triangle_ptrs.reserve(records.size());
+    for (const auto& tri : records) {
+        triangle_ptrs.push_back(std::make_shared<Triangle>(Vector3f(tri[0], tri[1], tri[2]),
+                                                           Vector3f(tri[3], tri[4], tri[5]),
+                                                           Vector3f(tri[6], tri[7], tri[8]), _mat_ptr));
+    }
+    return std::make_shared<ClusterGeometry>(std::move(triangle_ptrs));
+}
+
+std::atomic<uint64_t> GeometryCache::_instance_count = 0;
+
+std::shared_ptr<const ClusterGeometry> GeometryCache::acquire(const GeometryCluster& cluster) {
+    struct ThreadSlot {
+        uint64_t cache_id = 0;
+        const GeometryCluster* cluster_ptr = nullptr;
+        std::shared_ptr<const ClusterGeometry> geometry_ptr;
+        std::shared_ptr<LastUse> last_use;
+    };
+    thread_local std::array<ThreadSlot, THREAD_CLUSTER_COUNT> slots;
+    thread_local size_t next_slot = 0;
+
+    // clusters this thread acquired lately, unless evicted meanwhile
+    const auto tick = _tick.load(std::memory_order_relaxed);
+    for (auto& slot : slots) {
+        if (slot.cache_id != _id || slot.cluster_ptr != &cluster)
+            continue;
+
+        // only written when the tick has advanced, so the threads sharing a cluster rarely write its stamp
+        auto last_use = slot.last_use->load(std::memory_order_relaxed);
+        while (last_use != EVICTED && last_use < tick
+               && !slot.last_use->compare_exchange_weak(last_use, tick, std::memory_order_relaxed)) { }
+        if (last_use == EVICTED) {
+            slot = ThreadSlot();
+            break;
+        }
+        _hit_count.fetch_add(1, std::memory_order_relaxed);
+        return slot.geometry_ptr;
+    }
+
+    std::shared_ptr<LastUse> last_use;
+    auto geometry_ptr = acquire_shared(cluster, last_use);
+    slots[next_slot] = { _id, &cluster, geometry_ptr, std::move(last_use) };
+    next_slot = (next_slot + 1) % THREAD_CLUSTER_COUNT;
+    return geometry_ptr;
+}
+
+std::shared_ptr<const ClusterGeometry> GeometryCache::acquire_shared(const GeometryCluster& cluster, std::shared_ptr<LastUse>& last_use) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto tick = _tick.fetch_add(1, std::memory_order_relaxed) + 1;
+    const auto it = _entries.find(&cluster);
+    if (it != _entries.end()) {
+        it->second.last_use->store(tick, std::memory_order_relaxed);
+        last_use = it->second.last_use;
+        const auto geometry = it->second.geometry;
+        lock.unlock();
+        ++_hit_count;
+        // waits if another thread is still loading the cluster
+        return geometry.get();
+    }
+
+    // load outside the lock, the threads which want the cluster meanwhile wait for the future
+    ++_miss_count;
+    std::promise<std::shared_ptr<const ClusterGeometry>> promise;
+    auto& entry = _entries[&cluster];
+    entry.geometry = promise.get_future().share();
+    entry.last_use = std::make_shared<LastUse>(tick);
+    last_use = entry.last_use;
+    lock.unlock();
+
+    std::shared_ptr<const ClusterGeometry> geometry_ptr;
+    try {
+        geometry_ptr = cluster.load();
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+        lock.lock();
+        _entries.erase(&cluster);
+        throw;
+    }
+    promise.set_value(geometry_ptr);
+
+    // entries which are loading are never evicted
+    lock.lock();
+    auto& loaded_entry = _entries.at(&cluster);
+    loaded_entry.byte_size = std::max<size_t>(1, geometry_ptr->byte_size);
+    _resident_bytes += loaded_entry.byte_size;
+    evict(&cluster);
+    return geometry_ptr;
+}
+
+size_t GeometryCache::resident_bytes() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _resident_bytes;
+}
+
+void GeometryCache::evict(const GeometryCluster* kept_cluster_ptr) {
+    if (_resident_bytes <= _budget_bytes)
+        return;
+
+    // loaded clusters, least recently used first
+    std::vector<std::pair<uint64_t, const GeometryCluster*>> candidates;
+    for (const auto& [cluster_ptr, entry] : _entries) {
+        if (cluster_ptr != kept_cluster_ptr && entry.byte_size > 0)
+            candidates.emplace_back(entry.last_use->load(std::memory_order_relaxed), cluster_ptr);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto& [last_use, cluster_ptr] : candidates) {
+        if (_resident_bytes <= _budget_bytes)
+            break;
+        const auto entry_it = _entries.find(cluster_ptr);
+        entry_it->second.last_use->store(EVICTED, std::memory_order_relaxed);
+        _resident_bytes -= entry_it->second.byte_size;
+        _entries.erase(entry_it);
+        ++_eviction_count;
+    }
+}
+
+OutOfCoreMesh::OutOfCoreMesh(const std::string& page_file_name, std::shared_ptr<Material> mat_ptr, GeometryCache& cache)
+    : _page_file_name(page_file_name),
+      _mat_ptr(std::move(mat_ptr)),
+      _cluster_ptrs(read_cluster_table(_page_file_name, _mat_ptr, cache, _triangle_count)),
+      _bvh_tree(transform_to_object_vector<GeometryCluster>(_cluster_ptrs), BVH_tree::SplitMethod::NAIVE) { }
+
+std::vector<std::shared_ptr<GeometryCluster>> OutOfCoreMesh::read_cluster_table(const std::string& page_file_name,
+        const std::shared_ptr<Material>& mat_ptr, GeometryCache& cache, uint64_t& triangle_count) {
+    std::ifstream page_file(page_file_name, std::ios::binary);
+    if (!page_file)
+        throw std::runtime_error("cannot open page file " + page_file_name);
+
+    PageFileHeader header{};
+    page_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!page_file || std::memcmp(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != PAGE_FILE_VERSION)
+        throw std::runtime_error("invalid page file " + page_file_name);
+
+    std::vector<ClusterRecord> cluster_records(header.cluster_count);
+    page_file.seekg(static_cast<std::streamoff>(header.cluster_table_offset));
+    page_file.read(reinterpret_cast<char*>(cluster_records.data()), static_cast<std::streamsize>(cluster_records.size() * sizeof(ClusterRecord)));
+    if (!page_file)
+        throw std::runtime_error("truncated page file " + page_file_name);
+
+    triangle_count = header.triangle_count;
+    std::vector<std::shared_ptr<GeometryCluster>> cluster_ptrs;
+    cluster_ptrs.reserve(cluster_records.size());
+    for (const auto& record : cluster_records) {
+        const BoundingBox bound(Vector3f(record.p_min[0], record.p_min[1], record.p_min[2]),
+                                Vector3f(record.p_max[0], record.p_max[1], record.p_max[2]));
+        cluster_ptrs.push_back(std::make_shared<GeometryCluster>(page_file_name, record.offset, record.triangle_count,
+                                                                 bound, record.area, mat_ptr, cache));
+    }
+    return cluster_ptrs;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "BVH.hpp"
+#include "Material.hpp"
+#include "Object.hpp"
+
+// Out-of-core meshes for models which do not fit in memory.
+//
+// *build_page_file* streams a model into a page file of spatially coherent clusters of triangles.
+// An *OutOfCoreMesh* keeps only the table of the clusters and a BVH over their bounds in memory. The triangles
+// and the BVH of a cluster are loaded when a ray reaches its bounds and are kept in a *GeometryCache*, which
+// drops the least recently used clusters to stay within its memory budget.
+//
+// Page file: header { char magic[4] = "RTPG", uint32 version, uint32 cluster count, uint32 padding,
+//                     uint64 triangle count, uint64 offset of the cluster table },
+//            the triangles of all clusters as 9 floats each (3 vertices), then the cluster table of
+//            { uint64 offset, uint32 triangle count, float area, p_min[3], p_max[3] }
+//            in the byte order of the host.
+
+// Partition the triangles of the OBJ model *model_file_name* into clusters of *cluster_triangle_count*
+// triangles along a Morton curve and write them to *page_file_name*. The faces are streamed through a temporary
+// file next to the page file, only the vertex positions and 8 bytes per triangle are kept in memory.
+void build_page_file(const std::string& model_file_name, const std::string& page_file_name,
+                     unsigned int cluster_triangle_count = 1024);
+
+// Triangles of a cluster with their BVH, as loaded into the cache
+struct ClusterGeometry {
+    explicit ClusterGeometry(std::vector<std::shared_ptr<Triangle>>&& triangles);
+
+    std::vector<std::shared_ptr<Triangle>> triangle_ptrs;
+    BVH_tree bvh_tree;
+    size_t byte_size = 0;       // approximate memory taken by the triangles and the BVH
+};
+
+class GeometryCluster;
+
+// LRU cache of the geometry of clusters, shared by all out-of-core meshes. Thread safe.
+//
+// Each thread remembers the last few clusters it acquired, so the rays of a thread which keep reaching
+// the same clusters take no lock. Their recency is only stamped with the current tick of the cache,
+// which advances on the lookups that take the lock, and the least recently used clusters are found
+// by sorting the stamps when the cache is over budget.
+class GeometryCache {
+public:
+    explicit GeometryCache(size_t budget_bytes) : _budget_bytes(budget_bytes), _id(++_instance_count) {}
+
+    // Geometry of *cluster*, loaded from its page file unless it is resident. Clusters which are dropped
+    // from the cache stay alive until the last reference returned for them is released, including the
+    // references the threads remember, so up to THREAD_CLUSTER_COUNT clusters per thread may exceed the budget.
+    [[nodiscard]] std::shared_ptr<const ClusterGeometry> acquire(const GeometryCluster& cluster);
+
+    size_t budget_bytes() const { return _budget_bytes; }
+    size_t resident_bytes();
+    size_t hit_count() const { return _hit_count; }
+    size_t miss_count() const { return _miss_count; }
+    size_t eviction_count() const { return _eviction_count; }
+
+    // Number of clusters each thread remembers
+    static constexpr size_t THREAD_CLUSTER_COUNT = 4;
+
+private:
+    // Tick of the last use of a cluster, shared with the threads which remember it. EVICTED once dropped.
+    using LastUse = std::atomic<uint64_t>;
+    static constexpr uint64_t EVICTED = ~uint64_t(0);
+
+    struct Entry {
+        std::shared_future<std::shared_ptr<const ClusterGeometry>> geometry;
+        std::shared_ptr<LastUse> last_use;
+        size_t byte_size = 0;       // 0 while loading
+    };
+
+    // Look *cluster* up with *_mutex*, loading it on a miss
+    [[nodiscard]] std::shared_ptr<const ClusterGeometry> acquire_shared(const GeometryCluster& cluster, std::shared_ptr<LastUse>& last_use);
+    // Drop the least recently used loaded clusters but *kept_cluster_ptr* until the budget is met, with *_mutex* held
+    void evict(const GeometryCluster* kept_cluster_ptr);
+
+private:
+    size_t _budget_bytes;
+    uint64_t _id;       // tells the caches apart in the per-thread slots, which outlive them
+    static std::atomic<uint64_t> _instance_count;
+
+    std::mutex _mutex;
+    std::unordered_map<const GeometryCluster*, Entry> _entries;
+    std::atomic<uint64_t> _tick = 0;
+    size_t _resident_bytes = 0;
+
+    std::atomic<size_t> _hit_count = 0;
+    std::atomic<size_t> _miss_count = 0;
+    std::atomic<size_t> _eviction_count = 0;
+};
+
+// Leaf of the resident BVH of an *OutOfCoreMesh*, standing for the triangles of a cluster in the page file
+class GeometryCluster : public Object {
+public:
+    GeometryCluster(const std::string& page_file_name, uint64_t offset, uint32_t triangle_count,
+                    const BoundingBox& bound, float area, std::shared_ptr<Material> mat_ptr, GeometryCache& cache)
+        : _page_file_name(page_file_name), _offset(offset), _triangle_count(triangle_count),
+          _bound(bound), _area(area), _mat_ptr(std::move(mat_ptr)), _cache(cache) {}
+
+    float area() const override { return _area; }
+    BoundingBox bound() const override { return _bound; }
+    bool emitting() const override { return _mat_ptr->emitting(); }
+
+    [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray, Culling culling) override {
+        return _cache.acquire(*this)->bvh_tree.intersect(ray, culling);
+    }
+    [[nodiscard]] std::optional<Sample> sample() override { return _cache.acquire(*this)->bvh_tree.sample(); }
+
+    // Read the triangles of the cluster from the page file and build their BVH
+    [[nodiscard]] std::shared_ptr<const ClusterGeometry> load() const;
+
+private:
+    std::string _page_file_name;
+    uint64_t _offset;
+    uint32_t _triangle_count;
+    BoundingBox _bound;
+    float _area;
+    std::shared_ptr<Material> _mat_ptr;
+    GeometryCache& _cache;
+};
+
+class OutOfCoreMesh : public Object {
+public:
+    // Read the cluster table of *page_file_name* and build the BVH over the clusters, which are loaded
+    // into *cache* on demand. The cache must outlive the mesh.
+    OutOfCoreMesh(const std::string& page_file_name, std::shared_ptr<Material> mat_ptr, GeometryCache& cache);
+
+    float area() const override { return _bvh_tree.area(); }
+    BoundingBox bound() const override { return _bvh_tree.bound(); }
+    bool emitting() const override { return _mat_ptr->emitting(); }
+
+    [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray, Culling culling) override { return _bvh_tree.intersect(ray, culling); }
+    [[nodiscard]] std::optional<Sample> sample() override { return _bvh_tree.sample(); }
+    const QuantizedBVH* quantized_bvh() const override { return &_bvh_tree.quantized_bvh(); }
+
+    size_t cluster_count() const { return _cluster_ptrs.size(); }
+    uint64_t triangle_count() const { return _triangle_count; }
+
+private:
+    [[nodiscard]] static std::vector<std::shared_ptr<GeometryCluster>> read_cluster_table(const std::string& page_file_name,
+        const std::shared_ptr<Material>& mat_ptr, GeometryCache& cache, uint64_t& triangle_count);
+
+private:
+    std::string _page_file_name;
+    std::shared_ptr<Material> _mat_ptr;
+    uint64_t _triangle_count = 0;
+    std::vector<std::shared_ptr<GeometryCluster>> _cluster_ptrs;
+    BVH_tree _bvh_tree;
+};
@@ -0,0 +1,247 @@
+#include "PathGuiding.hpp"
+
+#include <algorithm>
+
+namespace {
+    constexpr float INV_FOUR_PI = 0.25f * INV_PI;
+
+    void atomic_add(std::atomic<float>& dst, float value) {
+        auto current = dst.load(std::memory_order_relaxed);
+        while (!dst.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) { }
+    }
+}
+
+DTree::Node::Node() : children{ 0, 0, 0, 0 } {
+    for (auto& sum : sums)
+        sum.store(0.0f, std::memory_order_relaxed);
+}
+
+DTree::Node::Node(const Node& rhs) : children(rhs.children) {
+    for (int i = 0; i < 4; ++i)
+        sums[i].store(rhs.sums[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+DTree::Node& DTree::Node::operator =(const Node& rhs) {
+    children = rhs.children;
+    for (int i = 0; i < 4; ++i)
+        sums[i].store(rhs.sums[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+DTree::DTree() : _nodes(1) { }
+
+DTree::DTree(const DTree& rhs) : _nodes(rhs._nodes) { }
+
+DTree& DTree::operator =(const DTree& rhs) {
+    if (this != &rhs)
+        _nodes = rhs._nodes;
+    return *this;
+}
+
+int DTree::descend(Vector2f& p) {
+    const auto x = p.x >= 0.5f ? 1 : 0;
+    const auto y = p.y >= 0.5f ? 1 : 0;
+    p.x = clamp(0.0f, 1.0f, 2.0f * p.x - static_cast<float>(x));
+    p.y = clamp(0.0f, 1.0f, 2.0f * p.y - static_cast<float>(y));
+    return x + 2 * y;
+}
+
+void DTree::record(Vector2f p, float value) {
+    uint32_t node_idx = 0;
+    for (;;) {
+        auto& node = _nodes[node_idx];
+        const auto quadrant = descend(p);
+        atomic_add(node.sums[quadrant], value);
+        if (node.is_leaf(quadrant))
+            return;
+        node_idx = node.children[quadrant];
+    }
+}
+
+float DTree::pdf(Vector2f p) const {
+    auto pdf = 1.0f;
+    uint32_t node_idx = 0;
+    for (;;) {
+        const auto& node = _nodes[node_idx];
+        const auto total = node.total();
+        if (total <= 0.0f)
+            return pdf;     // nothing recorded below, uniform
+
+        const auto quadrant = descend(p);
+        const auto sum = node.sums[quadrant].load(std::memory_order_relaxed);
+        if (sum <= 0.0f)
+            return 0.0f;
+
+        // each quadrant covers 1 / 4 of the area of its node
+        pdf *= 4.0f * sum / total;
+        if (node.is_leaf(quadrant))
+            return pdf;
+        node_idx = node.children[quadrant];
+    }
+}
+
+Vector2f DTree::sample() const {
+    Vector2f origin(0.0f);
+    auto size = 1.0f;
+    uint32_t node_idx = 0;
+    for (;;) {
+        const auto& node = _nodes[node_idx];
+        const auto total = node.total();
+        if (total <= 0.0f)
+            break;
+
+        // choose a quadrant proportional to its flux
+        auto threshold = get_random_float() * total;
+        int quadrant = 0;
+        while (quadrant < 3 && threshold >= node.sums[quadrant].load(std::memory_order_relaxed)) {
+            threshold -= node.sums[quadrant].load(std::memory_order_relaxed);
+            ++quadrant;
+        }
+
+        size *= 0.5f;
+        origin = origin + Vector2f(static_cast<float>(quadrant & 1), static_cast<float>(quadrant >> 1)) * size;
+        if (node.is_leaf(quadrant))
+            break;
+        node_idx = node.children[quadrant];
+    }
+
+    // uniform inside the chosen leaf quadrant
+    return origin + Vector2f(get_random_float(), get_random_float()) * size;
+}
+
+float DTree::flux() const {
+    return _nodes[0].total();
+}
+
+void DTree::refine(const DTree& stats, float subdivision_threshold) {
+    _nodes.assign(1, Node());
+
+    const auto total_flux = stats.flux();
+    if (total_flux > 0.0f)
+        refine(stats, 0, 0, 1.0f, total_flux, subdivision_threshold, 1);
+}
+
+void DTree::refine(const DTree& stats, int stats_node_idx, uint32_t node_idx, float node_flux_ratio,
+                   float total_flux, float subdivision_threshold, unsigned int depth) {
+    if (depth >= MAX_DEPTH)
+        return;
+
+    for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        // the flux below a leaf of *stats* is assumed to be uniform
+        const auto flux_ratio = stats_node_idx >= 0 ?
+            stats._nodes[stats_node_idx].sums[quadrant].load(std::memory_order_relaxed) / total_flux : 0.25f * node_flux_ratio;
+        if (flux_ratio <= subdivision_threshold)
+            continue;
+
+        const auto child_idx = static_cast<uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+        _nodes[node_idx].children[quadrant] = child_idx;
+
+        const auto child_stats_node_idx = (stats_node_idx >= 0 && !stats._nodes[stats_node_idx].is_leaf(quadrant)) ?
+            static_cast<int>(stats._nodes[stats_node_idx].children[quadrant]) : -1;
+        refine(stats, child_stats_node_idx, child_idx, flux_ratio, total_flux, subdivision_threshold, depth + 1);
+    }
+}
+
+Vector2f DTree::dir_to_square(const Vector3f& dir) {
+    const auto cos_theta = clamp(-1.0f, 1.0f, dir.z);
+    auto phi = shading_math::atan2(dir.y, dir.x);     // [-pi, pi]
+    if (phi < 0.0f)
+        phi += 2.0f * PI;
+    return { clamp(0.0f, 1.0f, 0.5f * (cos_theta + 1.0f)), clamp(0.0f, 1.0f, 0.5f * INV_PI * phi) };
+}
+
+Vector3f DTree::square_to_dir(const Vector2f& p) {
+    const auto cos_theta = 2.0f * p.x - 1.0f;
+    const auto sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    float sin_phi, cos_phi;
+    shading_math::sincos(2.0f * PI * p.y, sin_phi, cos_phi);
+    return { sin_theta * cos_phi, sin_theta * sin_phi, cos_theta };
+}
+
+
+
+void DTreeWrapper::record(const Vector3f& dir, float radiance, float pdf) {
+    if (pdf <= 0.0f || !(radiance > 0.0f) || !std::isfinite(radiance / pdf))
+        return;
+    _building.record(DTree::dir_to_square(dir), radiance / pdf);
+}
+
+Vector3f DTreeWrapper::sample() const {
+    return DTree::square_to_dir(_sampling.sample());
+}
+
+float DTreeWrapper::pdf(const Vector3f& dir) const {
+    // the mapping from the square to the sphere scales area by 4 * pi
+    return _sampling.pdf(DTree::dir_to_square(dir)) * INV_FOUR_PI;
+}
+
+void DTreeWrapper::refine(float subdivision_threshold) {
+    _sampling = _building;
+    _building.refine(_sampling, subdivision_threshold);
+}
+
+
+
+SDTree::SDTree(const BoundingBox& scene_bound) {
+    // use a cube so that the cells stay close to cubes while splitting the axes in turn
+    const auto center = scene_bound.centroid();
+    const auto d = scene_bound.diagonal();
+    const auto half_extent = 0.5f * std::max(d.x, std::max(d.y, d.z)) + EPSILON;
+    _bound = BoundingBox(center - Vector3f(half_extent), center + Vector3f(half_extent));
+
+    _nodes.emplace_back();
+    _nodes[0].dtree_ptr = std::make_unique<DTreeWrapper>();
+}
+
+DTreeWrapper& SDTree::dtree(const Vector3f& pos) {
+    auto p = _bound.offset_ratio(pos);
+    uint32_t node_idx = 0;
+    while (!_nodes[node_idx].is_leaf()) {
+        const auto axis = _nodes[node_idx].axis;
+        const auto child = p[axis] < 0.5f ? 0 : 1;
+        p[axis] = 2.0f * p[axis] - static_cast<float>(child);
+        node_idx = _nodes[node_idx].children[child];
+    }
+    return *_nodes[node_idx].dtree_ptr;
+}
+
+void SDTree::refine(unsigned int spatial_threshold, float directional_threshold) {
+    // split leaves recursively, each child inherits half of the samples of its parent
+    for (size_t node_idx = 0; node_idx < _nodes.size(); ++node_idx) {
+        if (!_nodes[node_idx].is_leaf() || _nodes[node_idx].dtree_ptr->sample_count() <= spatial_threshold)
+            continue;
+
+        const auto child_sample_count = _nodes[node_idx].dtree_ptr->sample_count() / 2;
+        for (int child = 0; child < 2; ++child) {
+            Node child_node;
+            child_node.axis = (_nodes[node_idx].axis + 1) % 3;
+            child_node.dtree_ptr = std::make_unique<DTreeWrapper>(*_nodes[node_idx].dtree_ptr);
+            child_node.dtree_ptr->set_sample_count(child_sample_count);
+
+            _nodes[node_idx].children[child] = static_cast<uint32_t>(_nodes.size());
+            _nodes.push_back(std::move(child_node));
+        }
+        _nodes[node_idx].dtree_ptr.reset();
+    }
+
+    for (auto& node : _nodes) {
+        if (node.is_leaf()) {
+            node.dtree_ptr->refine(directional_threshold);
+            node.dtree_ptr->set_sample_count(0);
+        }
+    }
+}
+
+size_t SDTree::leaf_count() const {
+    return static_cast<size_t>(std::count_if(_nodes.begin(), _nodes.end(), [](const Node& node) { return node.is_leaf(); }));
+}
+
+size_t SDTree::dtree_node_count() const {
+    size_t count = 0;
+    for (const auto& node : _nodes) {
+        if (node.is_leaf())
+            count += node.dtree_ptr->node_count();
+    }
+    return count;
+}
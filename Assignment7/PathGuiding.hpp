@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Math.hpp"
+#include "BoundingBox.hpp"
+
+// Online-learned distribution of incident radiance for path guiding,
+// based on "Practical Path Guiding for Efficient Light-Transport Simulation" (Müller et al. 2017).
+//
+// The scene bounds are partitioned by a binary spatial tree (S-tree), each leaf of which owns a
+// directional quadtree (D-tree) over the sphere of directions. During a training pass the incident
+// radiance estimates of the paths are recorded in the *building* D-trees while the *sampling* D-trees,
+// learned in the previous pass, are used to sample directions. Between passes the trees are refined.
+
+// Quadtree over the square [0, 1]^2, which is mapped to the unit sphere with cylindrical coordinates
+// (cos(theta) and phi are both linear in the square, so that the mapping preserves area up to 4 * pi).
+// Each node stores the flux of incident radiance recorded in its four quadrants.
+class DTree {
+public:
+    DTree();
+    DTree(const DTree& rhs);
+    DTree& operator =(const DTree& rhs);
+
+    // Add *value* (radiance / pdf of the recorded direction) to all quadrants containing *p*. Thread-safe.
+    void record(Vector2f p, float value);
+
+    // PDF over the square of sampling *p* with *sample*
+    [[nodiscard]] float pdf(Vector2f p) const;
+
+    // Sample a point of the square proportional to the recorded flux
+    [[nodiscard]] Vector2f sample() const;
+
+    // Total recorded flux
+    [[nodiscard]] float flux() const;
+
+    [[nodiscard]] size_t node_count() const { return _nodes.size(); }
+
+    // Rebuild the structure from the flux recorded in *stats*: quadrants holding more than
+    // *subdivision_threshold* of the total flux are subdivided, the others are collapsed.
+    // All recorded flux is cleared.
+    void refine(const DTree& stats, float subdivision_threshold);
+
+    // Map between unit directions and the square
+    static Vector2f dir_to_square(const Vector3f& dir);
+    static Vector3f square_to_dir(const Vector2f& p);
+
+private:
+    struct Node {
+        std::array<std::atomic<float>, 4> sums;
+        std::array<uint32_t, 4> children;     // 0 for leaf quadrants
+
+        Node();
+        Node(const Node& rhs);
+        Node& operator =(const Node& rhs);
+
+        float total() const { return sums[0].load(std::memory_order_relaxed) + sums[1].load(std::memory_order_relaxed)
+                                   + sums[2].load(std::memory_order_relaxed) + sums[3].load(std::memory_order_relaxed); }
+        bool is_leaf(int quadrant) const { return children[quadrant] == 0; }
+    };
+
+    // quadrant of the node containing *p*, then transform *p* into the local space of the quadrant
+    static int descend(Vector2f& p);
+
+    void refine(const DTree& stats, int stats_node_idx, uint32_t node_idx, float node_flux_ratio,
+                float total_flux, float subdivision_threshold, unsigned int depth);
+
+private:
+    static constexpr unsigned int MAX_DEPTH = 20;
+
+    std::vector<Node> _nodes;
+};
+
+// The pair of D-trees in one leaf of the S-tree.
+class DTreeWrapper {
+public:
+    // Record the incident radiance estimate *radiance* from direction *dir* sampled with *pdf*. Thread-safe.
+    void record(const Vector3f& dir, float radiance, float pdf);
+    // Count a path vertex in this leaf, used to decide the spatial subdivision. Thread-safe.
+    void add_sample() { _sample_count.fetch_add(1, std::memory_order_relaxed); }
+
+    // The sampling distribution is available once a pass has recorded some flux into it
+    [[nodiscard]] bool ready() const { return _sampling.flux() > 0.0f; }
+
+    // Sample a direction from the distribution learned in the previous pass
+    [[nodiscard]] Vector3f sample() const;
+    // PDF (solid angle measure) of sampling *dir* with *sample*
+    [[nodiscard]] float pdf(const Vector3f& dir) const;
+
+    // Nodes of the sampling tree
+    [[nodiscard]] size_t node_count() const { return _sampling.node_count(); }
+
+    [[nodiscard]] unsigned int sample_count() const { return _sample_count.load(std::memory_order_relaxed); }
+    void set_sample_count(unsigned int count) { _sample_count.store(count, std::memory_order_relaxed); }
+
+    // Swap in the building tree for sampling and restructure the building tree for the next pass
+    void refine(float subdivision_threshold);
+
+    DTreeWrapper() = default;
+    DTreeWrapper(const DTreeWrapper& rhs) : _building(rhs._building), _sampling(rhs._sampling), _sample_count(rhs.sample_count()) {}
+
+private:
+    DTree _building;
+    DTree _sampling;
+    std::atomic<unsigned int> _sample_count{ 0 };
+};
+
+// Binary tree over the (cubified) scene bounds, splitting x, y and z in turn.
+class SDTree {
+public:
+    explicit SDTree(const BoundingBox& scene_bound);
+
+    // D-trees of the leaf containing *pos*
+    [[nodiscard]] DTreeWrapper& dtree(const Vector3f& pos);
+
+    // Called between passes. Leaves with more than *spatial_threshold* recorded samples are split,
+    // then every D-tree is refined with *directional_threshold*.
+    void refine(unsigned int spatial_threshold, float directional_threshold);
+
+    // Whether incident radiance is recorded in the current pass
+    bool recording() const { return _recording; }
+    void set_recording(bool recording) { _recording = recording; }
+
+    [[nodiscard]] size_t leaf_count() const;
+    [[nodiscard]] size_t dtree_node_count() const;
+
+private:
+    struct Node {
+        int axis = 0;
+        std::array<uint32_t, 2> children = { 0, 0 };  // both 0 for leaves
+        std::unique_ptr<DTreeWrapper> dtree_ptr;
+
+        bool is_leaf() const { return children[0] == 0; }
+    };
+
+    BoundingBox _bound;
+    std::vector<Node> _nodes;
+    bool _recording = true;
+};
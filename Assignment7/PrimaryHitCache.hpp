@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Math.hpp"
+#include "Material.hpp"
+
+// Camera-ray hits of every sample of an image, so that the image can be shaded again after material edits
+// without tracing the camera rays. The materials are referenced, not copied: shading a cached hit uses the
+// current parameters of its material. Moving objects or the camera invalidates the cache.
+class PrimaryHitCache {
+public:
+    static constexpr uint32_t NO_MATERIAL = 0xffffffffu;
+
+    // Hit of the camera ray of a sample
+    struct PrimaryHit {
+        float dir[3];                           // direction of the camera ray
+        float pos[3];
+        float normal[3];
+        float uv[2];
+        uint32_t material_idx = NO_MATERIAL;    // index into *materials*, NO_MATERIAL if the ray escaped the scene
+        float radiance[3];                      // of the sample when it was last shaded
+    };
+
+    PrimaryHitCache() = default;
+    PrimaryHitCache(unsigned int width, unsigned int height, unsigned int spp, const Vector3f& eye_pos, float fov)
+        : _width(width), _height(height), _spp(spp), _eye_pos(eye_pos), _fov(fov),
+          _hits(static_cast<size_t>(width) * static_cast<size_t>(height) * spp) {}
+
+    unsigned int width() const { return _width; }
+    unsigned int height() const { return _height; }
+    unsigned int spp() const { return _spp; }
+    Vector3f eye_pos() const { return _eye_pos; }
+    float fov() const { return _fov; }
+    size_t byte_size() const { return _hits.size() * sizeof(PrimaryHit); }
+    // Whether the radiance of all samples has been shaded
+    bool shaded() const { return _shaded; }
+    void set_shaded() { _shaded = true; }
+
+    // Hit of sample *sample_idx* of the pixel *pixel_idx* (row by row)
+    PrimaryHit& hit(size_t pixel_idx, unsigned int sample_idx) { return _hits[pixel_idx * _spp + sample_idx]; }
+    const PrimaryHit& hit(size_t pixel_idx, unsigned int sample_idx) const { return _hits[pixel_idx * _spp + sample_idx]; }
+
+    // Materials of the hits, in the order they were first hit
+    const std::vector<std::shared_ptr<Material>>& materials() const { return _materials; }
+
+    // Index of *mat_ptr* among the materials, added if it is new. Not thread-safe.
+    uint32_t material_index(const std::shared_ptr<Material>& mat_ptr) {
+        const auto [it, inserted] = _material_indices.try_emplace(mat_ptr.get(), static_cast<uint32_t>(_materials.size()));
+        if (inserted)
+            _materials.push_back(mat_ptr);
+        return it->second;
+    }
+
+private:
+    unsigned int _width = 0;
+    unsigned int _height = 0;
+    unsigned int _spp = 0;
+    Vector3f _eye_pos;
+    float _fov = 0.0f;
+
+    bool _shaded = false;
+    std::vector<PrimaryHit> _hits;
+    std::vector<std::shared_ptr<Material>> _materials;
+    std::unordered_map<const Material*, uint32_t> _material_indices;
+};
@@ -0,0 +1,451 @@
+#include "QuantizedBVH.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#endif
+
+#include "BVH.hpp"
+
+namespace {
+    bool is_leaf(const BVH_node* node_ptr) {
+        return node_ptr->left_ptr == nullptr && node_ptr->right_ptr == nullptr;
+    }
+
+    void prefetch(const void* ptr) {
+#ifdef _MSC_VER
+        _mm_prefetch(static_cast<const char*>(ptr), _MM_HINT_T0);
+#else
+        __builtin_prefetch(ptr);
+#endif
+    }
+}
+
+QuantizedBVH::QuantizedBVH(const BVH_node* root_ptr) {
+    if (root_ptr == nullptr)
+        return;
+    _bound = root_ptr->bound;
+    build(root_ptr, 0);
+}
+
+float QuantizedBVH::exponent_to_scale(int8_t exponent) {
+    // 2^exponent from the bits of a float, the exponents are kept in the range of normal floats
+    const auto bits = static_cast<uint32_t>(exponent + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+uint32_t QuantizedBVH::build(const BVH_node* node_ptr, unsigned int depth) {
+    if (depth > MAX_DEPTH)
+        throw std::runtime_error("BVH too deep to quantize");
+
+    const auto node_idx = static_cast<uint32_t>(_nodes.size());
+    _nodes.emplace_back();
+
+    // a leaf is only built as a node when it is the root
+    const BVH_node* children[2] = { node_ptr, nullptr };
+    if (!is_leaf(node_ptr)) {
+        children[0] = node_ptr->left_ptr.get();
+        children[1] = node_ptr->right_ptr.get();
+    }
+    uint32_t child_refs[2];
+    for (int i = 0; i < 2; ++i)
+        child_refs[i] = child_reference(children[i], depth + 1);
+
+    // the children are appended behind, so the node is only referenced by index from here on
+    auto& node = _nodes[node_idx];
+    const auto& bound = node_ptr->bound;
+    for (int dim = 0; dim < 3; ++dim) {
+        const auto origin = bound.p_min[dim];
+        const auto extent = bound.p_max[dim] - origin;
+
+        // smallest power of two cell size with 255 cells covering the box
+        auto exponent = extent > 0.0f ? static_cast<int>(std::ceil(std::log2(extent / 255.0f))) : -126;
+        exponent = std::max(exponent, -126);
+        while (exponent < 127 && origin + 255.0f * exponent_to_scale(static_cast<int8_t>(exponent)) < bound.p_max[dim])
+            ++exponent;
+        const auto scale = exponent_to_scale(static_cast<int8_t>(exponent));
+
+        node.origin[dim] = origin;
+        node.exponents[dim] = static_cast<int8_t>(exponent);
+        for (int i = 0; i < 2; ++i) {
+            if (child_refs[i] == EMPTY) {
+                node.bounds[dim][i] = node.bounds[dim][2 + i] = 0;
+                continue;
+            }
+
+            // round outward, then step further out where rounding the dequantized bound could move it inward
+            const auto& child_bound = children[i]->bound;
+            auto q_min = static_cast<int>(clamp(0.0f, 255.0f, std::floor((child_bound.p_min[dim] - origin) / scale)));
+            auto q_max = static_cast<int>(clamp(0.0f, 255.0f, std::ceil((child_bound.p_max[dim] - origin) / scale)));
+            while (q_min > 0 && origin + static_cast<float>(q_min) * scale > child_bound.p_min[dim])
+                --q_min;
+            while (q_max < 255 && origin + static_cast<float>(q_max) * scale < child_bound.p_max[dim])
+                ++q_max;
+            node.bounds[dim][i] = static_cast<uint8_t>(q_min);
+            node.bounds[dim][2 + i] = static_cast<uint8_t>(q_max);
+        }
+    }
+    node.children[0] = child_refs[0];
+    node.children[1] = child_refs[1];
+    node.padding = 0;
+
+    return node_idx;
+}
+
+int QuantizedBVH::intersect_children(const Node& node, const Ray& ray, float max_time, float (&t_enter)[2]) {
+    // the cell sizes are powers of two, so the dequantized bounds are exact as while quantizing
+#ifdef USE_SIMD
+    // one lane for each bound of the axis: {min 0, min 1, max 0, max 1}
+    // the 16 bytes from *bounds* stay inside the node
+    const auto zero = _mm_setzero_si128();
+    const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(node.bounds));
+    const auto words_xy = _mm_unpacklo_epi8(bytes, zero);
+    const __m128i q[3] = { _mm_unpacklo_epi16(words_xy, zero), _mm_unpackhi_epi16(words_xy, zero),
+                           _mm_unpacklo_epi16(_mm_unpackhi_epi8(bytes, zero), zero) };
+
+    auto t_near = _mm_set1_ps(FLOAT_LOWEST);
+    auto t_far = _mm_set1_ps(FLOAT_INFINITY);
+    for (int dim = 0; dim < 3; ++dim) {
+        const auto bound = _mm_add_ps(_mm_set1_ps(node.origin[dim]), _mm_mul_ps(_mm_cvtepi32_ps(q[dim]), _mm_set1_ps(exponent_to_scale(node.exponents[dim]))));
+        const auto t = _mm_mul_ps(_mm_sub_ps(bound, _mm_set1_ps(ray.ori[dim])), _mm_set1_ps(ray.inv_dir[dim]));
+        // lanes 0 and 1 get the times of the min and the max bound of each child
+        const auto t_swapped = _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2));
+        t_near = _mm_max_ps(t_near, _mm_min_ps(t, t_swapped));
+        t_far = _mm_min_ps(t_far, _mm_max_ps(t, t_swapped));
+    }
+    const auto hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(t_far, t_near), _mm_cmpgt_ps(t_far, _mm_setzero_ps())),
+                                _mm_cmple_ps(t_near, _mm_set1_ps(max_time)));
+    alignas(16) float t_near_lanes[4];
+    _mm_store_ps(t_near_lanes, t_near);
+    t_enter[0] = t_near_lanes[0];
+    t_enter[1] = t_near_lanes[1];
+    auto mask = _mm_movemask_ps(hit) & 0x3;
+#else
+    float t_near[2] = { FLOAT_LOWEST, FLOAT_LOWEST };
+    float t_far[2] = { FLOAT_INFINITY, FLOAT_INFINITY };
+    for (int dim = 0; dim < 3; ++dim) {
+        const auto scale = exponent_to_scale(node.exponents[dim]);
+        for (int i = 0; i < 2; ++i) {
+            const auto t_min = (node.origin[dim] + static_cast<float>(node.bounds[dim][i]) * scale - ray.ori[dim]) * ray.inv_dir[dim];
+            const auto t_max = (node.origin[dim] + static_cast<float>(node.bounds[dim][2 + i]) * scale - ray.ori[dim]) * ray.inv_dir[dim];
+            t_near[i] = std::max(t_near[i], std::min(t_min, t_max));
+            t_far[i] = std::min(t_far[i], std::max(t_min, t_max));
+        }
+    }
+    int mask = 0;
+    for (int i = 0; i < 2; ++i) {
+        t_enter[i] = t_near[i];
+        if (t_far[i] >= t_near[i] && t_far[i] > 0.0f && t_near[i] <= max_time)
+            mask |= 1 << i;
+    }
+#endif
+    if (node.children[0] == EMPTY)
+        mask &= ~1;
+    if (node.children[1] == EMPTY)
+        mask &= ~2;
+    return mask;
+}
+
+uint32_t QuantizedBVH::child_reference(const BVH_node* child_ptr, unsigned int depth) {
+    if (child_ptr == nullptr)
+        return EMPTY;
+    if (!is_leaf(child_ptr))
+        return build(child_ptr, depth);
+    const auto& obj_ptrs = child_ptr->obj_ptrs;
+    if (obj_ptrs.empty())
+        return EMPTY;
+
+    if (obj_ptrs.size() == 1) {
+        if (_obj_ptrs.size() >= LEAF_INDEX_MASK)
+            throw std::runtime_error("too many objects to quantize the BVH");
+        _obj_ptrs.push_back(obj_ptrs.front().get());
+        return OBJECT_FLAG | static_cast<uint32_t>(_obj_ptrs.size() - 1);
+    }
+
+    if (obj_ptrs.size() > static_cast<size_t>(Vector3f_soa::WIDTH) || _triangle_leaves.size() >= LEAF_INDEX_MASK)
+        throw std::runtime_error("too many objects to quantize the BVH");
+    TriangleLeaf leaf;
+    for (size_t i = 0; i < obj_ptrs.size(); ++i) {
+        const auto* triangle_ptr = dynamic_cast<const Triangle*>(obj_ptrs[i].get());
+        if (triangle_ptr == nullptr)
+            throw std::runtime_error("only triangles can share a leaf of a quantized BVH");
+
+        const auto lane = static_cast<int>(i);
+        leaf.v0.set(lane, triangle_ptr->v0());
+        leaf.e1.set(lane, triangle_ptr->v1() - triangle_ptr->v0());
+        leaf.e2.set(lane, triangle_ptr->v2() - triangle_ptr->v0());
+        leaf.obj_ptrs[i] = obj_ptrs[i].get();
+    }
+    _triangle_leaves.push_back(leaf);
+    return OBJECT_FLAG | static_cast<uint32_t>(obj_ptrs.size() - 1) << LEAF_SIZE_SHIFT | static_cast<uint32_t>(_triangle_leaves.size() - 1);
+}
+
+std::optional<Intersection> QuantizedBVH::intersect(const TriangleLeaf& leaf, unsigned int size, const Ray& ray,
+                                                    Culling culling, float max_time) {
+    // Moller-Trumbore on all lanes at once, as in *Triangle::intersect*
+    const Vector3f_soa dir(ray.dir);
+    const auto S = Vector3f_soa(ray.ori) - leaf.v0;
+    const auto S1 = dir.cross(leaf.e2);
+    const auto S2 = S.cross(leaf.e1);
+    const auto inv_denominator = Float8(1.0f) / S1.dot(leaf.e1);
+
+    alignas(32) float t[Vector3f_soa::WIDTH];
+    alignas(32) float b1[Vector3f_soa::WIDTH];
+    alignas(32) float b2[Vector3f_soa::WIDTH];
+    alignas(32) float condition_sq[Vector3f_soa::WIDTH];
+    (S2.dot(leaf.e2) * inv_denominator).store(t);
+    (S1.dot(S) * inv_denominator).store(b1);
+    (S2.dot(dir) * inv_denominator).store(b2);
+    (S1.magnitude_squared() * S.magnitude_squared() * inv_denominator * inv_denominator).store(condition_sq);
+
+    // The lanes only pick the candidates, with a margin for rounding differently from the scalar test. The
+    // rounding grows with how much the division amplifies it, for small triangles far away or grazing rays.
+    // The triangles confirm the candidates, applying the culling, and build the intersection.
+    std::optional<Intersection> closest;
+    auto closest_time = max_time;
+    for (unsigned int i = 0; i < size; ++i) {
+        const auto margin = 1e-4f + 1e-6f * std::sqrt(condition_sq[i]);
+        if (!(t[i] > -margin && t[i] < closest_time * (1.0f + margin) + margin
+              && b1[i] > -margin && b2[i] > -margin && b1[i] + b2[i] < 1.0f + margin))
+            continue;
+
+        auto intersection = leaf.obj_ptrs[i]->intersect(ray, culling);
+        if (intersection && intersection->time < closest_time) {
+            closest_time = intersection->time;
+            closest = std::move(intersection);
+        }
+    }
+    return closest;
+}
+
+std::optional<Intersection> QuantizedBVH::intersect(const Ray& ray, Culling culling) const {
+    float t_root;
+    if (_nodes.empty() || !_bound.intersect(ray, t_root))
+        return std::nullopt;
+
+    struct StackEntry {
+        uint32_t node_idx;
+        float t_enter;
+    };
+    StackEntry stack[MAX_DEPTH + 1];
+    size_t stack_size = 0;
+
+    std::optional<Intersection> closest;
+    auto closest_time = ray.t_max;
+    uint32_t node_idx = 0;
+    for (;;) {
+        const auto& node = _nodes[node_idx];
+        float t_enter[2];
+        const auto hit_mask = intersect_children(node, ray, closest_time, t_enter);
+
+        // test the objects at once, and collect the inner children which are hit before the closest intersection
+        uint32_t hit_nodes[2];
+        float hit_times[2];
+        int hit_count = 0;
+        for (int i = 0; i < 2; ++i) {
+            if ((hit_mask & (1 << i)) == 0)
+                continue;
+
+            const auto child = node.children[i];
+            if ((child & OBJECT_FLAG) != 0) {
+                const auto leaf_size = ((child & ~OBJECT_FLAG) >> LEAF_SIZE_SHIFT) + 1;
+                auto intersection = leaf_size == 1 ? _obj_ptrs[child & LEAF_INDEX_MASK]->intersect(ray, culling)
+                    : intersect(_triangle_leaves[child & LEAF_INDEX_MASK], leaf_size, ray, culling, closest_time);
+                if (intersection && intersection->time < closest_time) {
+                    closest_time = intersection->time;
+                    closest = std::move(intersection);
+                }
+            } else {
+                hit_nodes[hit_count] = child;
+                hit_times[hit_count] = t_enter[i];
+                ++hit_count;
+            }
+        }
+
+        if (hit_count == 2) {
+            // visit the nearer child first, the farther one may be culled by then
+            const auto near = hit_times[0] <= hit_times[1] ? 0 : 1;
+            stack[stack_size++] = { hit_nodes[1 - near], hit_times[1 - near] };
+            node_idx = hit_nodes[near];
+            continue;
+        }
+        if (hit_count == 1) {
+            node_idx = hit_nodes[0];
+            continue;
+        }
+
+        // pop the next subtree which may still hold a closer intersection
+        do {
+            if (stack_size == 0)
+                return closest;
+            --stack_size;
+        } while (stack[stack_size].t_enter > closest_time);
+        node_idx = stack[stack_size].node_idx;
+    }
+}
+
+struct QuantizedBVH::Query {
+    size_t ray_idx = 0;
+    const Ray* ray_ptr = nullptr;
+    std::optional<Intersection> closest;
+    float closest_time = FLOAT_INFINITY;
+
+    const QuantizedBVH* bvh_ptr = nullptr;      // node to visit in the next step, none once the traversal is done
+    uint32_t node_idx = 0;
+    std::array<Object*, 2> pending_obj_ptrs{};  // objects to test in the next step
+    size_t pending_count = 0;
+    std::array<const TriangleLeaf*, 2> pending_leaf_ptrs{};   // triangle leaves to test in the next step
+    std::array<unsigned int, 2> pending_leaf_sizes{};
+    size_t pending_leaf_count = 0;
+
+    // two levels of BVHs, the scene and a mesh
+    std::array<StackEntry, 2 * (MAX_DEPTH + 1)> stack{};
+    size_t stack_size = 0;
+};
+
+bool QuantizedBVH::step(Query& query, Culling culling, RayQuery ray_query) {
+    const auto& ray = *query.ray_ptr;
+    for (size_t i = 0; i < query.pending_count; ++i) {
+        auto intersection = query.pending_obj_ptrs[i]->intersect(ray, culling);
+        if (intersection && intersection->time < query.closest_time) {
+            query.closest_time = intersection->time;
+            query.closest = std::move(intersection);
+        }
+    }
+    query.pending_count = 0;
+    for (size_t i = 0; i < query.pending_leaf_count; ++i) {
+        auto intersection = intersect(*query.pending_leaf_ptrs[i], query.pending_leaf_sizes[i], ray, culling, query.closest_time);
+        if (intersection) {
+            query.closest_time = intersection->time;
+            query.closest = std::move(intersection);
+        }
+    }
+    query.pending_leaf_count = 0;
+    if (query.bvh_ptr == nullptr || (ray_query == RayQuery::OCCLUSION && query.closest))
+        return false;
+
+    const auto* bvh_ptr = query.bvh_ptr;
+    const auto& node = bvh_ptr->_nodes[query.node_idx];
+    float t_enter[2];
+    const auto hit_mask = intersect_children(node, ray, query.closest_time, t_enter);
+
+    StackEntry hits[2];
+    int hit_count = 0;
+    for (int i = 0; i < 2; ++i) {
+        if ((hit_mask & (1 << i)) == 0)
+            continue;
+
+        const auto child = node.children[i];
+        if ((child & OBJECT_FLAG) == 0) {
+            hits[hit_count++] = { bvh_ptr, child, t_enter[i] };
+            continue;
+        }
+
+        const auto leaf_size = ((child & ~OBJECT_FLAG) >> LEAF_SIZE_SHIFT) + 1;
+        if (leaf_size > 1) {
+            const auto& leaf = bvh_ptr->_triangle_leaves[child & LEAF_INDEX_MASK];
+            for (size_t offset = 0; offset < sizeof(TriangleLeaf); offset += 64)
+                prefetch(reinterpret_cast<const char*>(&leaf) + offset);
+            query.pending_leaf_ptrs[query.pending_leaf_count] = &leaf;
+            query.pending_leaf_sizes[query.pending_leaf_count++] = leaf_size;
+            continue;
+        }
+
+        auto* obj_ptr = bvh_ptr->_obj_ptrs[child & LEAF_INDEX_MASK];
+        const auto* nested_bvh_ptr = obj_ptr->quantized_bvh();
+        if (nested_bvh_ptr != nullptr && !nested_bvh_ptr->_nodes.empty()) {
+            hits[hit_count++] = { nested_bvh_ptr, 0, t_enter[i] };
+        } else {
+            // objects are mostly larger than a cache line
+            prefetch(obj_ptr);
+            prefetch(reinterpret_cast<const char*>(obj_ptr) + 64);
+            query.pending_obj_ptrs[query.pending_count++] = obj_ptr;
+        }
+    }
+
+    if (hit_count == 2) {
+        const auto near = hits[0].t_enter <= hits[1].t_enter ? 0 : 1;
+        query.stack[query.stack_size++] = hits[1 - near];
+        hits[0] = hits[near];
+        hit_count = 1;
+    }
+    if (hit_count == 1) {
+        query.bvh_ptr = hits[0].bvh_ptr;
+        query.node_idx = hits[0].node_idx;
+    } else {
+        // the pending objects may still cull the popped node, its children are tested against them then
+        query.bvh_ptr = nullptr;
+        while (query.stack_size > 0) {
+            const auto& entry = query.stack[--query.stack_size];
+            if (entry.t_enter <= query.closest_time) {
+                query.bvh_ptr = entry.bvh_ptr;
+                query.node_idx = entry.node_idx;
+                break;
+            }
+        }
+        if (query.bvh_ptr == nullptr)
+            return query.pending_count > 0 || query.pending_leaf_count > 0;
+    }
+
+    prefetch(&query.bvh_ptr->_nodes[query.node_idx]);
+    return true;
+}
+
+void QuantizedBVH::intersect(Span<const Ray> rays, Culling culling, RayQuery query, Span<HitRecord> hits) const {
+    if (hits.size() != rays.size())
+        throw std::runtime_error("one hit record per ray is needed");
+    std::fill(hits.begin(), hits.end(), HitRecord());
+    if (_nodes.empty())
+        return;
+
+    size_t next_ray_idx = 0;
+    const auto start_query = [&](Query& q) {
+        while (next_ray_idx < rays.size()) {
+            const auto ray_idx = next_ray_idx++;
+            float t_enter;
+            if (!_bound.intersect(rays[ray_idx], t_enter) || t_enter > rays[ray_idx].t_max)
+                continue;
+
+            q.ray_idx = ray_idx;
+            q.ray_ptr = &rays[ray_idx];
+            q.closest.reset();
+            q.closest_time = rays[ray_idx].t_max;
+            q.bvh_ptr = this;
+            q.node_idx = 0;
+            q.pending_count = 0;
+            q.pending_leaf_count = 0;
+            q.stack_size = 0;
+            return true;
+        }
+        return false;
+    };
+
+    std::array<Query, INTERLEAVED_QUERY_COUNT> queries;
+    std::array<bool, INTERLEAVED_QUERY_COUNT> active{};
+    unsigned int active_count = 0;
+    for (unsigned int i = 0; i < INTERLEAVED_QUERY_COUNT; ++i) {
+        active[i] = start_query(queries[i]);
+        if (active[i])
+            ++active_count;
+    }
+
+    // round robin over the queries in flight, a finished query takes the next ray
+    while (active_count > 0) {
+        for (unsigned int i = 0; i < INTERLEAVED_QUERY_COUNT; ++i) {
+            if (!active[i] || step(queries[i], culling, query))
+                continue;
+
+            hits[queries[i].ray_idx] = make_hit_record(queries[i].closest, query);
+            if (!start_query(queries[i])) {
+                active[i] = false;
+                --active_count;
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "Object.hpp"
+#include "Ray.hpp"
+#include "BoundingBox.hpp"
+#include "Intersection.hpp"
+#include "RayQuery.hpp"
+
+struct BVH_node;
+
+// Compact copy of a BVH for traversal.
+//
+// The nodes are stored in one array. Each node keeps the bounds of its two children quantized to 8 bits
+// on a grid spanning its own box, whose cell size is a power of two on each axis. The quantized bounds are
+// rounded outward, so a child box always contains the exact one and no intersection is missed. The leaves
+// are folded into their parents: a child is either the index of a node or, with the top bit set, of a leaf.
+// A leaf of one object is the index of the object. A leaf of 2 to 8 triangles is the index of a *TriangleLeaf*,
+// which keeps their vertices side by side to test them all at once. The boxes are dequantized on the fly
+// while traversing.
+class QuantizedBVH {
+public:
+    QuantizedBVH() = default;
+    explicit QuantizedBVH(const BVH_node* root_ptr);
+
+    // Closest intersection before *ray.t_max*
+    [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray, Culling culling) const;
+
+    // Answer *query* for all *rays* into *hits* with INTERLEAVED_QUERY_COUNT queries in flight on the calling thread.
+    // Each query visits one node, prefetches the node and the objects it visits next and hands over to the next
+    // query, so that the latency of loading them is hidden behind the work of the other queries. Objects which have
+    // a quantized BVH of their own (meshes) are descended into by the same query.
+    void intersect(Span<const Ray> rays, Culling culling, RayQuery query, Span<HitRecord> hits) const;
+
+    size_t node_count() const { return _nodes.size(); }
+    size_t triangle_leaf_count() const { return _triangle_leaves.size(); }
+    static constexpr size_t bytes_per_node() { return sizeof(Node); }
+
+private:
+    struct Node {
+        float origin[3];            // min corner of the box of the node
+        int8_t exponents[3];        // the grid cell size is 2^exponent on each axis
+        uint8_t padding;
+        // child bounds in grid cells from *origin* on each axis: min of child 0 and 1, max of child 0 and 1
+        uint8_t bounds[3][4];
+        uint32_t children[2];       // node index, OBJECT_FLAG | (leaf size - 1) << LEAF_SIZE_SHIFT | object or
+                                    // triangle leaf index, or EMPTY
+    };
+
+    // Triangles of a leaf in lanes, as the first vertex and the two edges from it. Unused lanes are zero.
+    struct TriangleLeaf {
+        Vector3f_soa v0, e1, e2;
+        std::array<Object*, Vector3f_soa::WIDTH> obj_ptrs{};
+    };
+
+    struct StackEntry {
+        const QuantizedBVH* bvh_ptr;
+        uint32_t node_idx;
+        float t_enter;
+    };
+
+    // State of a ray query of the interleaved traversal
+    struct Query;
+
+    // Test the ray against the boxes of both children of *node*. Returns a mask of the children which are hit
+    // no later than *max_time*, with the times the ray enters them in *t_enter*.
+    static int intersect_children(const Node& node, const Ray& ray, float max_time, float (&t_enter)[2]);
+
+    // Closest intersection before *max_time* with the first *size* triangles of *leaf*
+    static std::optional<Intersection> intersect(const TriangleLeaf& leaf, unsigned int size, const Ray& ray,
+                                                 Culling culling, float max_time);
+
+    // Test the objects found by the previous step of *query* and visit its next node.
+    // Returns false once the query is finished, with OCCLUSION as soon as it has found a hit.
+    static bool step(Query& query, Culling culling, RayQuery ray_query);
+
+    // Append the node for the children of *node_ptr*, returns its index
+    uint32_t build(const BVH_node* node_ptr, unsigned int depth);
+    // Reference to *child_ptr* as a child of a node, appending its own node if it is an inner node
+    uint32_t child_reference(const BVH_node* child_ptr, unsigned int depth);
+
+    static float exponent_to_scale(int8_t exponent);
+
+private:
+    static constexpr uint32_t OBJECT_FLAG = 0x80000000u;
+    static constexpr unsigned int LEAF_SIZE_SHIFT = 28;
+    static constexpr uint32_t LEAF_INDEX_MASK = (1u << LEAF_SIZE_SHIFT) - 1;
+    static constexpr uint32_t EMPTY = 0xffffffffu;
+    static constexpr unsigned int MAX_DEPTH = 64;
+    static constexpr unsigned int INTERLEAVED_QUERY_COUNT = 8;
+
+    std::vector<Node> _nodes;
+    std::vector<Object*> _obj_ptrs;     // owned by the BVH_node tree the BVH was built from
+    std::vector<TriangleLeaf> _triangle_leaves;
+    BoundingBox _bound;
+};
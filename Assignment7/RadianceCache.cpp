@@ -0,0 +1,31 @@
+#include "RadianceCache.hpp"
+
+RadianceCache::RadianceCache(const BoundingBox& scene_bound, unsigned int resolution)
+    : _bound(scene_bound), _resolution(std::max(resolution, 1u)),
+      _cells(new Cell[static_cast<size_t>(_resolution) * _resolution * _resolution]) {
+}
+
+void RadianceCache::record(const Vector3f& pos, float radiance) {
+    if (!std::isfinite(radiance))
+        return;
+
+    auto& cell = _cells[cell_index(pos)];
+    auto current = cell.sum.load(std::memory_order_relaxed);
+    while (!cell.sum.compare_exchange_weak(current, current + radiance, std::memory_order_relaxed)) { }
+    cell.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+float RadianceCache::estimate(const Vector3f& pos) const {
+    const auto& cell = _cells[cell_index(pos)];
+    const auto count = cell.count.load(std::memory_order_relaxed);
+    return count < MIN_SAMPLE_COUNT ? 0.0f : cell.sum.load(std::memory_order_relaxed) / static_cast<float>(count);
+}
+
+size_t RadianceCache::cell_index(const Vector3f& pos) const {
+    const auto ratio = _bound.offset_ratio(pos);
+    const auto max_idx = static_cast<float>(_resolution - 1);
+    const auto x = static_cast<size_t>(clamp(0.0f, max_idx, ratio.x * static_cast<float>(_resolution)));
+    const auto y = static_cast<size_t>(clamp(0.0f, max_idx, ratio.y * static_cast<float>(_resolution)));
+    const auto z = static_cast<size_t>(clamp(0.0f, max_idx, ratio.z * static_cast<float>(_resolution)));
+    return (z * _resolution + y) * _resolution + x;
+}
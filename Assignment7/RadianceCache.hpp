@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "Math.hpp"
+#include "BoundingBox.hpp"
+
+// Coarse spatial cache of the indirect radiance leaving surfaces, used as the adjoint (importance)
+// estimate of adjoint-driven Russian roulette and splitting.
+//
+// The scene bounds are divided into a uniform grid. Each cell keeps the mean luminance of the indirect
+// illumination estimates recorded at the shading points inside it, ignoring the outgoing direction.
+class RadianceCache {
+public:
+    explicit RadianceCache(const BoundingBox& scene_bound, unsigned int resolution = 16);
+
+    // Add the indirect radiance estimate *radiance* at *pos*. Thread-safe.
+    void record(const Vector3f& pos, float radiance);
+
+    // Mean indirect radiance around *pos*, 0 if too few estimates have been recorded there
+    [[nodiscard]] float estimate(const Vector3f& pos) const;
+
+private:
+    struct Cell {
+        std::atomic<float> sum{ 0.0f };
+        std::atomic<unsigned int> count{ 0 };
+    };
+
+    [[nodiscard]] size_t cell_index(const Vector3f& pos) const;
+
+private:
+    static constexpr unsigned int MIN_SAMPLE_COUNT = 8;
+
+    BoundingBox _bound;
+    unsigned int _resolution;
+    std::unique_ptr<Cell[]> _cells;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "Intersection.hpp"
+#include "Math.hpp"
+
+// Non-owning view of contiguous elements, standing in for C++20 std::span
+template <typename T>
+class Span {
+public:
+    Span() = default;
+    Span(T* data, size_t size) : _data(data), _size(size) {}
+    template <typename U, typename = typename std::enable_if<std::is_same<const U, T>::value || std::is_same<U, T>::value>::type>
+    Span(std::vector<U>& elems) : _data(elems.data()), _size(elems.size()) {}
+    template <typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type>
+    Span(const std::vector<U>& elems) : _data(elems.data()), _size(elems.size()) {}
+
+    T* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    T* begin() const { return _data; }
+    T* end() const { return _data + _size; }
+    T& operator[](size_t idx) const { return _data[idx]; }
+
+    // *count* elements from *offset*
+    Span subspan(size_t offset, size_t count) const { return { _data + offset, count }; }
+
+private:
+    T* _data = nullptr;
+    size_t _size = 0;
+};
+
+// What a batch of rays is queried for
+enum class RayQuery {
+    CLOSEST_HIT,    // the nearest intersection of each ray before its *t_max*
+    OCCLUSION       // whether each ray hits anything before its *t_max*, the traversal stops at the first hit found
+};
+
+// Compact result of a ray of a batch query, without the reference counting of *Intersection*.
+// The hit position is *ray.at_time(time)*.
+struct HitRecord {
+    float time = FLOAT_INFINITY;    // FLOAT_INFINITY if the ray hits nothing
+    float normal[3] = {};           // geometric normal at the hit, only with CLOSEST_HIT
+    Object* obj_ptr = nullptr;      // object hit, only with CLOSEST_HIT, owned by the scene (triangles of
+                                    // out-of-core meshes only while their cluster is cached)
+    Material* mat_ptr = nullptr;    // material at the hit, only with CLOSEST_HIT
+
+    bool hit() const { return time < FLOAT_INFINITY; }
+};
+
+// Result of *query* for a ray with the closest *intersection* found for it
+inline HitRecord make_hit_record(const std::optional<Intersection>& intersection, RayQuery query) {
+    HitRecord hit;
+    if (!intersection)
+        return hit;
+
+    hit.time = intersection->time;
+    if (query == RayQuery::CLOSEST_HIT) {
+        hit.normal[0] = intersection->normal.x;
+        hit.normal[1] = intersection->normal.y;
+        hit.normal[2] = intersection->normal.z;
+        hit.obj_ptr = intersection->obj_ptr.get();
+        hit.mat_ptr = intersection->mat_ptr.get();
+    }
+    return hit;
+}
@@ -0,0 +1,257 @@
+#include "RenderService.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define RENDER_SERVICE_SUPPORTED
+#endif
+
+#ifdef RENDER_SERVICE_SUPPORTED
+
+namespace {
+    // A client that never sends its line only holds its own connection thread until then
+    constexpr time_t REQUEST_TIMEOUT_SECONDS = 5;
+    // Pause before accepting again when out of file descriptors or memory
+    constexpr auto ACCEPT_RETRY_DELAY = std::chrono::milliseconds(100);
+    // How often the accept loop checks for a shutdown requested on a connection thread
+    constexpr int SHUTDOWN_POLL_INTERVAL_MS = 100;
+
+    // Remove a socket left behind by an earlier run, refusing to delete anything else at *socket_path*
+    void remove_stale_socket(const std::string& socket_path) {
+        struct stat st{};
+        if (lstat(socket_path.c_str(), &st) != 0)
+            return;
+        if (!S_ISSOCK(st.st_mode))
+            throw std::runtime_error(socket_path + " exists and is not a socket");
+        unlink(socket_path.c_str());
+    }
+}
+
+void RenderService::run(const std::string& socket_path) {
+    // clients may hang up before their job is done
+    std::signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("socket path too long: " + socket_path);
+    addr.sun_family = AF_UNIX;
+    socket_path.copy(addr.sun_path, socket_path.size());
+
+    const auto listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw std::runtime_error("cannot create socket");
+
+    try {
+        remove_stale_socket(socket_path);
+    } catch (...) {
+        close(listen_fd);
+        throw;
+    }
+    if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+        close(listen_fd);
+        throw std::runtime_error("cannot listen on " + socket_path);
+    }
+
+    std::cout << " - Render service listening on " << socket_path << std::endl;
+    std::thread render_thread(&RenderService::render_jobs, this);
+
+    // each request is read on a thread of its own, so slow clients do not hold up the others
+    std::vector<std::future<void>> connection_handles;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(_queue_mutex);
+            if (_shutdown)
+                break;
+        }
+        connection_handles.erase(std::remove_if(connection_handles.begin(), connection_handles.end(), [](const std::future<void>& handle) {
+            return handle.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }), connection_handles.end());
+
+        pollfd listen_poll{ listen_fd, POLLIN, 0 };
+        if (poll(&listen_poll, 1, SHUTDOWN_POLL_INTERVAL_MS) <= 0)
+            continue;
+
+        const auto client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // resources are freed as queued jobs finish
+                std::this_thread::sleep_for(ACCEPT_RETRY_DELAY);
+                continue;
+            }
+
+            // the socket itself is broken: stop accepting and finish the queued jobs
+            std::cerr << " - Render service cannot accept connections (errno " << errno << ")" << std::endl;
+            std::lock_guard<std::mutex> lock(_queue_mutex);
+            _shutdown = true;
+            _queue_cv.notify_all();
+            break;
+        }
+
+        connection_handles.push_back(std::async(std::launch::async, &RenderService::handle_connection, this, client_fd));
+    }
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    for (auto& handle : connection_handles)
+        handle.get();
+    render_thread.join();
+    std::cout << " - Render service stopped" << std::endl;
+}
+
+void RenderService::handle_connection(int client_fd) {
+    timeval timeout{};
+    timeout.tv_sec = REQUEST_TIMEOUT_SECONDS;
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    if (!read_line(client_fd, request)) {
+        write_line(client_fd, "error no request received");
+        close(client_fd);
+        return;
+    }
+
+    if (request == "shutdown") {
+        write_line(client_fd, "ok");
+        close(client_fd);
+
+        std::lock_guard<std::mutex> lock(_queue_mutex);
+        _shutdown = true;
+        _queue_cv.notify_all();
+        return;
+    }
+
+    RenderJob job;
+    std::string error;
+    if (!parse_job(request, job, error)) {
+        write_line(client_fd, "error " + error);
+        close(client_fd);
+        return;
+    }
+
+    job.client_fd = client_fd;
+    {
+        std::lock_guard<std::mutex> lock(_queue_mutex);
+        // the render thread stops once the queue is empty after a shutdown
+        if (_shutdown) {
+            write_line(client_fd, "error shutting down");
+            close(client_fd);
+            return;
+        }
+        job.id = _next_job_id++;
+        _jobs.push(job);
+    }
+    write_line(client_fd, "queued " + std::to_string(job.id));
+    _queue_cv.notify_one();
+}
+
+void RenderService::render_jobs() {
+    for (;;) {
+        RenderJob job;
+        {
+            std::unique_lock<std::mutex> lock(_queue_mutex);
+            _queue_cv.wait(lock, [this] { return _shutdown || !_jobs.empty(); });
+            if (_jobs.empty())
+                return;     // shut down with an empty queue
+            job = _jobs.front();
+            _jobs.pop();
+        }
+
+        std::cout << " - Job " << job.id << ": " << job.width << " x " << job.height << ", " << job.spp
+                  << " spp -> " << job.output_file_name << std::endl;
+
+        // the jobs run one after another, so the scene is only touched by this thread while rendering
+        _scene.set_camera(job.width, job.height, job.eye_pos, job.fov);
+        const auto start = std::chrono::steady_clock::now();
+        try {
+            _renderer.render(_scene, job.spp, _total_thread_count, job.output_file_name);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            write_line(job.client_fd, "done " + std::to_string(job.id) + " " + std::to_string(elapsed.count()));
+        } catch (const std::exception& e) {
+            write_line(job.client_fd, std::string("error ") + e.what());
+        }
+        close(job.client_fd);
+    }
+}
+
+bool RenderService::read_line(int fd, std::string& line) {
+    line.clear();
+    for (;;) {
+        char c;
+        const auto n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;     // timed out or failed
+        if (n == 0 || c == '\n' || line.size() >= 4096)
+            break;
+        line.push_back(c);
+    }
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    return true;
+}
+
+void RenderService::write_line(int fd, const std::string& line) {
+    const auto message = line + "\n";
+    size_t written = 0;
+    while (written < message.size()) {
+        const auto n = write(fd, message.data() + written, message.size() - written);
+        if (n <= 0)
+            return;     // client went away
+        written += static_cast<size_t>(n);
+    }
+}
+
+#else
+
+void RenderService::run(const std::string& socket_path) {
+    throw std::runtime_error("render service requires Unix domain sockets");
+}
+
+void RenderService::handle_connection(int client_fd) { }
+
+void RenderService::render_jobs() { }
+
+bool RenderService::read_line(int fd, std::string& line) { return false; }
+
+void RenderService::write_line(int fd, const std::string& line) { }
+
+#endif
+
+bool RenderService::parse_job(const std::string& request, RenderJob& job, std::string& error) {
+    std::istringstream is(request);
+    std::string command;
+    is >> command;
+    if (command != "render") {
+        error = "unknown command '" + command + "'";
+        return false;
+    }
+
+    if (!(is >> job.width >> job.height >> job.eye_pos.x >> job.eye_pos.y >> job.eye_pos.z >> job.fov >> job.spp)) {
+        error = "usage: render <width> <height> <eye_x> <eye_y> <eye_z> <fov> <spp> <output_path>";
+        return false;
+    }
+    std::getline(is >> std::ws, job.output_file_name);
+    if (job.width == 0 || job.height == 0 || job.spp == 0 || job.fov <= 0.0f || job.fov >= 180.0f || job.output_file_name.empty()) {
+        error = "invalid job parameters";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+
+#include "Renderer.hpp"
+#include "Scene.hpp"
+
+// A render job received by *RenderService*
+struct RenderJob {
+    unsigned int id = 0;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    Vector3f eye_pos;
+    float fov = 0.0f;
+    unsigned int spp = 0;
+    std::string output_file_name;
+    int client_fd = -1;     // connection to report the result to, closed after the job
+};
+
+// Persistent render daemon. The scene is loaded and its BVHs built once by the caller,
+// then render jobs are accepted over a Unix domain socket and rendered one after another,
+// each with all the rendering threads.
+//
+// Protocol: one line of text per connection.
+//     render <width> <height> <eye_x> <eye_y> <eye_z> <fov> <spp> <output_path>
+//         replies "queued <id>" at once and "done <id> <seconds>" (or "error <message>") when rendered
+//     shutdown
+//         stops accepting jobs, renders the queued ones and exits *run*
+//
+// e.g. echo "render 512 512 278 273 -800 40 16 view.png" | nc -U /tmp/raytracing.sock
+class RenderService {
+public:
+    RenderService(Scene& scene, const Renderer& renderer, unsigned int total_thread_count)
+        : _scene(scene), _renderer(renderer), _total_thread_count(total_thread_count) {}
+
+    // Listen on *socket_path* and serve jobs until a shutdown request. A socket left at *socket_path* by an
+    // earlier run is replaced, any other file there is an error. Only supported on POSIX systems.
+    void run(const std::string& socket_path);
+
+private:
+    // Read the request line of a new connection, then queue the job or answer it directly.
+    // Runs on a thread of its own per connection, the read times out after REQUEST_TIMEOUT_SECONDS.
+    void handle_connection(int client_fd);
+    // Render queued jobs until shutdown
+    void render_jobs();
+
+    [[nodiscard]] static bool parse_job(const std::string& request, RenderJob& job, std::string& error);
+
+    // Read one line into *line*. Returns false if the read timed out or failed.
+    [[nodiscard]] static bool read_line(int fd, std::string& line);
+    static void write_line(int fd, const std::string& line);
+
+private:
+    Scene& _scene;
+    const Renderer& _renderer;
+    unsigned int _total_thread_count;
+
+    std::mutex _queue_mutex;
+    std::condition_variable _queue_cv;
+    std::queue<RenderJob> _jobs;
+    unsigned int _next_job_id = 1;
+    bool _shutdown = false;
+};
@@ -3,55 +3,364 @@
 #include <iostream>
 #include <future>
 #include <functional>
+#include <mutex>
+#include <unordered_map>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-void Renderer::render(const Scene& scene, unsigned int spp, unsigned int total_thread_count) const {
+void Renderer::render(const Scene& scene, unsigned int spp, unsigned int total_thread_count, const std::string& output_file_name) const {
+    std::cout << "SPP: " << spp << std::endl;
+    print_settings();
+
+    ProgressiveImage progressive_image(*this, scene, total_thread_count);
+    if (_path_guiding) {
+        // double the samples of each training pass as long as the final pass keeps at least as many
+        unsigned int pass_spp = 1;
+        while (progressive_image.rendered_spp() + 3 * pass_spp <= spp) {
+            std::cout << " - Path guiding training pass with " << pass_spp << " spp" << std::endl;
+            progressive_image.run_pass(pass_spp);
+            progressive_image.refine_guiding(pass_spp);
+            pass_spp *= 2;
+        }
+        progressive_image.finish_training();
+    } else if (_russian_roulette == RussianRoulette::ADRRS && spp > 1) {
+        // coarse pass with the fixed scheme to estimate the pixels and fill the radiance cache
+        std::cout << " - ADRRS estimation pass with " << estimation_spp(spp) << " spp" << std::endl;
+        progressive_image.run_pass(estimation_spp(spp));
+    }
+
+    if (progressive_image.rendered_spp() > 0)
+        std::cout << " - Final pass with " << spp - progressive_image.rendered_spp() << " spp" << std::endl;
+    progressive_image.run_pass(spp - progressive_image.rendered_spp());
+
+    save_image(scene.width(), scene.height(), progressive_image.image(), output_file_name);
+}
+
+unsigned int Renderer::render_within(const Scene& scene, std::chrono::duration<double> time_budget, unsigned int total_thread_count,
+                                     const std::string& output_file_name) const {
+    using Clock = std::chrono::steady_clock;
+    using Seconds = std::chrono::duration<double>;
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::duration_cast<Clock::duration>(time_budget);
+
+    std::cout << "Time budget: " << time_budget.count() << " seconds" << std::endl;
+    print_settings();
+
+    // the first pass also trains path guiding and estimates the pixels for ADRRS
+    ProgressiveImage progressive_image(*this, scene, total_thread_count);
+    auto training = _path_guiding;
+    std::cout << " - Pass with 1 spp" << std::endl;
+    auto pass_start = Clock::now();
+    progressive_image.run_pass(1);
+    Seconds spp_time = Clock::now() - pass_start;
+    // the SD-tree is refined after each training pass, on top of the time of its samples
+    Seconds refine_time(0.0);
+    if (training) {
+        const auto refine_start = Clock::now();
+        progressive_image.refine_guiding(1);
+        refine_time = Clock::now() - refine_start;
+    }
+
+    // write an image right away, which also measures the time to reserve for the final write
+    const auto save_start = Clock::now();
+    save_image(scene.width(), scene.height(), progressive_image.image(), output_file_name);
+    const Seconds save_time = Clock::now() - save_start;
+
+    unsigned int pass_spp = 1;
+    for (;;) {
+        // ending the training is done before the time left is taken, so it is paid out of the budget like a pass
+        if (training && Clock::now() - start >= TRAINING_BUDGET_FRACTION * time_budget) {
+            progressive_image.finish_training();
+            training = false;
+        }
+
+        // the passes grow geometrically to amortize their fixed costs, but at most double so that the prediction
+        // from the last one stays reliable. A training pass also has to leave time for refining the SD-tree,
+        // predicted by the last refinement.
+        const Seconds time_left = deadline - Clock::now() - save_time;
+        const Seconds pass_overhead = training ? refine_time : Seconds(0.0);
+        const auto affordable_spp = (time_left - pass_overhead).count() / (PASS_COST_MARGIN * spp_time.count());
+        pass_spp = static_cast<unsigned int>(std::min(2.0 * pass_spp, std::max(0.0, affordable_spp)));
+        if (pass_spp == 0)
+            break;
+
+        std::cout << " - " << (training ? "Path guiding training pass" : "Pass") << " with " << pass_spp << " spp, "
+                  << time_left.count() << " seconds left" << std::endl;
+        pass_start = Clock::now();
+        progressive_image.run_pass(pass_spp);
+        spp_time = (Clock::now() - pass_start) / pass_spp;
+        if (training) {
+            const auto refine_start = Clock::now();
+            progressive_image.refine_guiding(pass_spp);
+            refine_time = Clock::now() - refine_start;
+        }
+    }
+
+    if (progressive_image.rendered_spp() > 1)
+        save_image(scene.width(), scene.height(), progressive_image.image(), output_file_name);
+
+    const Seconds elapsed = Clock::now() - start;
+    std::cout << "Rendered " << progressive_image.rendered_spp() << " spp in " << elapsed.count() << " of "
+              << time_budget.count() << " seconds" << std::endl;
+    return progressive_image.rendered_spp();
+}
+
+void Renderer::print_settings() const {
+    std::cout << "MIS: " << (_mis_heuristic == MISHeuristic::POWER ? "power" : "balance") << " heuristic" << std::endl;
+    std::cout << "Path guiding: " << (_path_guiding ? "on" : "off") << std::endl;
+    std::cout << "Russian roulette: " << (_russian_roulette == RussianRoulette::ADRRS ? "ADRRS" : "fixed") << std::endl;
+}
+
+Renderer::ProgressiveImage::ProgressiveImage(const Renderer& renderer, const Scene& scene, unsigned int total_thread_count)
+    : _renderer(renderer), _scene(scene), _total_thread_count(total_thread_count) {
     const auto scene_size = static_cast<size_t>(scene.width()) * static_cast<size_t>(scene.height());
-    std::vector<Vector3f> frame_buffer(scene_size);
+    _frame_buffer.resize(scene_size);
+    _image_sum.resize(scene_size);
 
-    std::cout << "SPP: " << spp << std::endl;
+    if (renderer.path_guiding()) {
+        _sd_tree_ptr = std::make_unique<SDTree>(scene.bound());
+        _context.sd_tree_ptr = _sd_tree_ptr.get();
+    }
+    if (renderer.russian_roulette() == RussianRoulette::ADRRS) {
+        _radiance_cache_ptr = std::make_unique<RadianceCache>(scene.bound());
+        _context.radiance_cache_ptr = _radiance_cache_ptr.get();
+    }
+}
+
+void Renderer::ProgressiveImage::run_pass(unsigned int pass_spp) {
+    const ImageTile full_image{ 0, 0, _scene.width(), _scene.height() };
+    _renderer.render_pass(_scene, full_image, pass_spp, _total_thread_count, _context, _frame_buffer);
+    for (size_t i = 0; i < _image_sum.size(); ++i)
+        _image_sum[i] += _frame_buffer[i] * static_cast<float>(pass_spp);
+    _rendered_spp += pass_spp;
+
+    // the next passes compare the paths against the image so far
+    if (_radiance_cache_ptr != nullptr) {
+        _pixel_estimates = Renderer::pixel_estimates(_scene, _image_sum, _rendered_spp);
+        _context.pixel_estimates_ptr = &_pixel_estimates;
+    }
+}
+
+void Renderer::ProgressiveImage::refine_guiding(unsigned int pass_spp) {
+    const auto spatial_threshold = static_cast<unsigned int>(SPATIAL_SUBDIVISION_THRESHOLD * std::sqrt(static_cast<float>(pass_spp)));
+    _sd_tree_ptr->refine(spatial_threshold, DIRECTIONAL_SUBDIVISION_THRESHOLD);
+    std::cout << "   SD-tree: " << _sd_tree_ptr->leaf_count() << " spatial leaves, "
+              << _sd_tree_ptr->dtree_node_count() << " directional nodes" << std::endl;
+}
+
+std::vector<Vector3f> Renderer::ProgressiveImage::image() const {
+    std::vector<Vector3f> image(_image_sum.size());
+    for (size_t i = 0; i < image.size(); ++i)
+        image[i] = _image_sum[i] / static_cast<float>(_rendered_spp);
+    return image;
+}
+
+PrimaryHitCache Renderer::record_primary_hits(const Scene& scene, unsigned int spp, unsigned int total_thread_count) const {
+    PrimaryHitCache cache(scene.width(), scene.height(), spp, scene.eye_pos(), scene.fov());
+
+    // the threads look the materials up in their own table first, there are only a few of them
+    std::mutex material_mutex;
+    std::vector<std::unordered_map<const Material*, uint32_t>> thread_material_indices(total_thread_count);
+    for_each_pixel(static_cast<size_t>(scene.width()) * scene.height(), total_thread_count, [&](unsigned int thread_id, size_t pixel_idx) {
+        auto& material_indices = thread_material_indices[thread_id];
+
+        const auto pixel_row = static_cast<unsigned int>(pixel_idx / scene.width());
+        const auto pixel_col = static_cast<unsigned int>(pixel_idx % scene.width());
+        for (unsigned int k = 0; k < spp; ++k) {
+            const auto dir = camera_ray_dir(scene, static_cast<float>(pixel_col) + get_random_float(), static_cast<float>(pixel_row) + get_random_float());
+            auto& hit = cache.hit(pixel_idx, k);
+            hit = {};
+            hit.dir[0] = dir.x;
+            hit.dir[1] = dir.y;
+            hit.dir[2] = dir.z;
 
+            const auto intersection = scene.intersect(Ray(scene.eye_pos(), dir), Culling::BACK);
+            if (!intersection)
+                continue;
+
+            hit.pos[0] = intersection->pos.x;
+            hit.pos[1] = intersection->pos.y;
+            hit.pos[2] = intersection->pos.z;
+            hit.normal[0] = intersection->normal.x;
+            hit.normal[1] = intersection->normal.y;
+            hit.normal[2] = intersection->normal.z;
+            hit.uv[0] = intersection->uv.x;
+            hit.uv[1] = intersection->uv.y;
+
+            const auto it = material_indices.find(intersection->mat_ptr.get());
+            if (it != material_indices.end()) {
+                hit.material_idx = it->second;
+            } else {
+                std::lock_guard<std::mutex> lock(material_mutex);
+                hit.material_idx = cache.material_index(intersection->mat_ptr);
+                material_indices.emplace(intersection->mat_ptr.get(), hit.material_idx);
+            }
+        }
+    });
+
+    return cache;
+}
+
+void Renderer::reshade(const Scene& scene, PrimaryHitCache& cache, unsigned int total_thread_count, const std::string& output_file_name) const {
+    shade_cached_hits(scene, cache, nullptr, total_thread_count, output_file_name);
+}
+
+void Renderer::preview_material_edit(const Scene& scene, PrimaryHitCache& cache, const Material& edited_mat, unsigned int total_thread_count,
+                                     const std::string& output_file_name) const {
+    // the samples which missed the material have no radiance to keep before the first shade
+    shade_cached_hits(scene, cache, cache.shaded() ? &edited_mat : nullptr, total_thread_count, output_file_name);
+}
+
+void Renderer::shade_cached_hits(const Scene& scene, PrimaryHitCache& cache, const Material* only_mat_ptr, unsigned int total_thread_count,
+                                 const std::string& output_file_name) const {
+    const auto eye_pos = scene.eye_pos();
+    const auto cache_eye_pos = cache.eye_pos();
+    if (cache.width() != scene.width() || cache.height() != scene.height() || cache.fov() != scene.fov()
+        || eye_pos.x != cache_eye_pos.x || eye_pos.y != cache_eye_pos.y || eye_pos.z != cache_eye_pos.z)
+        throw std::runtime_error("the primary hits were cached for another camera");
+
+    // every sample is shaded if no camera ray hits the material
+    auto only_material_idx = PrimaryHitCache::NO_MATERIAL;
+    const auto& materials = cache.materials();
+    for (size_t i = 0; i < materials.size(); ++i) {
+        if (materials[i].get() == only_mat_ptr)
+            only_material_idx = static_cast<uint32_t>(i);
+    }
+    const auto shade_all = only_material_idx == PrimaryHitCache::NO_MATERIAL;
+
+    const PassContext context;
+    const PathState camera_path;
+    std::vector<Vector3f> frame_buffer(static_cast<size_t>(cache.width()) * cache.height());
+    for_each_pixel(frame_buffer.size(), total_thread_count, [&](unsigned int, size_t pixel_idx) {
+        Vector3f color(0.0f);
+        for (unsigned int k = 0; k < cache.spp(); ++k) {
+            auto& hit = cache.hit(pixel_idx, k);
+            if (!shade_all && hit.material_idx != only_material_idx) {
+                color += Vector3f(hit.radiance[0], hit.radiance[1], hit.radiance[2]);
+                continue;
+            }
+            const Ray ray(eye_pos, Vector3f(hit.dir[0], hit.dir[1], hit.dir[2]));
+
+            std::optional<Intersection> intersection;
+            if (hit.material_idx != PrimaryHitCache::NO_MATERIAL) {
+                intersection.emplace();
+                intersection->pos = { hit.pos[0], hit.pos[1], hit.pos[2] };
+                intersection->normal = { hit.normal[0], hit.normal[1], hit.normal[2] };
+                intersection->uv = { hit.uv[0], hit.uv[1] };
+                intersection->mat_ptr = cache.materials()[hit.material_idx];
+                intersection->time = (intersection->pos - eye_pos).magnitude();
+            }
+            const auto radiance = shade(scene, ray, intersection, context, camera_path);
+            hit.radiance[0] = radiance.x;
+            hit.radiance[1] = radiance.y;
+            hit.radiance[2] = radiance.z;
+            color += radiance;
+        }
+        frame_buffer[pixel_idx] = color / static_cast<float>(cache.spp());
+    });
+    cache.set_shaded();
+
+    save_image(cache.width(), cache.height(), frame_buffer, output_file_name);
+}
+
+void Renderer::for_each_pixel(size_t pixel_count, unsigned int total_thread_count, const std::function<void(unsigned int, size_t)>& pixel_task) {
+    // Use the amount of threads as interval to avoid mutex locking.
     std::vector<std::future<void>> thread_handles(total_thread_count);
     for (unsigned int thread_id = 0; thread_id < total_thread_count; ++thread_id) {
-        thread_handles[thread_id] = std::async(std::launch::async, &Renderer::render_thread, this, total_thread_count, thread_id, std::cref(scene), spp, std::ref(frame_buffer));
+        thread_handles[thread_id] = std::async(std::launch::async, [=, &pixel_task]() {
+            for (auto pixel_idx = static_cast<size_t>(thread_id); pixel_idx < pixel_count; pixel_idx += total_thread_count)
+                pixel_task(thread_id, pixel_idx);
+        });
     }
+    for (auto& handle : thread_handles)
+        handle.get();
+}
 
-    for (const auto& handle : thread_handles) {
-        handle.wait();
-    }
+Vector3f Renderer::camera_ray_dir(const Scene& scene, float x, float y) {
+    const auto scale = std::tan(degree_to_rad(scene.fov() * 0.5f));
+    const auto image_aspect_ratio = static_cast<float>(scene.width()) / static_cast<float>(scene.height());
+    const auto ndc_x = (2 * x / static_cast<float>(scene.width()) - 1.0f) * scale * image_aspect_ratio;
+    const auto ndc_y = (1.0f - 2 * y / static_cast<float>(scene.height())) * scale;
+    return Vector3f(-ndc_x, ndc_y, 1.0f).normalized();
+}
 
-    update_progress(1.0f);
-    std::cout << std::endl;
+std::vector<Vector3f> Renderer::render_tile(const Scene& scene, const ImageTile& tile, unsigned int spp, unsigned int total_thread_count) const {
+    std::vector<Vector3f> frame_buffer(static_cast<size_t>(tile.width) * static_cast<size_t>(tile.height));
+    PassContext context;
+    context.show_progress = false;
+    render_pass(scene, tile, spp, total_thread_count, context, frame_buffer);
+    return frame_buffer;
+}
 
+void Renderer::save_image(unsigned int width, unsigned int height, const std::vector<Vector3f>& frame_buffer, const std::string& output_file_name) {
     // save frame buffer to file with tools from stb library
-    const std::string output_file_name("output.png");
+    const auto scene_size = static_cast<size_t>(width) * static_cast<size_t>(height);
     constexpr unsigned int channel_num = 3;
     const size_t image_size = static_cast<size_t>(scene_size) * static_cast<size_t>(channel_num);
-    const auto stride_in_bytes = static_cast<size_t>(scene.width()) * channel_num * sizeof(unsigned char);
+    const auto stride_in_bytes = static_cast<size_t>(width) * channel_num * sizeof(unsigned char);
     const std::unique_ptr<unsigned char[]> pixel_data_ptr(new unsigned char[image_size]);
 
-    for (auto i = 0, idx = 0; i < scene_size; ++i) {
+    for (size_t i = 0, idx = 0; i < scene_size; ++i) {
         // pow(color, exponent) for gamma correction
-		pixel_data_ptr[idx++] = static_cast<unsigned char>(255.0f * std::pow(clamp(0.0f, 1.0f, frame_buffer[i].x), 0.6f));
+        pixel_data_ptr[idx++] = static_cast<unsigned char>(255.0f * std::pow(clamp(0.0f, 1.0f, frame_buffer[i].x), 0.6f));
         pixel_data_ptr[idx++] = static_cast<unsigned char>(255.0f * std::pow(clamp(0.0f, 1.0f, frame_buffer[i].y), 0.6f));
         pixel_data_ptr[idx++] = static_cast<unsigned char>(255.0f * std::pow(clamp(0.0f, 1.0f, frame_buffer[i].z), 0.6f));
     }
 
-    stbi_write_png(output_file_name.c_str(), static_cast<int>(scene.width()), static_cast<int>(scene.height()), channel_num, pixel_data_ptr.get(), stride_in_bytes);
+    if (stbi_write_png(output_file_name.c_str(), static_cast<int>(width), static_cast<int>(height), channel_num, pixel_data_ptr.get(), stride_in_bytes) == 0)
+        throw std::runtime_error("cannot write image " + output_file_name);
 }
 
-Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, Culling culling) const {
-    const auto intersection = scene.intersect(ray, culling);
-    if (!intersection)
-        return scene.background_color();
+Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, Culling culling, const PassContext& context, const PathState& path) const {
+    return shade(scene, ray, scene.intersect(ray, culling), context, path);
+}
+
+Vector3f Renderer::shade(const Scene& scene, const Ray& ray, const std::optional<Intersection>& intersection,
+                         const PassContext& context, const PathState& path) const {
+    if (!intersection) {
+        // escaped rays take the radiance of the environment, weighted against environment light sampling
+        const auto background = scene.background_radiance(ray.dir);
+        const auto env_light_ptr = scene.environment_light();
+        if (path.sampling_pdf == 0.0f || env_light_ptr == nullptr)
+            return background;
+        return background * mis_weight(path.sampling_pdf, env_light_ptr->pdf(ray.dir));
+    }
 
     const auto pos = intersection->pos;         // position of shading point
     const auto normal = intersection->normal;   // normal at shading point
     const auto observer_dir = -ray.dir;         // observer direction
     const auto mat_ptr = intersection->mat_ptr;             // material at shading point
 
+    // Emission of the hit light source
+    Vector3f i_emission = { 0.0f, 0.0f, 0.0f };
+    if (mat_ptr->emitting()) {
+        const auto emission = mat_ptr->emission(intersection->uv.x, intersection->uv.y);
+        if (path.sampling_pdf == 0.0f) {
+            // hit light source directly
+            i_emission = emission;
+        } else {
+            // convert the PDF of light source sampling to solid angle measure
+            const auto observer_dir_dot_normal = observer_dir.dot(normal);
+            const auto pdf_light_sample = (observer_dir_dot_normal == 0.0f) ?
+                0.0f : ((pos - ray.ori).magnitude_squared() * scene.pdf_light_sources()) / abs(observer_dir_dot_normal);
+            i_emission = emission * mis_weight(path.sampling_pdf, pdf_light_sample);
+        }
+    }
+
+    // Learned incident radiance at the shading point, near-specular surfaces only sample their BSDF
+    DTreeWrapper* dtree_ptr = nullptr;
+    if (context.sd_tree_ptr != nullptr && !mat_ptr->near_specular())
+        dtree_ptr = &context.sd_tree_ptr->dtree(pos);
+    const auto guiding = dtree_ptr != nullptr && dtree_ptr->ready();
+    const auto recording = dtree_ptr != nullptr && context.sd_tree_ptr->recording();
+
+    // PDF of sampling the indirect ray direction, the mixture of BSDF sampling and guided sampling
+    const auto pdf_indirect_sample = [&](const Vector3f& dir) {
+        const auto pdf_bsdf = mat_ptr->pdf(dir, observer_dir, normal);
+        return guiding ? lerp(pdf_bsdf, dtree_ptr->pdf(dir), GUIDING_FRACTION) : pdf_bsdf;
+    };
+
     // Direct illumination
     Vector3f i_direct = { 0.0f, 0.0f, 0.0f };
 
@@ -75,12 +384,29 @@ Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, Culling culling)
                 0.0f : (intersection_to_light_sample.magnitude_squared() * light_sample->pdf) / abs(light_dir_dot_light_sample_normal);
 
             // bsdf importance sampling
-            const auto pdf_bsdf = mat_ptr->pdf(light_sample_dir, observer_dir, normal);
+            const auto pdf_bsdf = pdf_indirect_sample(light_sample_dir);
 
-            // balanced heuristic multiple importance sampling
-            const auto pdf_sum = pdf_light_sample + pdf_bsdf;
-            if (pdf_sum > 0.0f) {
-                i_direct += emission * mat_ptr->contribution(light_sample_dir, observer_dir, normal) * abs(light_sample_dir.dot(normal)) / pdf_sum;
+            // multiple importance sampling, the BSDF sampled part is added when the indirect ray hits the light source
+            if (pdf_light_sample > 0.0f) {
+                i_direct += emission * mat_ptr->contribution(light_sample_dir, observer_dir, normal) * abs(light_sample_dir.dot(normal))
+                    * mis_weight(pdf_light_sample, pdf_bsdf) / pdf_light_sample;
+            }
+        }
+    }
+
+    // sample environment light
+    const auto env_light_ptr = scene.environment_light();
+    if (env_light_ptr != nullptr) {
+        const auto env_sample = env_light_ptr->sample();
+        if (env_sample) {
+            const auto env_sample_dir = env_sample->dir;
+            const auto env_culling = env_sample_dir.dot(normal) > 0.0f ? Culling::BACK : Culling::FRONT;
+
+            // the sample only contributes if the ray escapes the scene
+            if (!scene.intersect({ pos, env_sample_dir }, env_culling)) {
+                const auto pdf_bsdf = pdf_indirect_sample(env_sample_dir);
+                i_direct += env_sample->radiance * mat_ptr->contribution(env_sample_dir, observer_dir, normal) * abs(env_sample_dir.dot(normal))
+                    * mis_weight(env_sample->pdf, pdf_bsdf) / env_sample->pdf;
             }
         }
     }
@@ -88,58 +414,161 @@ Vector3f Renderer::cast_ray(const Scene& scene, const Ray& ray, Culling culling)
     // Indirect illumination
     Vector3f i_indirect = { 0.0f, 0.0f, 0.0f };
 
-    // Use Russian Roulette to limit the recursion depth
-    if (get_random_float() < scene.russian_roulette()) {
-        // sample a direction for indirect illumination
-        const auto indirect_light_source_dir = mat_ptr->sample_ray_source_dir(observer_dir, normal);
+    // Use Russian Roulette to limit the recursion depth, the path may also be split with ADRRS
+    float continuation_weight;
+    const auto path_count = continuation_count(scene, context, path, pos, continuation_weight);
+    for (unsigned int i = 0; i < path_count; ++i) {
+        // sample a direction for indirect illumination, from the guiding distribution with probability *GUIDING_FRACTION*
+        const auto indirect_light_source_dir = (guiding && get_random_float() < GUIDING_FRACTION) ?
+            dtree_ptr->sample() : mat_ptr->sample_ray_source_dir(observer_dir, normal);
+
+        // one-sample MIS over both sampling techniques
+        const auto pdf_indirect = pdf_indirect_sample(indirect_light_source_dir);
+        const auto bsdf = mat_ptr->contribution(indirect_light_source_dir, observer_dir, normal);
 
-        // bsdf importance sampling
-        const auto pdf_bsdf = mat_ptr->pdf(indirect_light_source_dir, observer_dir, normal);
+        if (recording)
+            dtree_ptr->add_sample();
 
-        if (pdf_bsdf > 0.0f) {
+        if (pdf_indirect > 0.0f && bsdf.magnitude_squared() > 0.0f) {
             const auto next_culling = indirect_light_source_dir.dot(normal) > 0.0f ? Culling::BACK : Culling::FRONT;
-            i_indirect = cast_ray(scene, { pos, indirect_light_source_dir }, next_culling)
-                * mat_ptr->contribution(indirect_light_source_dir, observer_dir, normal)
-                * abs(indirect_light_source_dir.dot(normal))
-                / (pdf_bsdf * scene.russian_roulette());
+            const auto weight = bsdf * abs(indirect_light_source_dir.dot(normal)) * continuation_weight / pdf_indirect;
+
+            PathState next_path;
+            next_path.throughput = path.throughput * weight;
+            next_path.pixel_estimate = path.pixel_estimate;
+            next_path.sampling_pdf = pdf_indirect;
+            next_path.depth = path.depth + 1;
+            next_path.split_count = path.split_count * path_count;
+
+            const auto incident_radiance = cast_ray(scene, { pos, indirect_light_source_dir }, next_culling, context, next_path);
+            i_indirect += incident_radiance * weight;
+
+            // the light sampled part of the emission is left out, next event estimation already handles it
+            if (recording)
+                dtree_ptr->record(indirect_light_source_dir, luminance(incident_radiance), pdf_indirect);
         }
     }
 
-    return  i_direct + i_indirect;
+    if (context.radiance_cache_ptr != nullptr)
+        context.radiance_cache_ptr->record(pos, luminance(i_indirect));
+
+    return i_emission + i_direct + i_indirect;
 }
 
-void Renderer::render_thread(unsigned int total_thread_count, unsigned int thread_id, const Scene& scene, unsigned int spp, std::vector<Vector3f>& frame_buffer) const {
-    const auto scale = std::tan(degree_to_rad(scene.fov() * 0.5f));
-    const auto image_aspect_ratio = static_cast<float>(scene.width()) / static_cast<float>(scene.height());
+unsigned int Renderer::continuation_count(const Scene& scene, const PassContext& context, const PathState& path,
+                                          const Vector3f& pos, float& weight) const {
+    if (context.radiance_cache_ptr != nullptr && path.pixel_estimate > 0.0f && path.depth < MAX_ADRRS_DEPTH) {
+        const auto adjoint = context.radiance_cache_ptr->estimate(pos);
+        if (adjoint > 0.0f) {
+            // expected contribution of the path to the pixel, relative to the pixel itself
+            const auto expected = luminance(path.throughput) * adjoint / path.pixel_estimate;
+
+            // weight window centered at 1
+            const auto lower = 2.0f / (1.0f + WEIGHT_WINDOW_SIZE);
+            const auto upper = WEIGHT_WINDOW_SIZE * lower;
+
+            // the total splitting is limited, since a poor pixel estimate could multiply the paths at every bounce
+            const auto max_split_count = std::min(MAX_SPLIT_COUNT, MAX_PATH_SPLIT_COUNT / path.split_count);
+            if (expected > upper && max_split_count > 1) {
+                const auto split_count = std::min(static_cast<unsigned int>(std::ceil(expected)), max_split_count);
+                weight = 1.0f / static_cast<float>(split_count);
+                return split_count;
+            }
+            if (expected < lower) {
+                const auto survival = std::max(expected, EPSILON);
+                weight = 1.0f / survival;
+                return get_random_float() < survival ? 1 : 0;
+            }
+            weight = 1.0f;
+            return 1;
+        }
+    }
+
+    weight = 1.0f / scene.russian_roulette();
+    return get_random_float() < scene.russian_roulette() ? 1 : 0;
+}
+
+float Renderer::mis_weight(float pdf, float other_pdf) const {
+    switch (_mis_heuristic) {
+        case MISHeuristic::BALANCE: {
+            const auto pdf_sum = pdf + other_pdf;
+            return pdf_sum > 0.0f ? pdf / pdf_sum : 0.0f;
+        } case MISHeuristic::POWER: {
+            const auto pdf_sq = pdf * pdf;
+            const auto pdf_sq_sum = pdf_sq + other_pdf * other_pdf;
+            return pdf_sq_sum > 0.0f ? pdf_sq / pdf_sq_sum : 0.0f;
+        } default: {
+            throw std::runtime_error("unknown MIS heuristic");
+        }
+    }
+}
+
+void Renderer::render_pass(const Scene& scene, const ImageTile& tile, unsigned int spp, unsigned int total_thread_count,
+                           const PassContext& context, std::vector<Vector3f>& frame_buffer) const {
+    std::vector<std::future<void>> thread_handles(total_thread_count);
+    for (unsigned int thread_id = 0; thread_id < total_thread_count; ++thread_id) {
+        thread_handles[thread_id] = std::async(std::launch::async, &Renderer::render_thread, this, total_thread_count, thread_id,
+                                               std::cref(scene), std::cref(tile), spp, std::cref(context), std::ref(frame_buffer));
+    }
 
-    const auto pixel_count = scene.width() * scene.height();
+    for (const auto& handle : thread_handles) {
+        handle.wait();
+    }
+
+    if (context.show_progress) {
+        update_progress(1.0f);
+        std::cout << std::endl;
+    }
+}
+
+void Renderer::render_thread(unsigned int total_thread_count, unsigned int thread_id, const Scene& scene, const ImageTile& tile,
+                             unsigned int spp, const PassContext& context, std::vector<Vector3f>& frame_buffer) const {
+    const auto pixel_count = tile.width * tile.height;
 
     // Use the amount of threads as interval to avoid mutex locking.
     for (auto pixel_idx = thread_id; pixel_idx < pixel_count; pixel_idx += total_thread_count) {
-        const auto pixel_row = pixel_idx / scene.width();
-        const auto pixel_col = pixel_idx % scene.width();
+        const auto pixel_row = tile.y + pixel_idx / tile.width;
+        const auto pixel_col = tile.x + pixel_idx % tile.width;
+
+        PathState camera_path;
+        if (context.pixel_estimates_ptr != nullptr)
+            camera_path.pixel_estimate = (*context.pixel_estimates_ptr)[pixel_row * scene.width() + pixel_col];
 
         Vector3f color(0.0f);
         for (unsigned int k = 0; k < spp; k++) {
             // generate primary ray direction for each sample
-            const auto x = (2 * (static_cast<float>(pixel_col) + get_random_float()) / static_cast<float>(scene.width()) - 1.0f) * scale * image_aspect_ratio;
-            const auto y = (1.0f - 2 * (static_cast<float>(pixel_row) + get_random_float()) / static_cast<float>(scene.height())) * scale;
-
-            const auto dir = Vector3f(-x, y, 1.0f).normalized();
+            const auto dir = camera_ray_dir(scene, static_cast<float>(pixel_col) + get_random_float(), static_cast<float>(pixel_row) + get_random_float());
             const Ray ray(scene.eye_pos(), dir);
 
-            const auto intersection = scene.intersect(ray, Culling::BACK);
-            if (intersection && intersection->mat_ptr->emitting()) {
-                // hit light source directly
-                color += intersection->mat_ptr->emission(intersection->uv.x, intersection->uv.y);
-            }
             // do path tracing
-            color += cast_ray(scene, ray, Culling::BACK);
+            color += cast_ray(scene, ray, Culling::BACK, context, camera_path);
         }
         frame_buffer[pixel_idx] = color / static_cast<float>(spp);
 
-        if (thread_id == 0) {
-            update_progress(static_cast<float>(pixel_row) / static_cast<float>(scene.height()));
+        if (thread_id == 0 && context.show_progress) {
+            update_progress(static_cast<float>(pixel_row - tile.y) / static_cast<float>(tile.height));
         }
     }
-}
\ No newline at end of file
+}
+
+std::vector<float> Renderer::pixel_estimates(const Scene& scene, const std::vector<Vector3f>& image_sum, unsigned int spp) {
+    const auto width = static_cast<int>(scene.width());
+    const auto height = static_cast<int>(scene.height());
+    std::vector<float> estimates(image_sum.size(), 0.0f);
+
+    for (int row = 0; row < height; ++row) {
+        for (int col = 0; col < width; ++col) {
+            float sum = 0.0f;
+            int count = 0;
+            for (int r = std::max(row - 1, 0); r <= std::min(row + 1, height - 1); ++r) {
+                for (int c = std::max(col - 1, 0); c <= std::min(col + 1, width - 1); ++c) {
+                    sum += luminance(image_sum[static_cast<size_t>(r) * width + c]);
+                    ++count;
+                }
+            }
+            estimates[static_cast<size_t>(row) * width + col] = sum / static_cast<float>(count * spp);
+        }
+    }
+
+    return estimates;
+}
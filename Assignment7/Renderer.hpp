@@ -1,35 +1,224 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
+
 #include "Scene.hpp"
+#include "PathGuiding.hpp"
+#include "RadianceCache.hpp"
+#include "PrimaryHitCache.hpp"
 
 class Renderer {
 public:
+    // Heuristic to weight the contributions of light source sampling and BSDF sampling
+    // in multiple importance sampling.
+    enum class MISHeuristic {
+        BALANCE,    // w_i = pdf_i / sum(pdf_j)
+        POWER       // w_i = pdf_i^2 / sum(pdf_j^2)
+    };
+
+    // Strategy to terminate or split paths at each bounce.
+    enum class RussianRoulette {
+        FIXED,      // survive with the constant probability of the scene
+        ADRRS       // adjoint-driven Russian roulette and splitting: keep the expected contribution
+                    // of each path close to the pixel value, estimated by a coarse first pass
+    };
+
+    // With *path_guiding* enabled, the samples are split into progressive training passes which learn
+    // the incident radiance in an SD-tree, followed by a final pass which guides the indirect rays with it.
+    explicit Renderer(MISHeuristic mis_heuristic = MISHeuristic::POWER, bool path_guiding = false,
+                      RussianRoulette russian_roulette = RussianRoulette::FIXED)
+        : _mis_heuristic(mis_heuristic), _path_guiding(path_guiding), _russian_roulette(russian_roulette) {}
+
+    // Rectangle of pixels [x, x + width) x [y, y + height) of the image
+    struct ImageTile {
+        unsigned int x = 0;
+        unsigned int y = 0;
+        unsigned int width = 0;
+        unsigned int height = 0;
+    };
+
+    MISHeuristic mis_heuristic() const { return _mis_heuristic; }
+    bool path_guiding() const { return _path_guiding; }
+    RussianRoulette russian_roulette() const { return _russian_roulette; }
+
     // The main render function. This where we iterate over all pixels in the image,
     // generate primary rays and cast these rays into the scene. The content of the
-    // frame buffer is saved to a png image file with tools from stb library.
+    // frame buffer is saved to the png image file *output_file_name* with tools from stb library.
     //
     // *spp* is for sampling amount per pixel.
     // *total_thread_count* indicates how many threads are used to do multi-thread rendering.
-    void render(const Scene& scene, unsigned int spp, unsigned int total_thread_count) const;
+    void render(const Scene& scene, unsigned int spp, unsigned int total_thread_count,
+                const std::string& output_file_name = "output.png") const;
+
+    // Render progressive passes until the image has to be written to meet the wall-clock *time_budget*, instead of
+    // a fixed number of samples. The cost of the next pass is predicted from the last one, and a pass is only started
+    // if it and the final write fit before the deadline. An image is written after the first pass of 1 spp, which is
+    // always rendered, so the file exists at the deadline even if a pass is slower than predicted.
+    // Returns the samples per pixel rendered.
+    unsigned int render_within(const Scene& scene, std::chrono::duration<double> time_budget, unsigned int total_thread_count,
+                               const std::string& output_file_name = "output.png") const;
+
+    // Trace the camera rays of *spp* samples per pixel of the current camera of *scene* and cache their hits,
+    // to shade them again with *reshade* after editing materials
+    [[nodiscard]] PrimaryHitCache record_primary_hits(const Scene& scene, unsigned int spp, unsigned int total_thread_count) const;
+
+    // Render the image of the cached camera rays of *cache* with the current parameters of the materials, tracing
+    // only the rays from the primary hits on. Every sample is shaded again, so edits also show in the reflections,
+    // refractions and indirect light of the materials. Like tiles, it is rendered with BSDF sampling and the fixed roulette.
+    void reshade(const Scene& scene, PrimaryHitCache& cache, unsigned int total_thread_count,
+                 const std::string& output_file_name = "output.png") const;
+
+    // Approximate *reshade* after editing only *edited_mat*: once all samples have been shaded, only the samples
+    // whose camera ray hits the material are shaded again and the others keep their radiance. The edit is missing
+    // wherever the material is seen in reflections or refractions and in the light it reflects onto other surfaces.
+    void preview_material_edit(const Scene& scene, PrimaryHitCache& cache, const Material& edited_mat, unsigned int total_thread_count,
+                               const std::string& output_file_name = "output.png") const;
+
+    // Render the pixels of *tile* with *spp* samples each and return their linear colors row by row,
+    // used by the workers of distributed rendering. Path guiding and ADRRS need passes over the whole
+    // image to learn from, so a tile is always rendered with BSDF sampling and the fixed roulette.
+    [[nodiscard]] std::vector<Vector3f> render_tile(const Scene& scene, const ImageTile& tile, unsigned int spp,
+                                                    unsigned int total_thread_count) const;
+
+    // Gamma-correct *frame_buffer* of linear colors and save it to the png image file *output_file_name*
+    static void save_image(unsigned int width, unsigned int height, const std::vector<Vector3f>& frame_buffer,
+                           const std::string& output_file_name);
 
 private:
+    // Data shared by all paths of a rendering pass
+    struct PassContext {
+        SDTree* sd_tree_ptr = nullptr;                              // learned incident radiance for path guiding
+        RadianceCache* radiance_cache_ptr = nullptr;                // adjoint estimate for ADRRS
+        const std::vector<float>* pixel_estimates_ptr = nullptr;    // luminance of the image rendered so far for ADRRS
+        bool show_progress = true;
+    };
+
+    // Passes over the whole image accumulated into one, with the data learned from them
+    class ProgressiveImage {
+    public:
+        ProgressiveImage(const Renderer& renderer, const Scene& scene, unsigned int total_thread_count);
+
+        // Render a pass with *pass_spp* samples and add it to the image
+        void run_pass(unsigned int pass_spp);
+        // Refine the SD-tree of path guiding with the radiance recorded by the last pass of *pass_spp* samples
+        void refine_guiding(unsigned int pass_spp);
+        // Stop recording radiance into the SD-tree, the next passes only sample it
+        void finish_training() { _sd_tree_ptr->set_recording(false); }
+
+        unsigned int rendered_spp() const { return _rendered_spp; }
+        // Mean of the passes weighted by their samples, all passes are unbiased
+        [[nodiscard]] std::vector<Vector3f> image() const;
+
+    private:
+        const Renderer& _renderer;
+        const Scene& _scene;
+        unsigned int _total_thread_count;
+
+        PassContext _context;
+        std::unique_ptr<SDTree> _sd_tree_ptr;
+        std::unique_ptr<RadianceCache> _radiance_cache_ptr;
+        std::vector<float> _pixel_estimates;
+
+        std::vector<Vector3f> _frame_buffer;
+        std::vector<Vector3f> _image_sum;
+        unsigned int _rendered_spp = 0;
+    };
+
+    void print_settings() const;
+
+    // State of the path which generates a ray
+    struct PathState {
+        Vector3f throughput = Vector3f(1.0f);   // product of BSDF * cos / pdf and roulette weights from the camera
+        float pixel_estimate = 0.0f;            // estimated luminance of the pixel, 0 if unknown
+        float sampling_pdf = 0.0f;              // PDF of sampling the ray direction, 0 for camera rays
+        unsigned int depth = 0;                 // number of bounces before the ray
+        unsigned int split_count = 1;           // number of rays the camera ray has been split into
+    };
+
     // Implementation of the path tracing algorithm
     //
     // This function cast the given ray in the given scene and does shading at the intersection point.
     //
-    // If hit nothing, return the background color.
+    // If hit nothing, return the background color or the radiance of the environment light.
     //
-    // If hit light source, return its emission.
+    // If hit light source, add its emission. For camera rays the emission is fully counted,
+    // for rays sampled from BSDF it is weighted against light source sampling with MIS.
+    // *path.sampling_pdf* is the PDF of the sample which generates the given ray, 0 for camera rays.
     //
-    // If hit other objects, the return illumination is composed of two parts:
-    //     1. the direct illumination of the light sources with multiple
-    //        importance sampling (sampling light source, sampling BRDF)
+    // The return illumination is then composed of two parts:
+    //     1. the direct illumination of the light sources and the environment light
+    //        with multiple importance sampling (sampling light source, sampling BSDF)
     //     2. the indirect illumination of the other objects that reflect
     //        the emission of the light sources.
     //
-    // Russian Roulette method is applied to limit the depth of recursion.
-    [[nodiscard]] Vector3f cast_ray(const Scene& scene, const Ray& ray, Culling culling) const;
+    // If *context.sd_tree_ptr* is given, the indirect direction is sampled from the BSDF or the learned
+    // incident radiance with one-sample MIS, and the radiance estimates are recorded while training.
+    //
+    // Russian Roulette method is applied to limit the depth of recursion, see *continuation_count*.
+    [[nodiscard]] Vector3f cast_ray(const Scene& scene, const Ray& ray, Culling culling, const PassContext& context, const PathState& path) const;
+
+    // Shading part of *cast_ray*, for the *intersection* of *ray* with the scene
+    [[nodiscard]] Vector3f shade(const Scene& scene, const Ray& ray, const std::optional<Intersection>& intersection,
+                                 const PassContext& context, const PathState& path) const;
+
+    // Number of indirect rays to continue the path with at *pos*, and the *weight* of each of them.
+    // The fixed scheme continues with one ray at the survival probability of the scene. ADRRS compares the
+    // expected contribution of the path (throughput * cached radiance) with the pixel estimate: paths far
+    // below it are killed with higher probability, paths far above it are split.
+    [[nodiscard]] unsigned int continuation_count(const Scene& scene, const PassContext& context, const PathState& path,
+                                                  const Vector3f& pos, float& weight) const;
+
+    // MIS weight of the sampling strategy with *pdf* against the other one with *other_pdf*.
+    [[nodiscard]] float mis_weight(float pdf, float other_pdf) const;
+
+    // Shade the samples of *cache* whose camera ray hits *only_mat_ptr*, or all of them without it, and save the image
+    void shade_cached_hits(const Scene& scene, PrimaryHitCache& cache, const Material* only_mat_ptr, unsigned int total_thread_count,
+                           const std::string& output_file_name) const;
+
+    // Render the pixels of *tile* with *spp* samples into *frame_buffer*, which holds the tile row by row,
+    // on *total_thread_count* threads
+    void render_pass(const Scene& scene, const ImageTile& tile, unsigned int spp, unsigned int total_thread_count,
+                     const PassContext& context, std::vector<Vector3f>& frame_buffer) const;
+
+    // Run *pixel_task*(thread id, pixel index) for every pixel of a *pixel_count* pixel image on *total_thread_count* threads
+    static void for_each_pixel(size_t pixel_count, unsigned int total_thread_count, const std::function<void(unsigned int, size_t)>& pixel_task);
+
+    // Direction of the camera ray through the point (*x*, *y*) of the image of *scene* in pixels
+    static Vector3f camera_ray_dir(const Scene& scene, float x, float y);
 
     // Rendering task function for one thread
-    void render_thread(unsigned int total_thread_count, unsigned int thread_id, const Scene& scene, unsigned int spp, std::vector<Vector3f>& frame_buffer) const;
+    void render_thread(unsigned int total_thread_count, unsigned int thread_id, const Scene& scene, const ImageTile& tile,
+                       unsigned int spp, const PassContext& context, std::vector<Vector3f>& frame_buffer) const;
+
+    // Samples of the pass estimating the pixels for ADRRS when there is no training pass of path guiding
+    static unsigned int estimation_spp(unsigned int spp) { return std::max(1u, spp / 16); }
+
+    // Luminance of the mean image, smoothed by a 3 x 3 box filter to suppress the noise of the few samples
+    static std::vector<float> pixel_estimates(const Scene& scene, const std::vector<Vector3f>& image_sum, unsigned int spp);
+
+private:
+    // probability of sampling the guiding distribution instead of the BSDF
+    static constexpr float GUIDING_FRACTION = 0.5f;
+    // samples in an S-tree leaf before it is split, scaled by sqrt(spp) of the pass
+    static constexpr float SPATIAL_SUBDIVISION_THRESHOLD = 12000.0f;
+    // share of the flux in a D-tree quadrant before it is split
+    static constexpr float DIRECTIONAL_SUBDIVISION_THRESHOLD = 0.01f;
+
+    // ratio between the upper and the lower bound of the ADRRS weight window
+    static constexpr float WEIGHT_WINDOW_SIZE = 5.0f;
+    // maximum number of rays a path is split into at one bounce, and in total
+    static constexpr unsigned int MAX_SPLIT_COUNT = 4;
+    static constexpr unsigned int MAX_PATH_SPLIT_COUNT = 16;
+    // bounces after which ADRRS falls back to the fixed scheme
+    static constexpr unsigned int MAX_ADRRS_DEPTH = 16;
+
+    // share of the time budget spent training path guiding
+    static constexpr float TRAINING_BUDGET_FRACTION = 0.5f;
+    // factor on the predicted time of a pass before it is started within a time budget
+    static constexpr double PASS_COST_MARGIN = 1.25;
+
+    MISHeuristic _mis_heuristic;
+    bool _path_guiding;
+    RussianRoulette _russian_roulette;
 };
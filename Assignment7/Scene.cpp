@@ -1,5 +1,8 @@
 #include "Scene.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
 #include <iostream>
 
 void Scene::build_BVH() {
@@ -12,10 +15,68 @@ void Scene::build_SVH() {
     _bvh_tree_ptr = std::make_unique<BVH_tree>(_obj_ptrs, BVH_tree::SplitMethod::SAH);
 }
 
+void Scene::add_object(const std::shared_ptr<Object>& obj_ptr) {
+    if (obj_ptr == nullptr)
+        return;
+    _obj_ptrs.push_back(obj_ptr);
+    if (_bvh_tree_ptr != nullptr)
+        _bvh_tree_ptr->insert(obj_ptr);
+}
+
+bool Scene::remove_object(const std::shared_ptr<Object>& obj_ptr) {
+    const auto it = std::find(_obj_ptrs.begin(), _obj_ptrs.end(), obj_ptr);
+    if (it == _obj_ptrs.end())
+        return false;
+    _obj_ptrs.erase(it);
+    if (_bvh_tree_ptr != nullptr)
+        _bvh_tree_ptr->remove(obj_ptr);
+    return true;
+}
+
+void Scene::commit_BVH() {
+    if (_bvh_tree_ptr != nullptr)
+        _bvh_tree_ptr->commit();
+}
+
+unsigned int Scene::update_BVH() {
+    // the bounds of the objects are the leaves of the scene BVH, refit them first
+    unsigned int rebuild_count = 0;
+    for (const auto& obj_ptr : _obj_ptrs) {
+        if (obj_ptr->refit())
+            ++rebuild_count;
+    }
+    if (_bvh_tree_ptr->update())
+        ++rebuild_count;
+    return rebuild_count;
+}
+
 std::optional<Intersection> Scene::intersect(const Ray& ray, Culling culling) const {
     return _bvh_tree_ptr->intersect(ray, culling);
 }
 
+void Scene::intersect(Span<const Ray> rays, Culling culling, RayQuery query, Span<HitRecord> hits, unsigned int thread_count) const {
+    if (hits.size() != rays.size())
+        throw std::runtime_error("one hit record per ray is needed");
+
+    // chunks are taken dynamically, rays hitting nothing are much cheaper than the others
+    std::atomic<size_t> next_chunk_start = 0;
+    const auto trace_chunks = [&]() {
+        for (auto start = next_chunk_start.fetch_add(BATCH_CHUNK_SIZE); start < rays.size(); start = next_chunk_start.fetch_add(BATCH_CHUNK_SIZE)) {
+            const auto count = std::min(BATCH_CHUNK_SIZE, rays.size() - start);
+            _bvh_tree_ptr->intersect(rays.subspan(start, count), culling, query, hits.subspan(start, count));
+        }
+    };
+
+    const auto chunk_count = (rays.size() + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE;
+    const auto helper_count = std::min<size_t>(std::max(1u, thread_count), chunk_count) - (chunk_count > 0 ? 1 : 0);
+    std::vector<std::future<void>> thread_handles;
+    for (size_t i = 0; i < helper_count; ++i)
+        thread_handles.push_back(std::async(std::launch::async, trace_chunks));
+    trace_chunks();
+    for (auto& handle : thread_handles)
+        handle.get();
+}
+
 std::optional<Sample> Scene::sample_light_sources() const {
     float total_emitting_area = 0.0f;
     for (const auto& obj_ptr : _obj_ptrs) {
@@ -23,6 +84,7 @@ std::optional<Sample> Scene::sample_light_sources() const {
             total_emitting_area += obj_ptr->area();
         }
     }
+    const auto init_total_emitting_area = total_emitting_area;
 
     const auto p = get_random_float();
     auto threshold = p * total_emitting_area;
@@ -35,6 +97,8 @@ std::optional<Sample> Scene::sample_light_sources() const {
             if (current_emitting_area_sum >= threshold) {
                 auto s = obj_ptr->sample();
                 if (s) {
+                    // the object is chosen with probability of its share of the emitting area
+                    s->pdf *= obj_area / init_total_emitting_area;
                     return s;
                 } else {
                     current_emitting_area_sum -= obj_area;
@@ -46,4 +110,15 @@ std::optional<Sample> Scene::sample_light_sources() const {
     }
 
     return std::nullopt;
+}
+
+float Scene::pdf_light_sources() const {
+    float total_emitting_area = 0.0f;
+    for (const auto& obj_ptr : _obj_ptrs) {
+        if (obj_ptr->emitting()) {
+            total_emitting_area += obj_ptr->area();
+        }
+    }
+
+    return total_emitting_area > 0.0f ? 1.0f / total_emitting_area : 0.0f;
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "Object.hpp"
 #include "BVH.hpp"
 #include "Ray.hpp"
+#include "EnvironmentLight.hpp"
 
 class Scene {
 public:
@@ -21,15 +22,47 @@ public:
     Vector3f background_color() const { return _background_color; }
     float russian_roulette() const { return _russian_roulette; }
 
+    // Change the image size and the camera, the objects and the BVH are kept
+    void set_camera(unsigned int w, unsigned int h, const Vector3f& eye_pos, float fov) {
+        _width = w;
+        _height = h;
+        _eye_pos = eye_pos;
+        _fov = fov;
+    }
+
+    // Radiance of rays escaping the scene, from the environment light if there is one, otherwise the background color.
+    Vector3f background_radiance(const Vector3f& dir) const { return _env_light_ptr != nullptr ? _env_light_ptr->radiance(dir) : _background_color; }
+    [[nodiscard]] std::shared_ptr<EnvironmentLight> environment_light() const { return _env_light_ptr; }
+    void set_environment_light(const std::shared_ptr<EnvironmentLight>& env_light_ptr) { _env_light_ptr = env_light_ptr; }
+
     [[nodiscard]] std::vector<std::shared_ptr<Object>> objects() const { return _obj_ptrs; }
 
-    void add_object(const std::shared_ptr<Object>& obj_ptr) { if (obj_ptr != nullptr) _obj_ptrs.push_back(obj_ptr); }
+    // Once the BVH is built, objects added or removed are inserted into it or removed from it in place instead
+    // of rebuilding it, see *BVH_tree::insert*. Call *commit_BVH* after a batch of them, before tracing.
+    // Removing returns false if the scene does not hold the object.
+    void add_object(const std::shared_ptr<Object>& obj_ptr);
+    bool remove_object(const std::shared_ptr<Object>& obj_ptr);
+    // Rebuild the compact copy of the scene BVH after objects were added or removed, see *BVH_tree::commit*
+    void commit_BVH();
 
     void build_BVH();
     void build_SVH();
+    // Refit the BVHs of the objects and of the scene after objects have moved, e.g. between the frames
+    // of an animation. Each BVH is only rebuilt when refitting has degraded it too much, see *BVH_tree::update*.
+    // Returns the number of rebuilt BVHs.
+    unsigned int update_BVH();
+
+    // Bounding box of all objects, available after the BVH is built
+    [[nodiscard]] BoundingBox bound() const { return _bvh_tree_ptr->bound(); }
 
     [[nodiscard]] std::optional<Intersection> intersect(const Ray& ray, Culling culling) const;
+    // Answer *query* for all *rays* into the caller's *hits*, one record per ray. The rays are split into chunks
+    // of BATCH_CHUNK_SIZE which *thread_count* threads take in turn, and the rays of a chunk are traversed
+    // interleaved, which is faster than one by one on scenes which do not fit in the cache.
+    void intersect(Span<const Ray> rays, Culling culling, RayQuery query, Span<HitRecord> hits, unsigned int thread_count = 1) const;
     [[nodiscard]] std::optional<Sample> sample_light_sources() const;
+    // PDF (area measure) of sampling a point on the light sources with *sample_light_sources*
+    [[nodiscard]] float pdf_light_sources() const;
 
 private:
     unsigned int  _width = 1280;
@@ -40,6 +73,9 @@ private:
     float _russian_roulette = 0.8f;
 
     std::vector<std::shared_ptr<Object>> _obj_ptrs;
+    std::shared_ptr<EnvironmentLight> _env_light_ptr;
 
     std::unique_ptr<BVH_tree> _bvh_tree_ptr;
+
+    static constexpr size_t BATCH_CHUNK_SIZE = 1024;
 };
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "TraversalBenchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <random>
+
+#include "Mesh.hpp"
+#include "Scene.hpp"
+
+namespace {
+    // Cast *rays* [start, end) one by one and count the hits
+    size_t cast_rays(const Scene& scene, const std::vector<Ray>& rays, size_t start, size_t end) {
+        size_t hit_count = 0;
+        for (auto i = start; i < end; ++i) {
+            if (scene.intersect(rays[i], Culling::NONE))
+                ++hit_count;
+        }
+        return hit_count;
+    }
+
+    // Rays per second and hit count of casting all *rays* on *total_thread_count* threads, one by one
+    // without *query*, otherwise as a batch
+    std::pair<double, size_t> measure(const Scene& scene, const std::vector<Ray>& rays, unsigned int total_thread_count,
+                                      std::optional<RayQuery> query) {
+        const auto start = std::chrono::steady_clock::now();
+        size_t hit_count = 0;
+        if (query) {
+            std::vector<HitRecord> hits(rays.size());
+            scene.intersect(rays, Culling::NONE, *query, hits, total_thread_count);
+            hit_count = static_cast<size_t>(std::count_if(hits.begin(), hits.end(), [](const HitRecord& hit) { return hit.hit(); }));
+        } else {
+            std::vector<std::future<size_t>> thread_handles(total_thread_count);
+            const auto chunk = (rays.size() + total_thread_count - 1) / total_thread_count;
+            for (unsigned int thread_id = 0; thread_id < total_thread_count; ++thread_id) {
+                const auto chunk_start = std::min(rays.size(), thread_id * chunk);
+                const auto chunk_end = std::min(rays.size(), chunk_start + chunk);
+                thread_handles[thread_id] = std::async(std::launch::async, cast_rays, std::cref(scene), std::cref(rays), chunk_start, chunk_end);
+            }
+            for (auto& handle : thread_handles)
+                hit_count += handle.get();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return { static_cast<double>(rays.size()) / elapsed.count(), hit_count };
+    }
+}
+
+void run_traversal_benchmark(unsigned int triangle_count, unsigned int ray_count, unsigned int total_thread_count) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const auto random_vector = [&]() { return Vector3f(dist(rng), dist(rng), dist(rng)); };
+
+    // small triangles scattered in the unit cube, sized so that about half of the rays pass through
+    std::cout << " - Generating " << triangle_count << " random triangles..." << std::endl;
+    const auto triangle_size = 0.3f / std::cbrt(static_cast<float>(triangle_count));
+    const auto mat_ptr = std::make_shared<Diffuse>(Vector3f(0.5f));
+    std::vector<std::shared_ptr<Triangle>> triangle_ptrs;
+    triangle_ptrs.reserve(triangle_count);
+    for (unsigned int i = 0; i < triangle_count; ++i) {
+        const auto center = random_vector();
+        triangle_ptrs.push_back(std::make_shared<Triangle>(center + triangle_size * (random_vector() - Vector3f(0.5f)),
+                                                           center + triangle_size * (random_vector() - Vector3f(0.5f)),
+                                                           center + triangle_size * (random_vector() - Vector3f(0.5f)), mat_ptr));
+    }
+
+    Scene scene;
+    const auto mesh_ptr = std::make_shared<TriangleMesh>(triangle_ptrs, BVH_tree::SplitMethod::NAIVE);
+    scene.add_object(mesh_ptr);
+    scene.build_BVH();
+
+    // from a sphere around the cube through random points inside it
+    std::vector<Ray> rays;
+    rays.reserve(ray_count);
+    const Vector3f center(0.5f);
+    for (unsigned int i = 0; i < ray_count; ++i) {
+        const auto origin = center + 1.5f * (2.0f * random_vector() - Vector3f(1.0f)).normalized();
+        rays.emplace_back(origin, (random_vector() - origin).normalized());
+    }
+
+    const auto node_bytes = mesh_ptr->quantized_bvh()->node_count() * QuantizedBVH::bytes_per_node();
+    const auto triangle_bytes = static_cast<size_t>(triangle_count) * sizeof(Triangle);
+    std::cout << "BVH nodes: " << node_bytes / (1 << 20) << " MiB, triangles: " << triangle_bytes / (1 << 20) << " MiB" << std::endl;
+
+    const auto [scalar_rate, scalar_hit_count] = measure(scene, rays, total_thread_count, std::nullopt);
+    const auto [batch_rate, batch_hit_count] = measure(scene, rays, total_thread_count, RayQuery::CLOSEST_HIT);
+    const auto [occlusion_rate, occlusion_hit_count] = measure(scene, rays, total_thread_count, RayQuery::OCCLUSION);
+    std::cout << "Scalar traversal:      " << scalar_rate * 1e-6 << " Mrays/s, " << scalar_hit_count << " hits" << std::endl;
+    std::cout << "Interleaved traversal: " << batch_rate * 1e-6 << " Mrays/s, " << batch_hit_count << " hits" << std::endl;
+    std::cout << "Interleaved occlusion: " << occlusion_rate * 1e-6 << " Mrays/s, " << occlusion_hit_count << " hits" << std::endl;
+    std::cout << "Speed-up: " << batch_rate / scalar_rate << " (closest hit), " << occlusion_rate / scalar_rate << " (occlusion)" << std::endl;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Compare scalar ray traversal with the interleaved batch traversal of *Scene::intersect* on a random triangle soup
+// of *triangle_count* triangles, which should be made large enough for its BVH and triangles to exceed the last level
+// cache. *ray_count* random rays are cast through the soup on *total_thread_count* threads, and the rays per second
+// of both modes and the size of the data are printed.
+void run_traversal_benchmark(unsigned int triangle_count, unsigned int ray_count, unsigned int total_thread_count);
@@ -1,17 +1,136 @@
 #include <chrono>
+#include <fstream>
+#include <iostream>
 
 #include "Renderer.hpp"
 #include "Scene.hpp"
 #include "Mesh.hpp"
+#include "RenderService.hpp"
+#include "DistributedRendering.hpp"
+#include "TraversalBenchmark.hpp"
+#include "OutOfCoreMesh.hpp"
+
+namespace {
+    constexpr const char* USAGE =
+        "Usage: RayTracing [--threads <count>] [--daemon <socket_path> | --coordinator <port> [--workers <count>]\n"
+        "                  | --worker <host> <port> | --frames <count> | --benchmark-traversal <triangle_count>]\n"
+        "                  [--out-of-core <budget_MiB>] [--time-budget <seconds> | --look-dev <count>] [--guiding] [--adrrs]\n"
+        "                  [environment_map.pfm]\n";
+    constexpr const char* BUNNY_PAGE_FILE_NAME = "bunny.page";
+
+    // Stream the bunny into its page file unless an earlier run already did
+    void write_bunny_page_file() {
+        if (std::ifstream(BUNNY_PAGE_FILE_NAME))
+            return;
+        std::cout << " - Writing clusters of the bunny to " << BUNNY_PAGE_FILE_NAME << "..." << std::endl;
+        build_page_file("../models/bunny/bunny.obj", BUNNY_PAGE_FILE_NAME);
+    }
+}
 
 // In the main function of the program, we create the scene (create objects and
 // lights) as well as set the options for the render (image width and height,
 // maximum recursion depth, field-of-view, etc.). We then call the render
 // function().
+//
+// Usage: see USAGE, printed for unknown options.
+// With --daemon the scene is kept in memory and render jobs are served over the socket, see RenderService.
+// With --coordinator the image is split into tile jobs for the worker processes started with --worker,
+// --workers starts that many of them on this machine, see TileCoordinator.
+// With --frames a turntable of the bunny is rendered into frame_0000.png, ..., refitting the BVHs between the frames.
+// With --benchmark-traversal the scalar and the interleaved BVH traversal are compared on a random triangle soup.
+// With --out-of-core the bunny is streamed into bunny.page once and its clusters are paged in on demand,
+// keeping at most budget_MiB of them in memory, see OutOfCoreMesh.
+// With --time-budget the image is rendered in as many samples as fit in that many seconds instead of spp,
+// see Renderer::render_within.
+// With --guiding the indirect rays are guided by the incident radiance learned in an SD-tree, see Renderer.
+// With --adrrs paths are killed or split by adjoint-driven Russian roulette instead of a fixed survival probability.
+// With --look-dev the camera rays are traced once, then the roughness of the bunny is swept over that many images
+// which shade the cached hits again, see Renderer::reshade.
 int main(int argc, char** argv) {
+    std::string socket_path;
+    std::string env_map_file_name;
+    unsigned int total_thread_count = 8;
+    int coordinator_port = -1;
+    unsigned int local_worker_count = 0;
+    std::string coordinator_host;
+    int worker_port = -1;
+    unsigned int frame_count = 0;
+    unsigned int benchmark_triangle_count = 0;
+    int out_of_core_budget_mib = -1;
+    double time_budget = 0.0;
+    unsigned int look_dev_count = 0;
+    bool path_guiding = false;
+    auto russian_roulette = Renderer::RussianRoulette::FIXED;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "--daemon" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            total_thread_count = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--coordinator" && i + 1 < argc) {
+            coordinator_port = std::stoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            local_worker_count = static_cast<unsigned int>(std::max(0, std::stoi(argv[++i])));
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frame_count = static_cast<unsigned int>(std::max(0, std::stoi(argv[++i])));
+        } else if (arg == "--benchmark-traversal" && i + 1 < argc) {
+            benchmark_triangle_count = static_cast<unsigned int>(std::max(0, std::stoi(argv[++i])));
+        } else if (arg == "--look-dev" && i + 1 < argc) {
+            look_dev_count = static_cast<unsigned int>(std::max(0, std::stoi(argv[++i])));
+        } else if (arg == "--time-budget" && i + 1 < argc) {
+            time_budget = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--out-of-core" && i + 1 < argc) {
+            out_of_core_budget_mib = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--guiding") {
+            path_guiding = true;
+        } else if (arg == "--adrrs") {
+            russian_roulette = Renderer::RussianRoulette::ADRRS;
+        } else if (arg == "--worker" && i + 2 < argc) {
+            coordinator_host = argv[++i];
+            worker_port = std::stoi(argv[++i]);
+        } else if (!arg.empty() && arg[0] == '-') {
+            // unknown options and options missing their values are not taken for the environment map
+            std::cerr << "unknown option or missing value: " << arg << "\n" << USAGE;
+            return 1;
+        } else {
+            env_map_file_name = arg;
+        }
+    }
+
+    if (benchmark_triangle_count > 0) {
+        run_traversal_benchmark(benchmark_triangle_count, 1000000, total_thread_count);
+        return 0;
+    }
+
     Scene scene(1024, 1024, {278.0f, 273.0f, -800.0f}, 40.0f);
     constexpr unsigned int spp = 16;
-    constexpr unsigned int total_thread_count = 8;
+
+    // the coordinator only hands out tiles, the workers load the scene themselves
+    if (coordinator_port >= 0) {
+        const auto threads_per_worker = std::max(1u, total_thread_count / std::max(1u, local_worker_count));
+        std::vector<std::string> worker_command = { argv[0], "--worker", "127.0.0.1", std::to_string(coordinator_port),
+                                                    "--threads", std::to_string(threads_per_worker) };
+        if (path_guiding)
+            worker_command.push_back("--guiding");
+        if (russian_roulette == Renderer::RussianRoulette::ADRRS)
+            worker_command.push_back("--adrrs");
+        if (out_of_core_budget_mib >= 0) {
+            worker_command.push_back("--out-of-core");
+            worker_command.push_back(std::to_string(out_of_core_budget_mib));
+            // written once here, so the local workers do not all write it at the same time
+            write_bunny_page_file();
+        }
+        if (!env_map_file_name.empty())
+            worker_command.push_back(env_map_file_name);
+
+        const auto start = std::chrono::steady_clock::now();
+        TileCoordinator coordinator(scene, spp);
+        const auto frame_buffer = coordinator.run(static_cast<uint16_t>(coordinator_port), local_worker_count, worker_command);
+        Renderer::save_image(scene.width(), scene.height(), frame_buffer, "output.png");
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Render complete in " << elapsed.count() << " seconds" << std::endl;
+        return 0;
+    }
 
     const auto light_emission = Vector3f(8.0f * Vector3f(0.747f + 0.058f, 0.747f + 0.258f, 0.747f)
                                      + 15.6f * Vector3f(0.740f + 0.287f, 0.740f + 0.160f, 0.740f)
@@ -31,7 +150,6 @@ int main(int argc, char** argv) {
     const auto left_wall_triangles = load_triangles_from_model_file("../models/cornellbox/left.obj", red_diffuse_mat_ptr);
     const auto right_wall_triangles = load_triangles_from_model_file("../models/cornellbox/right.obj", green_diffuse_mat_ptr);
     const auto tall_box_triangles = load_triangles_from_model_file("../models/cornellbox/tallbox.obj", marble_mat_ptr);
-    const auto bunny_triangles = load_triangles_from_model_file("../models/bunny/bunny.obj", silver_mat_ptr);
     const auto ceiling_lamp_triangles = load_triangles_from_model_file("../models/cornellbox/light.obj", light_mat_ptr);
 
     std::cout << " - Generating triangle mesh for ceiling, floor and back wall..." << std::endl;
@@ -40,8 +158,20 @@ int main(int argc, char** argv) {
     const auto left_wall_ptr = std::make_shared<TriangleMesh>(left_wall_triangles, BVH_tree::SplitMethod::NAIVE);
     std::cout << " - Generating triangle mesh for right wall..." << std::endl;
     const auto right_wall_ptr = std::make_shared<TriangleMesh>(right_wall_triangles, BVH_tree::SplitMethod::NAIVE);
-    std::cout << " - Generating triangle mesh for short box..." << std::endl;
-    const auto bunny_ptr = std::make_shared<TriangleMesh>(bunny_triangles, BVH_tree::SplitMethod::NAIVE);
+    // the bunny is either in memory as a whole or paged in by clusters
+    std::shared_ptr<TriangleMesh> bunny_ptr;
+    std::shared_ptr<Object> bunny_obj_ptr;
+    GeometryCache geometry_cache(static_cast<size_t>(std::max(0, out_of_core_budget_mib)) << 20);
+    if (out_of_core_budget_mib >= 0) {
+        write_bunny_page_file();
+        std::cout << " - Generating cluster BVH for the bunny..." << std::endl;
+        bunny_obj_ptr = std::make_shared<OutOfCoreMesh>(BUNNY_PAGE_FILE_NAME, silver_mat_ptr, geometry_cache);
+    } else {
+        std::cout << " - Generating triangle mesh for bunny..." << std::endl;
+        bunny_ptr = std::make_shared<TriangleMesh>(load_triangles_from_model_file("../models/bunny/bunny.obj", silver_mat_ptr),
+                                                   BVH_tree::SplitMethod::NAIVE);
+        bunny_obj_ptr = bunny_ptr;
+    }
     std::cout << " - Generating triangle mesh for tall box..." << std::endl;
     const auto tall_box_ptr = std::make_shared<TriangleMesh>(tall_box_triangles, BVH_tree::SplitMethod::NAIVE);
     std::cout << " - Generating triangle mesh for ceiling lamp..." << std::endl;
@@ -52,24 +182,98 @@ int main(int argc, char** argv) {
     scene.add_object(ceil_floor_back_wall_ptr);
     scene.add_object(left_wall_ptr);
     scene.add_object(right_wall_ptr);
-    scene.add_object(bunny_ptr);
+    scene.add_object(bunny_obj_ptr);
     scene.add_object(tall_box_ptr);
     scene.add_object(ceiling_lamp_ptr);
     scene.add_object(glass_ball_ptr);
 
+    // optional HDR environment map in PFM format
+    if (!env_map_file_name.empty()) {
+        scene.set_environment_light(std::make_shared<EnvironmentLight>(env_map_file_name));
+    }
+
     scene.build_BVH();
 
-    Renderer r;
+    Renderer r(Renderer::MISHeuristic::POWER, path_guiding, russian_roulette);
+
+    if (!socket_path.empty()) {
+        RenderService service(scene, r, total_thread_count);
+        service.run(socket_path);
+        return 0;
+    }
+
+    if (worker_port >= 0) {
+        TileWorker worker(scene, r, total_thread_count);
+        worker.run(coordinator_host, static_cast<uint16_t>(worker_port));
+        return 0;
+    }
+
+    if (frame_count > 0) {
+        // the bunny turns around its center while the glass ball bounces, out-of-core meshes stay in place
+        const auto bunny_center = bunny_obj_ptr->bound().centroid();
+        const auto ball_center = glass_ball_ptr->center();
+        for (unsigned int frame = 0; frame < frame_count; ++frame) {
+            const auto angle = 2.0f * PI * static_cast<float>(frame) / static_cast<float>(frame_count);
+            const auto sin_angle = std::sin(angle);
+            const auto cos_angle = std::cos(angle);
+            if (bunny_ptr != nullptr) {
+                bunny_ptr->transform([&](const Vector3f& v) {
+                    const auto d = v - bunny_center;
+                    return bunny_center + Vector3f(cos_angle * d.x + sin_angle * d.z, d.y, cos_angle * d.z - sin_angle * d.x);
+                });
+            }
+            glass_ball_ptr->set_center(ball_center + Vector3f(0.0f, 60.0f * std::abs(sin_angle), 0.0f));
+
+            const auto update_start = std::chrono::steady_clock::now();
+            const auto rebuild_count = scene.update_BVH();
+            const std::chrono::duration<double, std::milli> update_time = std::chrono::steady_clock::now() - update_start;
+            std::cout << " - Frame " << frame << ": BVHs updated in " << update_time.count() << " ms, "
+                      << rebuild_count << " rebuilt" << std::endl;
+
+            char file_name[32];
+            std::snprintf(file_name, sizeof(file_name), "frame_%04u.png", frame);
+            r.render(scene, spp, total_thread_count, file_name);
+        }
+        return 0;
+    }
+
+    if (look_dev_count > 0) {
+        const auto record_start = std::chrono::steady_clock::now();
+        auto primary_hit_cache = r.record_primary_hits(scene, spp, total_thread_count);
+        const std::chrono::duration<double> record_time = std::chrono::steady_clock::now() - record_start;
+        std::cout << " - Cached " << spp << " primary hits per pixel (" << (primary_hit_cache.byte_size() >> 20) << " MiB) in "
+                  << record_time.count() << " seconds" << std::endl;
+
+        for (unsigned int i = 0; i < look_dev_count; ++i) {
+            const auto roughness = lerp(0.01f, 0.6f, static_cast<float>(i) / static_cast<float>(std::max(1u, look_dev_count - 1)));
+            silver_mat_ptr->set_roughness(roughness);
+
+            char file_name[32];
+            std::snprintf(file_name, sizeof(file_name), "look_dev_%02u.png", i);
+            const auto reshade_start = std::chrono::steady_clock::now();
+            r.reshade(scene, primary_hit_cache, total_thread_count, file_name);
+            const std::chrono::duration<double> reshade_time = std::chrono::steady_clock::now() - reshade_start;
+            std::cout << " - " << file_name << ": bunny roughness " << roughness << ", shaded in " << reshade_time.count() << " seconds" << std::endl;
+        }
+        return 0;
+    }
 
     std::cout << " - Rendering Scene..." << std::endl;
     const auto start = std::chrono::system_clock::now();
-    r.render(scene, spp, total_thread_count);
+    if (time_budget > 0.0)
+        r.render_within(scene, std::chrono::duration<double>(time_budget), total_thread_count);
+    else
+        r.render(scene, spp, total_thread_count);
     const auto stop = std::chrono::system_clock::now();
 
     std::cout << "Render complete: \n";
     std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << " hours\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() << " minutes\n";
     std::cout << "          : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() << " seconds\n";
+    if (out_of_core_budget_mib >= 0) {
+        std::cout << "Geometry cache: " << geometry_cache.hit_count() << " hits, " << geometry_cache.miss_count() << " misses, "
+                  << geometry_cache.eviction_count() << " evictions, " << (geometry_cache.resident_bytes() >> 10) << " KiB resident\n";
+    }
 
     return 0;
 }
\ No newline at end of file